@@ -15,6 +15,7 @@ public:
 		CastsShadows = true;
 		ReceivesShadows = true;
 		Lit = true;
+		ParallelUpdate = true;
 		SetModel(model);
 		SetGlobalPosition(position);
 		LookAtGlobal(position + direction);
@@ -29,8 +30,9 @@ public:
 		bool enemyHit = _enemyManager->CheckCollision(GetGlobalPosition());
 		_lifetime -= (float)dt;
 		if (enemyHit || _lifetime < 0) {
-			_renderer->RemoveObject(this);
-			delete(this);
+			sg::CommandBuffer* commands = _renderer->GetCommands();
+			commands->RemoveObject(this);
+			commands->Delete(this);
 		}
 	}
 };
\ No newline at end of file
@@ -2,6 +2,8 @@
 
 #include <sgEngine.h>
 #include <glm/glm/gtc/random.hpp>
+#include <mutex>
+#include <vector>
 
 class EnemyManager : public sg::Entity3D {
 private:
@@ -10,6 +12,9 @@ private:
 	sg::Renderer* _renderer;
 	float _speed;
 	glm::vec2 _spawnPoints[7];
+	std::vector<sg::Entity3D*> _zombies;
+	std::vector<sg::Entity3D*> _killed;
+	std::mutex _killMutex;
 
 	void AddEnemy(float x, float z) {
 		sg::Object3D* enemy = new sg::Object3D();
@@ -49,7 +54,7 @@ public:
 		_renderer = renderer;
 		_player = player;
 		_enemyModel = new sg::Model();
-		_enemyModel->LoadFromObj(modelPath);
+		_enemyModel->LoadFromObjAsync(modelPath, renderer->GetJobSystem());
 		_speed = speed;
 
 		_renderer->AddEntity(this);
@@ -60,26 +65,40 @@ public:
 		AddEnemy(-15, 0);
 	}
 
+	// Each zombie only moves itself, so they are split across the job threads
 	void Update(double dt) override {
-		for (const auto& child : _children) {
-			child->LookAtGlobal(_player->GetGlobalPosition());
-			child->TranslateGlobal((float)dt * _speed * child->GlobalForward());
-		}
+		_zombies.assign(_children.begin(), _children.end());
+		glm::vec3 target = _player->GetGlobalPosition();
+		_renderer->GetJobSystem()->ParallelFor((int)_zombies.size(), 0, [this, dt, target](int first, int last) {
+			for (int i = first; i < last; i++) {
+				_zombies[i]->LookAtGlobal(target);
+				_zombies[i]->TranslateGlobal((float)dt * _speed * _zombies[i]->GlobalForward());
+			}
+		});
 	}
 
+	// Called by bullets from the job threads: the first bullet to reach a zombie claims it, and the
+	// removal and the new spawns wait for the end of the update phase
 	bool CheckCollision(glm::vec3 position) {
+		std::lock_guard<std::mutex> lock(_killMutex);
 		sg::Object3D* toDelete = NULL;
 		for (const auto& child : _children) {
-			if (glm::distance2(child->GetGlobalPosition(), position) < 1) {
+			if (glm::distance2(child->GetGlobalPosition(), position) < 1
+				&& std::find(_killed.begin(), _killed.end(), child) == _killed.end()) {
 				toDelete = dynamic_cast<sg::Object3D*>(child);
 				break;
 			}
 		}
 		if (toDelete != NULL) {
-			_renderer->RemoveObject(toDelete);
-			RemoveChild(toDelete, false);
-			delete(toDelete);
-			SpawnZombies(2);
+			_killed.push_back(toDelete);
+			sg::CommandBuffer* commands = _renderer->GetCommands();
+			commands->RemoveObject(toDelete);
+			commands->SetParent(toDelete, NULL, false);
+			commands->Delete(toDelete);
+			commands->Call([this, toDelete]() {
+				_killed.erase(std::find(_killed.begin(), _killed.end(), toDelete));
+				SpawnZombies(2);
+			});
 			return true;
 		}
 		return false;
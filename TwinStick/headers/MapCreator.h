@@ -16,7 +16,6 @@ private:
 
     std::vector<sg::Object3D*> _lampObjs;
     std::vector<sg::PointLight3D*> _lampLights;
-    bool _topLightsInScene;
 
     std::vector<sg::Object3D*> _trees;
 
@@ -27,6 +26,7 @@ private:
             treeObj->Lit = true;
             treeObj->CastsShadows = true;
             treeObj->ReceivesShadows = true;
+            treeObj->Static = true;
             treeObj->SetGlobalPosition(glm::linearRand(min, max));
             treeObj->RotateGlobal(treeObj->GlobalUp(), glm::linearRand(0.0f, 3.1415926535f));
             _trees.push_back(treeObj);
@@ -36,7 +36,7 @@ private:
 
     void PlaceLamps() {
         _lampModel = new sg::Model();
-        _lampModel->LoadFromObj("res/models/streetlamp.obj");
+        _lampModel->LoadFromObjAsync("res/models/streetlamp.obj", _renderer->GetJobSystem());
         for (int i = 0; i < 2; i++) {
             for (int j = 0; j < 2; j++) {
                 sg::Object3D* lampObj = new sg::Object3D();
@@ -45,6 +45,7 @@ private:
                 lampObj->Lit = true;
                 lampObj->CastsShadows = true;
                 lampObj->ReceivesShadows = true;
+                lampObj->Static = true;
 
                 sg::PointLight3D* lampLight = new sg::PointLight3D(512, 0.05, 20);
                 lampLight->SetIntensity(2);
@@ -55,12 +56,9 @@ private:
                 _lampObjs.push_back(lampObj);
                 _lampLights.push_back(lampLight);
                 _renderer->AddObject(lampObj);
-                if (j == 0) {
-                    _renderer->AddLight(lampLight);
-                }
+                _renderer->AddLight(lampLight);
             }
         }
-        _topLightsInScene = true;
     }
 
 public:
@@ -72,24 +70,28 @@ public:
         _siloObj2 = new sg::Object3D();
         _treeModel = new sg::Model();
 
-        _mapObj->LoadModelFromObj("res/models/map.obj");
+        _mapObj->LoadModelFromObjAsync("res/models/map.obj", renderer->GetJobSystem());
         _mapObj->Lit = true;
         _mapObj->ReceivesShadows = true;
         _mapObj->PerformFrustumCheck = false;
+        _mapObj->Static = true;
 
-        _shedObj->LoadModelFromObj("res/models/shed.obj");
+        _shedObj->LoadModelFromObjAsync("res/models/shed.obj", renderer->GetJobSystem());
         _shedObj->Lit = true;
         _shedObj->CastsShadows = true;
         _shedObj->ReceivesShadows = true;
+        _shedObj->Static = true;
 
-        _siloObj->LoadModelFromObj("res/models/silo.obj");
+        _siloObj->LoadModelFromObjAsync("res/models/silo.obj", renderer->GetJobSystem());
         _siloObj->Lit = true;
         _siloObj->CastsShadows = true;
         _siloObj->ReceivesShadows = true;
+        _siloObj->Static = true;
         _siloObj2->SetModel(_siloObj->GetModel());
         _siloObj2->Lit = true;
         _siloObj2->CastsShadows = true;
         _siloObj2->ReceivesShadows = true;
+        _siloObj2->Static = true;
         _siloObj2->SetGlobalPosition(0, 0, 15);
 
         renderer->AddObject(_mapObj);
@@ -97,7 +99,7 @@ public:
         renderer->AddObject(_siloObj);
         renderer->AddObject(_siloObj2);
 
-        _treeModel->LoadFromObj("res/models/tree.obj");
+        _treeModel->LoadFromObjAsync("res/models/tree.obj", renderer->GetJobSystem());
         GenerateTrees(10, glm::vec3(-40, 0, -30), glm::vec3(-13, 0, -23));
         GenerateTrees(10, glm::vec3(13, 0, -30), glm::vec3(40, 0, -23));
         GenerateTrees(10, glm::vec3(-40, 0, 15), glm::vec3(-32, 0, 40));
@@ -107,21 +109,6 @@ public:
         PlaceLamps();
 	}
 
-    void SwapLights() {
-        if (_topLightsInScene) {
-            _renderer->RemoveLight(_lampLights[0]);
-            _renderer->RemoveLight(_lampLights[2]);
-            _renderer->AddLight(_lampLights[1]);
-            _renderer->AddLight(_lampLights[3]);
-        } else {
-            _renderer->RemoveLight(_lampLights[1]);
-            _renderer->RemoveLight(_lampLights[3]);
-            _renderer->AddLight(_lampLights[0]);
-            _renderer->AddLight(_lampLights[2]);
-        }
-        _topLightsInScene = !_topLightsInScene;
-    }
-
 	~MapCreator() {
         delete(_mapObj);
         delete(_shedObj);
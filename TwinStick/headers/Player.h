@@ -17,7 +17,7 @@ public:
 		_speed = speed;
 
 		_playerObj = new sg::Object3D();
-		_playerObj->LoadModelFromObj("res/models/player.obj");
+		_playerObj->LoadModelFromObjAsync("res/models/player.obj", renderer->GetJobSystem());
 		_playerObj->Lit = true;
 		_playerObj->CastsShadows = true;
 		_playerObj->ReceivesShadows = true;
@@ -9,7 +9,8 @@ namespace sg {
 	class AngledLight3D : public View3D, public ShadowedLight3D {
 	private:
 		glm::mat4 _shadowMatrix;
-		sg::FrameBuffer *_depthBuffer;
+		sg::AtlasTile _atlasTile;
+		glm::vec4 _atlasRect;
 
 		void SetBoundingBox() {
 			const float farPlane = GetFarPlane();
@@ -54,26 +55,29 @@ namespace sg {
 	public:
 		AngledLight3D(int width, int height, float fov, float aspectRatio, float nearPlane, float farPlane) : View3D(fov, aspectRatio, nearPlane, farPlane) {
 			_shadowMatrix = glm::mat4(1);
-			_depthBuffer = new sg::FrameBuffer(width, height, false, true, false, false);
+			_atlasTile = AtlasTile{ 0, 0, 0 };
+			_atlasRect = glm::vec4(0);
 			SetShadowWidth(width);
 			SetShadowHeight(height);
 		}
 
-		GLuint GetShadowTexture() {
-			return _depthBuffer->depthMap;
+		// The light's shadow map is a tile of the renderer's shadow atlas; the shaders read it
+		// through the rect (offset and scale in atlas UVs) so the shadow matrix stays in [0, 1]
+		void SetAtlasTile(sg::AtlasTile tile, int atlasSize) {
+			_atlasTile = tile;
+			_atlasRect = glm::vec4(tile.x, tile.y, tile.size, tile.size) / (float)atlasSize;
 		}
 
-		sg::FrameBuffer GetShadowBuffer() const {
-			return *_depthBuffer;
+		sg::AtlasTile GetAtlasTile() const {
+			return _atlasTile;
 		}
 
-		glm::mat4 GetShadow() const {
-			return _shadowMatrix;
+		glm::vec4 GetAtlasRect() const {
+			return _atlasRect;
 		}
 
-		~AngledLight3D() {
-			_depthBuffer->FreeTextures();
-			delete(_depthBuffer);
+		glm::mat4 GetShadow() const {
+			return _shadowMatrix;
 		}
 	};
 }
\ No newline at end of file
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <vector>
+#include <functional>
+#include <sgObject3D.h>
+#include <sgLight.h>
+
+namespace sg {
+	enum CommandType {
+		CommandAddEntity,
+		CommandRemoveEntity,
+		CommandAddObject,
+		CommandRemoveObject,
+		CommandAddLight,
+		CommandRemoveLight,
+		CommandSetParent,
+		CommandDelete,
+		CommandCall
+	};
+
+	struct Command {
+		CommandType type;
+		Entity3D* entity;
+		Object3D* object;
+		Light* light;
+		Entity3D* parent;
+		bool keepLocal;
+		std::function<void()> call;
+	};
+
+	// Structural changes recorded during the update phase, while other threads may be walking the
+	// scene, and carried out by the renderer at the end of it. Each job thread records into its own
+	// buffer, so recording takes no lock.
+	class CommandBuffer {
+	private:
+		std::vector<Command> _commands;
+
+		void Record(CommandType type, Entity3D* entity, Object3D* object, Light* light) {
+			Command command = Command();
+			command.type = type;
+			command.entity = entity;
+			command.object = object;
+			command.light = light;
+			_commands.push_back(command);
+		}
+
+	public:
+		void AddEntity(Entity3D* entity) { Record(CommandAddEntity, entity, NULL, NULL); }
+		void RemoveEntity(Entity3D* entity) { Record(CommandRemoveEntity, entity, NULL, NULL); }
+		void AddObject(Object3D* object) { Record(CommandAddObject, NULL, object, NULL); }
+		void RemoveObject(Object3D* object) { Record(CommandRemoveObject, NULL, object, NULL); }
+		void AddLight(Light* light) { Record(CommandAddLight, NULL, NULL, light); }
+		void RemoveLight(Light* light) { Record(CommandRemoveLight, NULL, NULL, light); }
+
+		// Deletes are held back until every other command has run, and an entity deleted twice is deleted once
+		void Delete(Entity3D* entity) { Record(CommandDelete, entity, NULL, NULL); }
+
+		// Moves child under parent, or detaches it when parent is NULL
+		void SetParent(Entity3D* child, Entity3D* parent, bool keepLocal) {
+			Record(CommandSetParent, child, NULL, NULL);
+			_commands.back().parent = parent;
+			_commands.back().keepLocal = keepLocal;
+		}
+
+		// Any other change that must wait for the sync point, such as spawning through game code
+		void Call(const std::function<void()>& call) {
+			Record(CommandCall, NULL, NULL, NULL);
+			_commands.back().call = call;
+		}
+
+		std::vector<Command>& GetCommands() {
+			return _commands;
+		}
+
+		void Clear() {
+			_commands.clear();
+		}
+	};
+}
\ No newline at end of file
@@ -0,0 +1,277 @@
+#pragma once
+
+#include <GL/glew.h>
+#include <vector>
+#include <sgUtils.h>
+#include <sgCamera3D.h>
+#include <sgSpotLight3D.h>
+#include <sgStructures.h>
+
+// The G-buffer and accumulation textures sit on units the forward path never binds
+#define DEFERRED_GBUFFER_UNIT 16
+#define DEFERRED_ACCUMULATION_UNIT 20
+#define DEFERRED_SPHERE_RINGS 8
+#define DEFERRED_SPHERE_SEGMENTS 12
+
+namespace sg {
+	// Deferred path: lit objects write albedo, specular, normal and view depth into a G-buffer,
+	// then every light adds its contribution in screen space. Directional and ambient lights
+	// cover the screen; point lights draw spheres and spot lights their frustum, back faces only
+	// and with the depth test reversed, so pixels behind a volume are rejected before shading.
+	// The result is accumulated in an offscreen target that shares the G-buffer depth, so unlit
+	// objects and the skybox can still be drawn forward on top before it is presented.
+	class DeferredShading {
+	private:
+		ShaderProgram* _geometryProgram;
+		ShaderProgram* _geometryUnshadowedProgram;
+		ShaderProgram* _directionalProgram;
+		ShaderProgram* _pointProgram;
+		ShaderProgram* _spotProgram;
+		ShaderProgram* _presentProgram;
+		FrameBuffer* _gBuffer = NULL;
+		FrameBuffer* _accumulation = NULL;
+		int _width = 0;
+		int _height = 0;
+
+		GLuint _fullscreenVAO = 0;
+		GLuint _fullscreenVBO = 0;
+		GLuint _fullscreenEBO = 0;
+		GLuint _sphereVAO = 0;
+		GLuint _sphereVBO = 0;
+		GLuint _sphereEBO = 0;
+		int _sphereIndices = 0;
+		GLuint _cubeVAO = 0;
+		GLuint _cubeVBO = 0;
+		GLuint _cubeEBO = 0;
+		int _cubeIndices = 0;
+
+		static GLuint CreateMesh(const std::vector<glm::vec3>& positions, const std::vector<GLuint>& indices, GLuint& vbo, GLuint& ebo) {
+			GLuint vao;
+			glGenVertexArrays(1, &vao);
+			GLState::BindVertexArray(vao);
+			vbo = GLState::CreateBuffer();
+			GLState::BufferData(GL_ARRAY_BUFFER, vbo, positions.size() * sizeof(glm::vec3), positions.data(), GL_STATIC_DRAW);
+			GLState::BindBuffer(GL_ARRAY_BUFFER, vbo);
+			glEnableVertexAttribArray(0);
+			glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(glm::vec3), (GLvoid*)0);
+			glGenBuffers(1, &ebo);
+			GLState::BindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
+			glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(GLuint), indices.data(), GL_STATIC_DRAW);
+			GLState::BindVertexArray(0);
+			return vao;
+		}
+
+		// Unit sphere, pushed out so that its flat faces still contain the round one
+		void CreateSphere() {
+			std::vector<glm::vec3> positions;
+			std::vector<GLuint> indices;
+			const float pi = 3.14159265358979323846f;
+			const float scale = 1 / (cosf(pi / DEFERRED_SPHERE_SEGMENTS) * cosf(pi / (2 * DEFERRED_SPHERE_RINGS)));
+			for (int r = 0; r <= DEFERRED_SPHERE_RINGS; r++) {
+				float theta = pi * r / DEFERRED_SPHERE_RINGS;
+				for (int s = 0; s <= DEFERRED_SPHERE_SEGMENTS; s++) {
+					float phi = 2 * pi * s / DEFERRED_SPHERE_SEGMENTS;
+					positions.push_back(scale * glm::vec3(sinf(theta) * cosf(phi), cosf(theta), sinf(theta) * sinf(phi)));
+				}
+			}
+			for (int r = 0; r < DEFERRED_SPHERE_RINGS; r++) {
+				for (int s = 0; s < DEFERRED_SPHERE_SEGMENTS; s++) {
+					GLuint a = r * (DEFERRED_SPHERE_SEGMENTS + 1) + s;
+					GLuint b = a + 1;
+					GLuint c = a + DEFERRED_SPHERE_SEGMENTS + 1;
+					GLuint d = c + 1;
+					indices.insert(indices.end(), { a, b, c, b, d, c });
+				}
+			}
+			_sphereIndices = (int)indices.size();
+			_sphereVAO = CreateMesh(positions, indices, _sphereVBO, _sphereEBO);
+		}
+
+		// The clip-space cube; a spot light's inverse view projection turns it into the light's frustum
+		void CreateCube() {
+			std::vector<glm::vec3> positions;
+			for (int i = 0; i < 8; i++) {
+				positions.push_back(glm::vec3((i & 1) ? 1 : -1, (i & 2) ? 1 : -1, (i & 4) ? 1 : -1));
+			}
+			std::vector<GLuint> indices = {
+				0, 4, 6, 0, 6, 2,
+				1, 3, 7, 1, 7, 5,
+				0, 1, 5, 0, 5, 4,
+				2, 6, 7, 2, 7, 3,
+				0, 2, 3, 0, 3, 1,
+				4, 5, 7, 4, 7, 6
+			};
+			_cubeIndices = (int)indices.size();
+			_cubeVAO = CreateMesh(positions, indices, _cubeVBO, _cubeEBO);
+		}
+
+		void CreateFullscreenTriangle() {
+			std::vector<glm::vec3> positions = { glm::vec3(-1, -1, 0), glm::vec3(3, -1, 0), glm::vec3(-1, 3, 0) };
+			std::vector<GLuint> indices = { 0, 1, 2 };
+			_fullscreenVAO = CreateMesh(positions, indices, _fullscreenVBO, _fullscreenEBO);
+		}
+
+		void FreeTargets() {
+			if (_gBuffer == NULL) return;
+			_accumulation->FreeTextures();
+			GLState::DeleteFramebuffer(_accumulation->bufferIndex);
+			delete(_accumulation);
+			_gBuffer->FreeTextures();
+			GLState::DeleteFramebuffer(_gBuffer->bufferIndex);
+			delete(_gBuffer);
+			_accumulation = NULL;
+			_gBuffer = NULL;
+		}
+
+		void SetCameraUniforms(ShaderProgram* program, glm::mat4 view, glm::mat4 projection) {
+			program->SetMat4(program->uniforms.vp, projection * view);
+			program->SetMat4(program->uniforms.deferred.inverseProjection, glm::inverse(projection));
+			program->SetMat4(program->uniforms.deferred.inverseView, glm::inverse(view));
+			program->SetVec2(program->uniforms.deferred.screenSize, glm::vec2(_width, _height));
+		}
+
+		static void SetGBufferUnits(ShaderProgram* program) {
+			program->SetInt(program->uniforms.deferred.gAlbedo, DEFERRED_GBUFFER_UNIT);
+			program->SetInt(program->uniforms.deferred.gSpecular, DEFERRED_GBUFFER_UNIT + 1);
+			program->SetInt(program->uniforms.deferred.gNormal, DEFERRED_GBUFFER_UNIT + 2);
+			program->SetInt(program->uniforms.deferred.gDepth, DEFERRED_GBUFFER_UNIT + 3);
+		}
+
+		static void DrawMesh(GLuint vao, int indices, int instances) {
+			GLState::BindVertexArray(vao);
+			glDrawElementsInstanced(GL_TRIANGLES, indices, GL_UNSIGNED_INT, (GLvoid*)0, instances);
+		}
+
+	public:
+		void Init() {
+			_geometryProgram = sg::CreateProgram("shaders/vertexShader_gbuffer.glsl", "shaders/fragmentShader_gbuffer.glsl");
+			_geometryUnshadowedProgram = sg::CreateProgram("shaders/vertexShader_gbuffer.glsl", "shaders/fragmentShader_gbuffer.glsl");
+			_directionalProgram = sg::CreateProgram("shaders/vertexShader_deferred.glsl", "shaders/fragmentShader_deferred_directional.glsl");
+			_pointProgram = sg::CreateProgram("shaders/vertexShader_deferred_volume.glsl", "shaders/fragmentShader_deferred_point.glsl");
+			_spotProgram = sg::CreateProgram("shaders/vertexShader_deferred_volume.glsl", "shaders/fragmentShader_deferred_spot.glsl");
+			_presentProgram = sg::CreateProgram("shaders/vertexShader_deferred.glsl", "shaders/fragmentShader_deferred_present.glsl");
+
+			// One program object per value, so objects that differ in it never share a batch
+			_geometryProgram->SetInt(_geometryProgram->uniforms.deferred.receivesShadows, 1);
+			_geometryUnshadowedProgram->SetInt(_geometryUnshadowedProgram->uniforms.deferred.receivesShadows, 0);
+			_pointProgram->SetInt(_pointProgram->uniforms.deferred.pointVolumes, 1);
+			_spotProgram->SetInt(_spotProgram->uniforms.deferred.pointVolumes, 0);
+			SetGBufferUnits(_directionalProgram);
+			SetGBufferUnits(_pointProgram);
+			SetGBufferUnits(_spotProgram);
+			_presentProgram->SetInt(_presentProgram->uniforms.deferred.accumulation, DEFERRED_ACCUMULATION_UNIT);
+
+			CreateFullscreenTriangle();
+			CreateSphere();
+			CreateCube();
+		}
+
+		// The programs that read the light block, shadow maps and clusters, for the renderer to keep up to date
+		std::vector<ShaderProgram*> GetLightPrograms() {
+			return { _directionalProgram, _pointProgram, _spotProgram };
+		}
+
+		ShaderProgram* GetGeometryProgram(bool receivesShadows) {
+			return receivesShadows ? _geometryProgram : _geometryUnshadowedProgram;
+		}
+
+		// Recreates the targets when the window size changed
+		void Resize(int width, int height) {
+			if (_gBuffer != NULL && width == _width && height == _height) return;
+			FreeTargets();
+			_width = width;
+			_height = height;
+
+			_gBuffer = new FrameBuffer(width, height, false, true, false);
+			_gBuffer->AddColorAttachment(width, height, GL_RGBA8, GL_RGBA, GL_UNSIGNED_BYTE);	// albedo
+			_gBuffer->AddColorAttachment(width, height, GL_RGBA16F, GL_RGBA, GL_FLOAT);		// specular, shininess
+			_gBuffer->AddColorAttachment(width, height, GL_RGBA16F, GL_RGBA, GL_FLOAT);		// view normal, receives shadows
+			_gBuffer->AddColorAttachment(width, height, GL_R32F, GL_RED, GL_FLOAT);			// view depth, 0 where empty
+			_accumulation = new FrameBuffer(width, height, false, false, false);
+			_accumulation->AddColorAttachment(width, height, GL_RGBA16F, GL_RGBA, GL_FLOAT);
+			_accumulation->AttachDepthMap(_gBuffer->depthMap);
+			if (!_gBuffer->isValid || !_accumulation->isValid) printf("Error: deferred shading targets are incomplete\n");
+		}
+
+		void BeginGeometry() {
+			GLState::BindFramebuffer(GL_DRAW_FRAMEBUFFER, _gBuffer->bufferIndex);
+			GLState::Viewport(0, 0, _width, _height);
+			glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+		}
+
+		// Adds up every light into the accumulation target and leaves it bound for the forward objects.
+		// spotViewProjections holds the view-projection of each spot light in the light buffer.
+		void Light(glm::mat4 view, glm::mat4 projection, int nPointLights, std::vector<glm::mat4>& spotViewProjections) {
+			GLState::BindFramebuffer(GL_DRAW_FRAMEBUFFER, _accumulation->bufferIndex);
+			glClear(GL_COLOR_BUFFER_BIT);
+			for (int i = 0; i < 4; i++) {
+				GLState::BindTexture(DEFERRED_GBUFFER_UNIT + i, GL_TEXTURE_2D, _gBuffer->colorAttachments[i]);
+			}
+
+			GLState::SetEnabled(GL_BLEND, true);
+			glBlendFunc(GL_ONE, GL_ONE);
+			glDepthMask(GL_FALSE);
+
+			SetCameraUniforms(_directionalProgram, view, projection);
+			_directionalProgram->Use();
+			GLState::SetEnabled(GL_DEPTH_TEST, false);
+			DrawMesh(_fullscreenVAO, 3, 1);
+			GLState::SetEnabled(GL_DEPTH_TEST, true);
+
+			glDepthFunc(GL_GEQUAL);
+			glCullFace(GL_FRONT);
+			if (nPointLights > 0) {
+				SetCameraUniforms(_pointProgram, view, projection);
+				_pointProgram->Use();
+				DrawMesh(_sphereVAO, _sphereIndices, nPointLights);
+			}
+
+			// The inverse projection mirrors the cube, which turns its winding around
+			glFrontFace(GL_CW);
+			SetCameraUniforms(_spotProgram, view, projection);
+			for (int i = 0; i < spotViewProjections.size() && i < MAX_LIGHTS; i++) {
+				_spotProgram->SetInt(_spotProgram->uniforms.deferred.spotIndex, i);
+				_spotProgram->SetMat4(_spotProgram->uniforms.deferred.volumeMatrix, glm::inverse(spotViewProjections[i]));
+				_spotProgram->Use();
+				DrawMesh(_cubeVAO, _cubeIndices, 1);
+			}
+			glFrontFace(GL_CCW);
+
+			glCullFace(GL_BACK);
+			glDepthFunc(GL_LESS);
+			glDepthMask(GL_TRUE);
+			GLState::SetEnabled(GL_BLEND, false);
+			GLState::BindVertexArray(0);
+		}
+
+		void Present(GLuint framebuffer) {
+			GLState::BindFramebuffer(GL_DRAW_FRAMEBUFFER, framebuffer);
+			GLState::Viewport(0, 0, _width, _height);
+			GLState::BindTexture(DEFERRED_ACCUMULATION_UNIT, GL_TEXTURE_2D, _accumulation->colorAttachments[0]);
+			_presentProgram->Use();
+			GLState::SetEnabled(GL_DEPTH_TEST, false);
+			DrawMesh(_fullscreenVAO, 3, 1);
+			GLState::SetEnabled(GL_DEPTH_TEST, true);
+			GLState::BindVertexArray(0);
+		}
+
+		void Destroy() {
+			FreeTargets();
+			GLState::DeleteVertexArray(_fullscreenVAO);
+			GLState::DeleteVertexArray(_sphereVAO);
+			GLState::DeleteVertexArray(_cubeVAO);
+			GLState::DeleteBuffer(_fullscreenVBO);
+			GLState::DeleteBuffer(_sphereVBO);
+			GLState::DeleteBuffer(_cubeVBO);
+			glDeleteBuffers(1, &_fullscreenEBO);
+			glDeleteBuffers(1, &_sphereEBO);
+			glDeleteBuffers(1, &_cubeEBO);
+			delete(_geometryProgram);
+			delete(_geometryUnshadowedProgram);
+			delete(_directionalProgram);
+			delete(_pointProgram);
+			delete(_spotProgram);
+			delete(_presentProgram);
+		}
+	};
+}
\ No newline at end of file
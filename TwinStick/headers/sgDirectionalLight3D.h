@@ -2,18 +2,77 @@
 
 #include <sgAngledLight3D.h>
 
+#define MAX_CASCADES 4
+
 namespace sg {
 	class DirectionalLight3D : public AngledLight3D {
 	private:
 		glm::vec3 _direction;
 		float _distance;
 
+		int _nCascades;
+		int _cascadeResolution;
+		float _cascadeDistance;
+		float _splitLambda;
+		float _cascadeSplits[MAX_CASCADES];
+		glm::mat4 _cascadeViewProjections[MAX_CASCADES];
+		glm::mat4 _cascadeShadowMatrices[MAX_CASCADES];
+		Frustum _cascadeFrustums[MAX_CASCADES];
+		AtlasTile _cascadeTiles[MAX_CASCADES];
+		glm::vec4 _cascadeRects[MAX_CASCADES];
+
 		void UpdateCoords() {
 			SetLocalPosition(-_direction * _distance);
 			LookAtLocal(glm::vec3(0,0,0));
 			UpdateView();
 		}
 
+		// Fits one cascade around the slice of the camera frustum between two view depths.
+		// The box is sized from the slice's bounding sphere and its center is moved in whole
+		// texels, so the map does not shimmer when the camera moves or turns.
+		void FitCascade(int index, const glm::vec3 nearCorners[4], const glm::vec3 farCorners[4], float from, float to) {
+			glm::vec3 corners[8];
+			glm::vec3 center(0);
+			for (int i = 0; i < 4; i++) {
+				corners[i] = glm::mix(nearCorners[i], farCorners[i], from);
+				corners[i + 4] = glm::mix(nearCorners[i], farCorners[i], to);
+				center += corners[i] + corners[i + 4];
+			}
+			center /= 8.0f;
+
+			float radius = 0;
+			for (int i = 0; i < 8; i++) radius = glm::max(radius, glm::length(corners[i] - center));
+			radius = glm::ceil(radius * 16.0f) / 16.0f;
+
+			const glm::vec3 forward = _direction;
+			const glm::vec3 worldUp = std::abs(forward.y) > 0.99f ? glm::vec3(0, 0, 1) : glm::vec3(0, 1, 0);
+			const glm::vec3 right = glm::normalize(glm::cross(forward, worldUp));
+			const glm::vec3 up = glm::cross(right, forward);
+
+			const float texel = 2 * radius / _cascadeResolution;
+			float x = glm::floor(glm::dot(center, right) / texel) * texel;
+			float y = glm::floor(glm::dot(center, up) / texel) * texel;
+			center = right * x + up * y + forward * glm::dot(center, forward);
+
+			// Casters between the light and the slice must still land in the map
+			const glm::vec3 eye = center - forward * (radius + _distance);
+			const float depth = 2 * radius + _distance;
+
+			glm::mat4 view = glm::lookAt(eye, center, up);
+			glm::mat4 projection = glm::ortho(-radius, radius, -radius, radius, 0.0f, depth);
+			_cascadeViewProjections[index] = projection * view;
+			_cascadeShadowMatrices[index] = glm::translate(glm::vec3(0.5f, 0.5f, 0.5f)) * glm::scale(glm::vec3(0.5f, 0.5f, 0.5f))
+				* projection * glm::translate(glm::vec3(0, 0, 0.05f)) * view;
+
+			Frustum& frustum = _cascadeFrustums[index];
+			frustum.nearFace = { eye, forward };
+			frustum.farFace = { eye + forward * depth, -forward };
+			frustum.rightFace = { center + right * radius, -right };
+			frustum.leftFace = { center - right * radius, right };
+			frustum.topFace = { center + up * radius, -up };
+			frustum.bottomFace = { center - up * radius, up };
+		}
+
 	protected:
 		void UpdateProjectionMatrix() override {
 			SetOrthographic();
@@ -26,6 +85,17 @@ namespace sg {
 			_direction = glm::normalize(direction);
 			_distance = distance;
 			_lightType = TypeDirectionalLight;
+			_nCascades = 0;
+			_cascadeResolution = 0;
+			_cascadeDistance = 0;
+			_splitLambda = 0;
+			for (int i = 0; i < MAX_CASCADES; i++) {
+				_cascadeSplits[i] = 0;
+				_cascadeViewProjections[i] = glm::mat4(1);
+				_cascadeShadowMatrices[i] = glm::mat4(1);
+				_cascadeTiles[i] = AtlasTile{ 0, 0, 0 };
+				_cascadeRects[i] = glm::vec4(0);
+			}
 			UpdateCoords();
 		}
 
@@ -38,5 +108,82 @@ namespace sg {
 			_distance = distance;
 			UpdateCoords();
 		}
+
+		// Splits the main camera frustum, up to maxDistance, into count cascades with a map of
+		// resolution texels each. splitLambda blends uniform (0) and logarithmic (1) split distances.
+		// A count of 0 goes back to the single fixed orthographic map.
+		void SetCascades(int count, int resolution, float maxDistance, float splitLambda = 0.75f) {
+			_nCascades = glm::clamp(count, 0, MAX_CASCADES);
+			_cascadeResolution = resolution;
+			_cascadeDistance = maxDistance;
+			_splitLambda = splitLambda;
+			InvalidateStaticCache();
+		}
+
+		// Refits every cascade to the camera; called by the renderer once per frame
+		void UpdateCascades(glm::mat4 cameraViewProjection, float cameraNear, float cameraFar) {
+			if (_nCascades == 0) return;
+
+			glm::mat4 inverse = glm::inverse(cameraViewProjection);
+			glm::vec3 nearCorners[4];
+			glm::vec3 farCorners[4];
+			for (int i = 0; i < 4; i++) {
+				glm::vec2 ndc((i & 1) ? 1.0f : -1.0f, (i & 2) ? 1.0f : -1.0f);
+				glm::vec4 n = inverse * glm::vec4(ndc, -1, 1);
+				glm::vec4 f = inverse * glm::vec4(ndc, 1, 1);
+				nearCorners[i] = glm::vec3(n) / n.w;
+				farCorners[i] = glm::vec3(f) / f.w;
+			}
+
+			const float lastSplit = glm::min(_cascadeDistance, cameraFar);
+			float from = cameraNear;
+			for (int c = 0; c < _nCascades; c++) {
+				const float t = (c + 1) / (float)_nCascades;
+				const float logSplit = cameraNear * std::pow(lastSplit / cameraNear, t);
+				const float uniformSplit = cameraNear + (lastSplit - cameraNear) * t;
+				const float to = glm::mix(uniformSplit, logSplit, _splitLambda);
+				_cascadeSplits[c] = to;
+				FitCascade(c, nearCorners, farCorners, (from - cameraNear) / (cameraFar - cameraNear), (to - cameraNear) / (cameraFar - cameraNear));
+				from = to;
+			}
+		}
+
+		int GetNCascades() const {
+			return _nCascades;
+		}
+
+		int GetCascadeResolution() const {
+			return _cascadeResolution;
+		}
+
+		// View depth, along the main camera's forward axis, where the cascade ends
+		float GetCascadeSplit(int index) const {
+			return _cascadeSplits[index];
+		}
+
+		glm::mat4 GetCascadeViewProjection(int index) const {
+			return _cascadeViewProjections[index];
+		}
+
+		glm::mat4 GetCascadeShadow(int index) const {
+			return _cascadeShadowMatrices[index];
+		}
+
+		Frustum GetCascadeFrustum(int index) const {
+			return _cascadeFrustums[index];
+		}
+
+		void SetCascadeAtlasTile(int index, sg::AtlasTile tile, int atlasSize) {
+			_cascadeTiles[index] = tile;
+			_cascadeRects[index] = glm::vec4(tile.x, tile.y, tile.size, tile.size) / (float)atlasSize;
+		}
+
+		sg::AtlasTile GetCascadeAtlasTile(int index) const {
+			return _cascadeTiles[index];
+		}
+
+		glm::vec4 GetCascadeAtlasRect(int index) const {
+			return _cascadeRects[index];
+		}
 	};
 }
\ No newline at end of file
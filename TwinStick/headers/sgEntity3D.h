@@ -149,11 +149,17 @@ namespace sg {
 		}
 
 	public:
+		// Update only changes this entity and its descendants and makes structural changes through the
+		// renderer's command buffers, so it may run on a job thread alongside other such entities
+		bool ParallelUpdate;
 
 		Entity3D() : _id(nextId++) {
 			_parent = NULL;
+			ParallelUpdate = false;
 		}
 
+		virtual ~Entity3D() {}
+
 		#pragma region Local
 
 		virtual void TranslateLocal(float x, float y, float z) { _localTransform.Translate(x, y, z); GlobalPositionFromLocal(); }
@@ -256,6 +262,10 @@ namespace sg {
 			}
 		}
 
+		Entity3D* GetParent() {
+			return _parent;
+		}
+
 		virtual void Start() {}
 		virtual void Update(double dt) {}
 	};
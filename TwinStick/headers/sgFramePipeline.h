@@ -0,0 +1,186 @@
+#pragma once
+
+#include <GL/glew.h>
+#include <chrono>
+#include <cstring>
+#include <algorithm>
+#include <sgGLState.h>
+
+#define MAX_FRAMES_IN_FLIGHT 3
+#define DEFAULT_FRAMES_IN_FLIGHT 2
+
+namespace sg {
+	struct FrameTimings {
+		double cpuWait;	// milliseconds the CPU spent blocked on the fence of an earlier frame
+		double gpuBusy;	// milliseconds the GPU spent on the last frame it finished, from a timer query
+	};
+
+	// Lets the CPU build up to depth frames ahead of the GPU. Every frame ends with a fence; before a
+	// frame reuses the slot of the one depth frames earlier, it waits on that frame's fence, so the
+	// per-frame regions of the stream buffers are never written while the GPU still reads them.
+	class FramePipeline {
+	private:
+		int _depth = DEFAULT_FRAMES_IN_FLIGHT;
+		int _frame = 0;
+		int _slot = 0;
+		GLsync _fences[MAX_FRAMES_IN_FLIGHT] = {};
+		GLuint _queries[MAX_FRAMES_IN_FLIGHT] = {};
+		bool _queryIssued[MAX_FRAMES_IN_FLIGHT] = {};
+		FrameTimings _timings = {};
+
+		// Returns the milliseconds spent waiting
+		static double WaitFence(GLsync& fence) {
+			if (fence == NULL) return 0;
+			auto start = std::chrono::steady_clock::now();
+			GLbitfield flags = GL_SYNC_FLUSH_COMMANDS_BIT;
+			while (true) {
+				GLenum result = glClientWaitSync(fence, flags, 1000000);
+				if (result == GL_ALREADY_SIGNALED || result == GL_CONDITION_SATISFIED || result == GL_WAIT_FAILED) break;
+				flags = 0;
+			}
+			glDeleteSync(fence);
+			fence = NULL;
+			return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+		}
+
+	public:
+		void Init(int depth) {
+			glGenQueries(MAX_FRAMES_IN_FLIGHT, _queries);
+			SetDepth(depth);
+		}
+
+		// Waits for every frame in flight, so the new depth starts from an idle GPU
+		void SetDepth(int depth) {
+			for (int i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+				WaitFence(_fences[i]);
+				_queryIssued[i] = false;
+			}
+			_depth = std::min(std::max(depth, 1), MAX_FRAMES_IN_FLIGHT);
+			_frame = 0;
+		}
+
+		int GetDepth() {
+			return _depth;
+		}
+
+		// Call before the frame's first write to a stream buffer
+		void BeginFrame() {
+			_slot = _frame % _depth;
+			_timings.cpuWait = WaitFence(_fences[_slot]);
+			if (_queryIssued[_slot]) {
+				GLuint64 nanoseconds = 0;
+				glGetQueryObjectui64v(_queries[_slot], GL_QUERY_RESULT, &nanoseconds);
+				_timings.gpuBusy = nanoseconds / 1000000.0;
+			}
+			glBeginQuery(GL_TIME_ELAPSED, _queries[_slot]);
+		}
+
+		// Call once the frame has been submitted
+		void EndFrame() {
+			glEndQuery(GL_TIME_ELAPSED);
+			_queryIssued[_slot] = true;
+			_fences[_slot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+			_frame++;
+		}
+
+		// Region of the stream buffers the current frame writes to
+		int GetSlot() {
+			return _slot;
+		}
+
+		FrameTimings GetTimings() {
+			return _timings;
+		}
+
+		void Destroy() {
+			if (_queries[0] == 0) return;
+			for (int i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+				WaitFence(_fences[i]);
+			}
+			glDeleteQueries(MAX_FRAMES_IN_FLIGHT, _queries);
+			_queries[0] = 0;
+		}
+	};
+
+	// Buffer rewritten every frame, with one region per frame in flight. With ARB_buffer_storage it is
+	// mapped once, persistently and coherently, and each frame writes straight into its own region.
+	// Without it, writes orphan the storage as before and always land at offset 0.
+	class StreamBuffer {
+	private:
+		GLenum _target = 0;
+		GLuint _buffer = 0;
+		size_t _regionSize = 0;
+		size_t _alignment = 1;
+		unsigned char* _mapped = NULL;
+		bool _persistent = false;
+
+		// Draws still reading the old buffer keep its storage alive after the delete
+		void Allocate(size_t regionSize) {
+			if (_buffer != 0) GLState::DeleteBuffer(_buffer);
+			_regionSize = (regionSize + _alignment - 1) / _alignment * _alignment;
+			_buffer = GLState::CreateBuffer();
+			if (!_persistent) {
+				GLState::BufferData(_target, _buffer, _regionSize, NULL, GL_STREAM_DRAW);
+				return;
+			}
+			GLsizeiptr size = _regionSize * MAX_FRAMES_IN_FLIGHT;
+			GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+			if (GLState::HasDSA()) {
+				glNamedBufferStorage(_buffer, size, NULL, flags);
+				_mapped = (unsigned char*)glMapNamedBufferRange(_buffer, 0, size, flags);
+			} else {
+				GLState::BindBuffer(_target, _buffer);
+				glBufferStorage(_target, size, NULL, flags);
+				_mapped = (unsigned char*)glMapBufferRange(_target, 0, size, flags);
+			}
+		}
+
+	public:
+		void Init(GLenum target, size_t regionSize) {
+			_target = target;
+			_persistent = GLEW_ARB_buffer_storage || GLEW_VERSION_4_4;
+			if (target == GL_UNIFORM_BUFFER) {
+				GLint alignment = 1;
+				glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+				_alignment = std::max(alignment, 1);
+			}
+			Allocate(regionSize);
+		}
+
+		bool IsPersistent() {
+			return _persistent;
+		}
+
+		GLuint GetBuffer() {
+			return _buffer;
+		}
+
+		size_t GetOffset(int slot) {
+			return _persistent ? slot * _regionSize : 0;
+		}
+
+		// Mapped memory of the slot's region; persistent buffers only
+		unsigned char* GetRegion(int slot) {
+			return _mapped + GetOffset(slot);
+		}
+
+		// Writes the frame's data into its region, growing every region when it does not fit, and
+		// returns where it starts in GetBuffer()
+		size_t Write(int slot, const void* data, size_t size) {
+			if (size > _regionSize) Allocate(std::max(size, _regionSize * 2));
+			if (!_persistent) {
+				GLState::BufferData(_target, _buffer, _regionSize, NULL, GL_STREAM_DRAW);
+				if (size > 0) GLState::BufferSubData(_target, _buffer, 0, size, data);
+				return 0;
+			}
+			if (size > 0) memcpy(GetRegion(slot), data, size);
+			return GetOffset(slot);
+		}
+
+		void Destroy() {
+			if (_buffer != 0) GLState::DeleteBuffer(_buffer);
+			_buffer = 0;
+			_mapped = NULL;
+		}
+	};
+}
\ No newline at end of file
@@ -0,0 +1,102 @@
+#pragma once
+
+#include <vector>
+#include <glm/glm/glm.hpp>
+#include <sgStructures.h>
+
+// SSE is part of every x64 target and the default for 32-bit MSVC builds; anything else takes the scalar path,
+// as does any build that defines SG_CULL_SCALAR
+#if !defined(SG_CULL_SCALAR) && (defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1) || defined(__SSE__))
+#define SG_CULL_SSE
+#include <xmmintrin.h>
+#endif
+
+#define CULL_LANES 4
+
+namespace sg {
+	// The six planes of a frustum with every component in its own row, plus the absolute normals
+	// that project a box's extents onto them
+	struct FrustumPlanes {
+		float nx[6], ny[6], nz[6], d[6];
+		float ax[6], ay[6], az[6];
+
+		FrustumPlanes() {}
+
+		FrustumPlanes(const Frustum& frustum) {
+			const Plane* planes[6] = { &frustum.leftFace, &frustum.rightFace, &frustum.topFace, &frustum.bottomFace, &frustum.nearFace, &frustum.farFace };
+			for (int p = 0; p < 6; p++) {
+				nx[p] = planes[p]->normal.x;
+				ny[p] = planes[p]->normal.y;
+				nz[p] = planes[p]->normal.z;
+				d[p] = planes[p]->distance;
+				ax[p] = glm::abs(nx[p]);
+				ay[p] = glm::abs(ny[p]);
+				az[p] = glm::abs(nz[p]);
+			}
+		}
+	};
+
+	// World boxes as centers and half-extents in structure-of-arrays form. The arrays are padded
+	// by CULL_LANES - 1 so that a group of lanes can be read from any box.
+	class BoxesSoA {
+	private:
+		std::vector<float> _cx, _cy, _cz;
+		std::vector<float> _ex, _ey, _ez;
+		int _size = 0;
+
+	public:
+		void Resize(int size) {
+			_size = size;
+			int padded = size + CULL_LANES - 1;
+			_cx.assign(padded, 0); _cy.assign(padded, 0); _cz.assign(padded, 0);
+			_ex.assign(padded, 0); _ey.assign(padded, 0); _ez.assign(padded, 0);
+		}
+
+		void Set(int index, glm::vec3 min, glm::vec3 max) {
+			glm::vec3 center = (min + max) * 0.5f;
+			glm::vec3 extents = max - center;
+			_cx[index] = center.x; _cy[index] = center.y; _cz[index] = center.z;
+			_ex[index] = extents.x; _ey[index] = extents.y; _ez[index] = extents.z;
+		}
+
+		int GetSize() {
+			return _size;
+		}
+
+		// Bit i is set when box first + i is at least partly inside all six planes. No early-out:
+		// every lane is tested against every plane and the results are and-ed together.
+		int Cull(const FrustumPlanes& planes, int first) const {
+#ifdef SG_CULL_SSE
+			__m128 cx = _mm_loadu_ps(&_cx[first]), cy = _mm_loadu_ps(&_cy[first]), cz = _mm_loadu_ps(&_cz[first]);
+			__m128 ex = _mm_loadu_ps(&_ex[first]), ey = _mm_loadu_ps(&_ey[first]), ez = _mm_loadu_ps(&_ez[first]);
+			__m128 inside = _mm_cmpeq_ps(_mm_setzero_ps(), _mm_setzero_ps());
+			for (int p = 0; p < 6; p++) {
+				__m128 distance = _mm_sub_ps(_mm_add_ps(_mm_add_ps(
+					_mm_mul_ps(cx, _mm_set1_ps(planes.nx[p])),
+					_mm_mul_ps(cy, _mm_set1_ps(planes.ny[p]))),
+					_mm_mul_ps(cz, _mm_set1_ps(planes.nz[p]))),
+					_mm_set1_ps(planes.d[p]));
+				__m128 radius = _mm_add_ps(_mm_add_ps(
+					_mm_mul_ps(ex, _mm_set1_ps(planes.ax[p])),
+					_mm_mul_ps(ey, _mm_set1_ps(planes.ay[p]))),
+					_mm_mul_ps(ez, _mm_set1_ps(planes.az[p])));
+				inside = _mm_and_ps(inside, _mm_cmpge_ps(_mm_add_ps(distance, radius), _mm_setzero_ps()));
+			}
+			return _mm_movemask_ps(inside);
+#else
+			int mask = 0;
+			for (int i = 0; i < CULL_LANES; i++) {
+				int b = first + i;
+				bool inside = true;
+				for (int p = 0; p < 6; p++) {
+					float distance = _cx[b] * planes.nx[p] + _cy[b] * planes.ny[p] + _cz[b] * planes.nz[p] - planes.d[p];
+					float radius = _ex[b] * planes.ax[p] + _ey[b] * planes.ay[p] + _ez[b] * planes.az[p];
+					inside &= distance + radius >= 0;
+				}
+				mask |= (int)inside << i;
+			}
+			return mask;
+#endif
+		}
+	};
+}
\ No newline at end of file
@@ -0,0 +1,244 @@
+#pragma once
+
+#include <GL/glew.h>
+#include <map>
+
+#define GLSTATE_TEXTURE_UNITS 32
+
+namespace sg {
+	struct GLStateCounters {
+		int issued;
+		int elided;
+	};
+
+	// The bindings GLState last set
+	struct GLStateCache {
+		bool dsa = false;
+		GLuint program = 0;
+		GLuint vertexArray = 0;
+		GLuint arrayBuffer = 0;
+		GLuint uniformBuffer = 0;
+		GLuint drawFramebuffer = 0;
+		GLuint readFramebuffer = 0;
+		GLuint activeUnit = 0;
+		GLuint textures[GLSTATE_TEXTURE_UNITS] = {};
+		GLenum textureTargets[GLSTATE_TEXTURE_UNITS] = {};
+		GLint viewport[4] = {};
+		GLint scissor[4] = {};
+		std::map<GLenum, bool> capabilities;
+		GLStateCounters counters = GLStateCounters();
+		GLStateCounters lastFrame = GLStateCounters();
+	};
+
+	// Shadow copy of the GL bindings the engine changes. Every bind goes through here so that
+	// calls which would not change anything are dropped; objects must be deleted through here
+	// too, since GL may hand a deleted name out again.
+	class GLState {
+	private:
+		// One copy of the cache for the whole program, without a static member defined in this header
+		static GLStateCache& State() {
+			static GLStateCache state;
+			return state;
+		}
+
+		static bool Changed(bool changed) {
+			if (changed) State().counters.issued++;
+			else State().counters.elided++;
+			return changed;
+		}
+
+		static void ActiveTexture(GLuint unit) {
+			if (Changed(State().activeUnit != unit)) {
+				glActiveTexture(GL_TEXTURE0 + unit);
+				State().activeUnit = unit;
+			}
+		}
+
+	public:
+		// Forgets every cached binding; call after creating a context or after code outside the engine touched GL
+		static void Reset() {
+			State().dsa = GLEW_ARB_direct_state_access || GLEW_VERSION_4_5;
+			State().program = 0;
+			State().vertexArray = 0;
+			State().arrayBuffer = 0;
+			State().uniformBuffer = 0;
+			GLint framebuffer = 0;
+			glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &framebuffer);
+			State().drawFramebuffer = framebuffer;
+			glGetIntegerv(GL_READ_FRAMEBUFFER_BINDING, &framebuffer);
+			State().readFramebuffer = framebuffer;
+			State().activeUnit = 0;
+			glActiveTexture(GL_TEXTURE0);
+			for (int i = 0; i < GLSTATE_TEXTURE_UNITS; i++) {
+				State().textures[i] = 0;
+				State().textureTargets[i] = 0;
+			}
+			glGetIntegerv(GL_VIEWPORT, State().viewport);
+			glGetIntegerv(GL_SCISSOR_BOX, State().scissor);
+			State().capabilities.clear();
+		}
+
+		static bool HasDSA() {
+			return State().dsa;
+		}
+
+		static void UseProgram(GLuint program) {
+			if (Changed(State().program != program)) {
+				glUseProgram(program);
+				State().program = program;
+			}
+		}
+
+		static void BindVertexArray(GLuint vertexArray) {
+			if (Changed(State().vertexArray != vertexArray)) {
+				glBindVertexArray(vertexArray);
+				State().vertexArray = vertexArray;
+			}
+		}
+
+		// The element array binding belongs to the bound vertex array, so it is never elided
+		static void BindBuffer(GLenum target, GLuint buffer) {
+			GLuint* cached = NULL;
+			if (target == GL_ARRAY_BUFFER) cached = &State().arrayBuffer;
+			else if (target == GL_UNIFORM_BUFFER) cached = &State().uniformBuffer;
+			if (!Changed(cached == NULL || *cached != buffer)) return;
+			glBindBuffer(target, buffer);
+			if (cached != NULL) *cached = buffer;
+		}
+
+		// glBindBufferBase also binds the generic target, so the cache follows it
+		static void BindBufferBase(GLenum target, GLuint index, GLuint buffer) {
+			State().counters.issued++;
+			glBindBufferBase(target, index, buffer);
+			if (target == GL_UNIFORM_BUFFER) State().uniformBuffer = buffer;
+		}
+
+		static void BindBufferRange(GLenum target, GLuint index, GLuint buffer, GLintptr offset, GLsizeiptr size) {
+			State().counters.issued++;
+			glBindBufferRange(target, index, buffer, offset, size);
+			if (target == GL_UNIFORM_BUFFER) State().uniformBuffer = buffer;
+		}
+
+		// With DSA the name must be created, not just generated, before it can be edited without a bind
+		static GLuint CreateBuffer() {
+			GLuint buffer = 0;
+			if (State().dsa) glCreateBuffers(1, &buffer);
+			else glGenBuffers(1, &buffer);
+			return buffer;
+		}
+
+		static void BufferData(GLenum target, GLuint buffer, GLsizeiptr size, const void* data, GLenum usage) {
+			if (State().dsa) {
+				glNamedBufferData(buffer, size, data, usage);
+			} else {
+				BindBuffer(target, buffer);
+				glBufferData(target, size, data, usage);
+			}
+		}
+
+		static void BufferSubData(GLenum target, GLuint buffer, GLintptr offset, GLsizeiptr size, const void* data) {
+			if (State().dsa) {
+				glNamedBufferSubData(buffer, offset, size, data);
+			} else {
+				BindBuffer(target, buffer);
+				glBufferSubData(target, offset, size, data);
+			}
+		}
+
+		static void BindTexture(GLuint unit, GLenum target, GLuint texture) {
+			if (!Changed(State().textures[unit] != texture || State().textureTargets[unit] != target)) return;
+			if (State().dsa && texture != 0) {
+				glBindTextureUnit(unit, texture);
+			} else {
+				ActiveTexture(unit);
+				glBindTexture(target, texture);
+			}
+			State().textures[unit] = texture;
+			State().textureTargets[unit] = target;
+		}
+
+		// Binds a texture to its target on unit 0 so that it can be created or its parameters edited.
+		// Always a classic bind: a name from glGenTextures has no target until it is first bound.
+		static void BindTextureForEdit(GLenum target, GLuint texture) {
+			ActiveTexture(0);
+			State().counters.issued++;
+			glBindTexture(target, texture);
+			State().textures[0] = texture;
+			State().textureTargets[0] = target;
+		}
+
+		static void BindFramebuffer(GLenum target, GLuint framebuffer) {
+			bool draw = target == GL_FRAMEBUFFER || target == GL_DRAW_FRAMEBUFFER;
+			bool read = target == GL_FRAMEBUFFER || target == GL_READ_FRAMEBUFFER;
+			if (!Changed((draw && State().drawFramebuffer != framebuffer) || (read && State().readFramebuffer != framebuffer))) return;
+			glBindFramebuffer(target, framebuffer);
+			if (draw) State().drawFramebuffer = framebuffer;
+			if (read) State().readFramebuffer = framebuffer;
+		}
+
+		static void Viewport(GLint x, GLint y, GLsizei width, GLsizei height) {
+			if (!Changed(State().viewport[0] != x || State().viewport[1] != y || State().viewport[2] != width || State().viewport[3] != height)) return;
+			glViewport(x, y, width, height);
+			State().viewport[0] = x;
+			State().viewport[1] = y;
+			State().viewport[2] = width;
+			State().viewport[3] = height;
+		}
+
+		static void Scissor(GLint x, GLint y, GLsizei width, GLsizei height) {
+			if (!Changed(State().scissor[0] != x || State().scissor[1] != y || State().scissor[2] != width || State().scissor[3] != height)) return;
+			glScissor(x, y, width, height);
+			State().scissor[0] = x;
+			State().scissor[1] = y;
+			State().scissor[2] = width;
+			State().scissor[3] = height;
+		}
+
+		static void SetEnabled(GLenum capability, bool enabled) {
+			auto it = State().capabilities.find(capability);
+			if (!Changed(it == State().capabilities.end() || it->second != enabled)) return;
+			if (enabled) glEnable(capability);
+			else glDisable(capability);
+			State().capabilities[capability] = enabled;
+		}
+
+		static void DeleteProgram(GLuint program) {
+			if (State().program == program) State().program = 0;
+			glDeleteProgram(program);
+		}
+
+		static void DeleteVertexArray(GLuint vertexArray) {
+			if (State().vertexArray == vertexArray) State().vertexArray = 0;
+			glDeleteVertexArrays(1, &vertexArray);
+		}
+
+		static void DeleteBuffer(GLuint buffer) {
+			if (State().arrayBuffer == buffer) State().arrayBuffer = 0;
+			if (State().uniformBuffer == buffer) State().uniformBuffer = 0;
+			glDeleteBuffers(1, &buffer);
+		}
+
+		static void DeleteFramebuffer(GLuint framebuffer) {
+			if (State().drawFramebuffer == framebuffer) State().drawFramebuffer = 0;
+			if (State().readFramebuffer == framebuffer) State().readFramebuffer = 0;
+			glDeleteFramebuffers(1, &framebuffer);
+		}
+
+		static void DeleteTexture(GLuint texture) {
+			for (int i = 0; i < GLSTATE_TEXTURE_UNITS; i++) {
+				if (State().textures[i] == texture) State().textures[i] = 0;
+			}
+			glDeleteTextures(1, &texture);
+		}
+
+		// Closes the frame's counters; GetLastFrameCounters returns them until the next call
+		static void EndFrame() {
+			State().lastFrame = State().counters;
+			State().counters = GLStateCounters();
+		}
+
+		static GLStateCounters GetLastFrameCounters() {
+			return State().lastFrame;
+		}
+	};
+}
\ No newline at end of file
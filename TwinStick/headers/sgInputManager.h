@@ -23,6 +23,8 @@ namespace sg {
 	constexpr auto Key_S_Up = 115;
 	constexpr auto Key_D_Down = 116;
 	constexpr auto Key_D_Up = 117;
+	constexpr auto Key_P_Down = 118;
+	constexpr auto Key_P_Up = 119;
 	constexpr auto Window_Resize = 200;
 
 	typedef void (*sgCursorPosFun)(double xpos, double ypos);
@@ -149,6 +151,12 @@ namespace sg {
 			case Key_D_Up:
 				f.key = GLFW_KEY_D; f.action = 0;
 				break;
+			case Key_P_Down:
+				f.key = GLFW_KEY_P; f.action = 1;
+				break;
+			case Key_P_Up:
+				f.key = GLFW_KEY_P; f.action = 0;
+				break;
 			default:
 				BindingError();
 				return;
@@ -0,0 +1,93 @@
+#pragma once
+
+#include <GL/glew.h>
+#include <vector>
+#include <cstddef>
+#include <sgStructures.h>
+#include <sgGLState.h>
+#include <sgFramePipeline.h>
+
+#define INSTANCE_BUFFER_INITIAL_SIZE 1024
+
+namespace sg {
+	class Object3D;
+	class ShaderProgram;
+
+	// A run of consecutive instances in the frame's instance buffer drawn with one call
+	struct InstanceBatch {
+		Object3D* object;
+		ShaderProgram* program;
+		int firstInstance;
+		int count;
+		float depth;	// main camera view depth of the nearest instance
+		int faceMask;	// cube faces the instances are visible from, for layered passes
+		int lod;	// level of detail the instances are drawn with
+	};
+
+	// A run of consecutive batches belonging to one pass
+	struct BatchRange {
+		int first;
+		int count;
+	};
+
+	// Per-instance model and normal matrices, rebuilt and streamed to the GPU once per frame
+	// into the frame's region of a stream buffer
+	class InstanceBuffer {
+	private:
+		StreamBuffer _stream;
+		size_t _offset = 0;
+		std::vector<InstanceData> _data;
+
+	public:
+		void Init() {
+			_stream.Init(GL_ARRAY_BUFFER, INSTANCE_BUFFER_INITIAL_SIZE * sizeof(InstanceData));
+		}
+
+		void Clear() {
+			_data.clear();
+		}
+
+		// Reserves count consecutive instances and returns the index of the first one
+		int Allocate(int count) {
+			int first = (int)_data.size();
+			_data.resize(_data.size() + count);
+			return first;
+		}
+
+		void Set(int index, glm::mat4 model, glm::mat3 normal, int lightMask) {
+			_data[index].model = model;
+			_data[index].normal = normal;
+			_data[index].lightMask = lightMask;
+		}
+
+		int Size() {
+			return (int)_data.size();
+		}
+
+		// slot is the frame pipeline's; the region it names is no longer read by the GPU
+		void Upload(int slot) {
+			_offset = _stream.Write(slot, _data.data(), _data.size() * sizeof(InstanceData));
+		}
+
+		// Points the instance attributes of the bound vertex array at firstInstance.
+		// GL 3.3 has no base instance, so every batch re-points the attributes instead.
+		void BindAttributes(int firstInstance) {
+			size_t base = _offset + firstInstance * sizeof(InstanceData);
+			GLState::BindBuffer(GL_ARRAY_BUFFER, _stream.GetBuffer());
+			for (int c = 0; c < 4; c++) {
+				glVertexAttribPointer(INSTANCE_MODEL_LOCATION + c, 4, GL_FLOAT, GL_FALSE, sizeof(InstanceData),
+					(GLvoid*)(base + offsetof(InstanceData, model) + c * sizeof(glm::vec4)));
+			}
+			for (int c = 0; c < 3; c++) {
+				glVertexAttribPointer(INSTANCE_NORMAL_LOCATION + c, 3, GL_FLOAT, GL_FALSE, sizeof(InstanceData),
+					(GLvoid*)(base + offsetof(InstanceData, normal) + c * sizeof(glm::vec3)));
+			}
+			glVertexAttribIPointer(INSTANCE_LIGHT_MASK_LOCATION, 1, GL_INT, sizeof(InstanceData),
+				(GLvoid*)(base + offsetof(InstanceData, lightMask)));
+		}
+
+		void Destroy() {
+			_stream.Destroy();
+		}
+	};
+}
\ No newline at end of file
@@ -0,0 +1,245 @@
+#pragma once
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <deque>
+#include <vector>
+#include <functional>
+#include <algorithm>
+
+// ParallelFor never cuts a range into batches smaller than this when it picks the size itself
+#define JOB_MIN_BATCH 16
+// Batches per thread ParallelFor aims for, so that stealing can even out uneven items
+#define JOB_BATCHES_PER_THREAD 4
+
+namespace sg {
+	// Jobs of a fork that have not finished yet; the fork has joined when it is back to zero
+	typedef std::atomic<int> JobCounter;
+
+	struct Job {
+		std::function<void()> work;
+		JobCounter* counter;
+	};
+
+	// The owner pushes and pops at the back, so it goes on with what it forked last while the
+	// data is still in cache; thieves take from the front, where the oldest and largest jobs are
+	class JobQueue {
+	private:
+		std::mutex _mutex;
+		std::deque<Job> _jobs;
+
+	public:
+		void Push(const Job& job) {
+			std::lock_guard<std::mutex> lock(_mutex);
+			_jobs.push_back(job);
+		}
+
+		bool Pop(Job& job) {
+			std::lock_guard<std::mutex> lock(_mutex);
+			if (_jobs.empty()) return false;
+			job = std::move(_jobs.back());
+			_jobs.pop_back();
+			return true;
+		}
+
+		// The newest job of one fork, for a thread joining it
+		bool PopFor(JobCounter* counter, Job& job) {
+			std::lock_guard<std::mutex> lock(_mutex);
+			for (auto it = _jobs.rbegin(); it != _jobs.rend(); ++it) {
+				if (it->counter != counter) continue;
+				job = std::move(*it);
+				_jobs.erase(std::next(it).base());
+				return true;
+			}
+			return false;
+		}
+
+		bool Steal(Job& job) {
+			std::lock_guard<std::mutex> lock(_mutex);
+			if (_jobs.empty()) return false;
+			job = std::move(_jobs.front());
+			_jobs.pop_front();
+			return true;
+		}
+	};
+
+	// Fixed pool of worker threads with one queue each. The thread that called Init owns queue 0 and
+	// works too while it waits on a counter, so a pool of n threads starts n - 1 workers; any other
+	// thread that submits jobs shares queue 0. Idle workers steal from the others' queues and sleep
+	// when every queue is empty. Long jobs that nobody waits on, such as asset loads, go to a separate
+	// background queue that only idle workers take from, so they never run inside a Wait.
+	class JobSystem {
+	private:
+		std::vector<std::thread> _workers;
+		std::vector<JobQueue*> _queues;
+		JobQueue _background;
+		std::atomic<bool> _running;
+		std::atomic<int> _queued;
+		std::atomic<int> _backgroundQueued;
+		std::mutex _sleepMutex;
+		std::condition_variable _wake;
+		// Defined in a function so that every translation unit including this header shares one copy
+		static int& ThreadIndex() {
+			static thread_local int index = 0;
+			return index;
+		}
+
+		bool Take(Job& job) {
+			int n = (int)_queues.size();
+			int self = GetThreadIndex();
+			bool found = _queues[self]->Pop(job);
+			for (int i = 1; i < n && !found; i++) {
+				found = _queues[(self + i) % n]->Steal(job);
+			}
+			if (found) _queued--;
+			return found;
+		}
+
+		bool RunOne() {
+			Job job;
+			if (!Take(job)) return false;
+			job.work();
+			if (job.counter != NULL) (*job.counter)--;
+			return true;
+		}
+
+		bool RunBackground() {
+			Job job;
+			if (!_background.Steal(job)) return false;
+			_backgroundQueued--;
+			job.work();
+			return true;
+		}
+
+		// Background jobs are drained before a worker exits, since their owners may be waiting on them
+		void WorkerLoop(int index) {
+			ThreadIndex() = index;
+			while (true) {
+				if (RunOne() || RunBackground()) continue;
+				if (!_running) return;
+				std::unique_lock<std::mutex> lock(_sleepMutex);
+				_wake.wait(lock, [this]() { return _queued > 0 || _backgroundQueued > 0 || !_running; });
+			}
+		}
+
+		void Wake() {
+			// Taking the lock orders the push before a worker's last look at the counts, so it cannot sleep through it
+			{ std::lock_guard<std::mutex> lock(_sleepMutex); }
+			_wake.notify_one();
+		}
+
+	public:
+		JobSystem() {
+			_running = false;
+			_queued = 0;
+			_backgroundQueued = 0;
+		}
+
+		// nThreads counts the calling thread; 0 takes one per hardware thread
+		void Init(int nThreads = 0) {
+			if (!_queues.empty()) return;
+			if (nThreads <= 0) nThreads = std::max((int)std::thread::hardware_concurrency(), 1);
+			ThreadIndex() = 0;
+			_running = true;
+			for (int i = 0; i < nThreads; i++) {
+				_queues.push_back(new JobQueue());
+			}
+			for (int i = 1; i < nThreads; i++) {
+				_workers.push_back(std::thread(&JobSystem::WorkerLoop, this, i));
+			}
+		}
+
+		int GetNThreads() {
+			return std::max((int)_queues.size(), 1);
+		}
+
+		// 0 for the thread that called Init and for threads outside the pool, 1 to n - 1 for the workers
+		int GetThreadIndex() {
+			int index = ThreadIndex();
+			return index < (int)_queues.size() ? index : 0;
+		}
+
+		// Queues work on the calling thread's queue; counter, if given, is raised now and lowered once
+		// the work is done. Without Init the work runs right away.
+		void Run(const std::function<void()>& work, JobCounter* counter) {
+			if (_queues.empty()) {
+				work();
+				return;
+			}
+			if (counter != NULL) (*counter)++;
+			_queued++;
+			_queues[GetThreadIndex()]->Push(Job{ work, counter });
+			Wake();
+		}
+
+		// Queues work on the background queue, oldest first. Without workers it runs right away.
+		void RunBackground(const std::function<void()>& work) {
+			if (_queues.size() < 2) {
+				work();
+				return;
+			}
+			_backgroundQueued++;
+			_background.Push(Job{ work, NULL });
+			Wake();
+		}
+
+		// Joins a fork: runs the fork's jobs still in this thread's queue and waits for the ones the
+		// workers took. Nothing else runs here, so a join never picks up another thread's work, which
+		// on queue 0 could belong to the other of the main and simulation threads.
+		void Wait(JobCounter& counter) {
+			if (_queues.empty()) return;
+			JobQueue* queue = _queues[GetThreadIndex()];
+			while (counter > 0) {
+				Job job;
+				if (queue->PopFor(&counter, job)) {
+					_queued--;
+					job.work();
+					counter--;
+				} else {
+					std::this_thread::yield();
+				}
+			}
+		}
+
+		// Calls body(first, last) over [0, count) in batches of batchSize, or of a size picked from the
+		// thread count when batchSize is 0, and returns once every batch is done. The calling thread
+		// takes the first batch itself.
+		void ParallelFor(int count, int batchSize, const std::function<void(int, int)>& body) {
+			if (count <= 0) return;
+			if (batchSize <= 0) batchSize = std::max(count / (GetNThreads() * JOB_BATCHES_PER_THREAD), JOB_MIN_BATCH);
+			if (_queues.size() < 2 || count <= batchSize) {
+				body(0, count);
+				return;
+			}
+			JobCounter counter(0);
+			for (int first = batchSize; first < count; first += batchSize) {
+				int last = std::min(first + batchSize, count);
+				Run([&body, first, last]() { body(first, last); }, &counter);
+			}
+			body(0, batchSize);
+			Wait(counter);
+		}
+
+		// Stops the workers once the queues are empty and joins them
+		void Destroy() {
+			if (_queues.empty()) return;
+			_running = false;
+			{ std::lock_guard<std::mutex> lock(_sleepMutex); }
+			_wake.notify_all();
+			for (std::thread& worker : _workers) {
+				worker.join();
+			}
+			_workers.clear();
+			for (JobQueue* queue : _queues) {
+				delete(queue);
+			}
+			_queues.clear();
+		}
+
+		~JobSystem() {
+			Destroy();
+		}
+	};
+}
\ No newline at end of file
@@ -0,0 +1,148 @@
+#pragma once
+
+#include <GL/glew.h>
+#include <vector>
+#include <cstring>
+#include <sgShaderProgram.h>
+#include <sgFramePipeline.h>
+#include <sgSpotLight3D.h>
+#include <sgDirectionalLight3D.h>
+#include <sgAmbientLight.h>
+
+namespace sg {
+
+	// CPU mirrors of the std140 "Lights" uniform block declared in the lit and shadowed shaders.
+	// Positions and directions are in world space; the shaders move them to view space with "view".
+	struct SpotLightData {
+		glm::vec3 pos;
+		float intensity;
+		glm::vec3 color;
+		float range;
+		int mapTextureSet;
+		int padding[3];
+		glm::vec4 atlasRect;
+	};
+
+	struct DirLightData {
+		glm::vec3 dir;
+		float intensity;
+		glm::vec3 color;
+		int nCascades;
+		glm::vec4 atlasRect;
+		glm::vec4 cascadeSplits;
+	};
+
+	// Cascades of directional light i live at cascades[i * MAX_CASCADES + c]
+	struct CascadeData {
+		glm::mat4 shadowMatrix;
+		glm::vec4 atlasRect;
+	};
+
+	struct AmbientLightData {
+		glm::vec3 color;
+		float intensity;
+	};
+
+	struct LightBlock {
+		glm::mat4 view;
+		SpotLightData spotLights[MAX_LIGHTS];
+		DirLightData dirLights[MAX_LIGHTS];
+		AmbientLightData ambientLights[MAX_LIGHTS];
+		CascadeData cascades[MAX_LIGHTS * MAX_CASCADES];
+		int nSpotLights;
+		int nDirLights;
+		int nAmbientLights;
+		int padding;	// std140 rounds the block size up to a multiple of 16
+	};
+
+	static_assert(sizeof(SpotLightData) == 64, "SpotLightData does not match the std140 layout");
+	static_assert(sizeof(DirLightData) == 64, "DirLightData does not match the std140 layout");
+	static_assert(sizeof(AmbientLightData) == 16, "AmbientLightData does not match the std140 layout");
+	static_assert(sizeof(CascadeData) == 80, "CascadeData does not match the std140 layout");
+	static_assert(sizeof(LightBlock) % 16 == 0, "LightBlock must span the whole std140 block when bound");
+
+	// With a persistent stream buffer every frame in flight has its own copy of the block, and a copy
+	// is compared with what was last written to that same copy; otherwise there is a single one
+	class LightBuffer {
+	private:
+		StreamBuffer _stream;
+		LightBlock _uploaded[MAX_FRAMES_IN_FLIGHT];
+		bool _valid[MAX_FRAMES_IN_FLIGHT] = {};
+
+		// Uploads the smallest span of the block that covers every changed 16-byte row
+		void UploadChanges(const LightBlock& block, int slot) {
+			int copy = _stream.IsPersistent() ? slot : 0;
+			const unsigned char* next = (const unsigned char*)&block;
+			unsigned char* current = (unsigned char*)&_uploaded[copy];
+			size_t first = sizeof(LightBlock);
+			size_t last = 0;
+			if (!_valid[copy]) {
+				first = 0;
+				last = sizeof(LightBlock);
+			} else {
+				for (size_t offset = 0; offset < sizeof(LightBlock); offset += 16) {
+					size_t rowSize = glm::min((size_t)16, sizeof(LightBlock) - offset);
+					if (memcmp(current + offset, next + offset, rowSize) != 0) {
+						if (offset < first) first = offset;
+						last = offset + rowSize;
+					}
+				}
+			}
+			if (first < last) {
+				memcpy(current + first, next + first, last - first);
+				if (_stream.IsPersistent()) memcpy(_stream.GetRegion(slot) + first, current + first, last - first);
+				else GLState::BufferSubData(GL_UNIFORM_BUFFER, _stream.GetBuffer(), first, last - first, current + first);
+				_valid[copy] = true;
+			}
+			GLState::BindBufferRange(GL_UNIFORM_BUFFER, LIGHTS_BLOCK_BINDING, _stream.GetBuffer(), _stream.GetOffset(slot), sizeof(LightBlock));
+		}
+
+	public:
+		void Init() {
+			_stream.Init(GL_UNIFORM_BUFFER, sizeof(LightBlock));
+			GLState::BindBufferBase(GL_UNIFORM_BUFFER, LIGHTS_BLOCK_BINDING, _stream.GetBuffer());
+			for (int i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+				_valid[i] = false;
+			}
+		}
+
+		// slot is the frame pipeline's; the copy it names is no longer read by the GPU
+		void Update(std::vector<SpotLight3D*>& spotLights, std::vector<DirectionalLight3D*>& dirLights, std::vector<AmbientLight*>& ambientLights, glm::mat4 view, int slot) {
+			LightBlock block;
+			memset(&block, 0, sizeof(LightBlock));
+			block.view = view;
+
+			block.nSpotLights = glm::min((int)spotLights.size(), MAX_LIGHTS);
+			for (int i = 0; i < block.nSpotLights; i++) {
+				block.spotLights[i].pos = spotLights[i]->GetGlobalPosition();
+				block.spotLights[i].intensity = spotLights[i]->GetIntensity();
+				block.spotLights[i].color = spotLights[i]->GetColor();
+				block.spotLights[i].range = spotLights[i]->GetRange();
+				block.spotLights[i].mapTextureSet = spotLights[i]->GetMapTexture().isPresent ? 1 : 0;
+				block.spotLights[i].atlasRect = spotLights[i]->GetAtlasRect();
+			}
+
+			block.nDirLights = glm::min((int)dirLights.size(), MAX_LIGHTS);
+			for (int i = 0; i < block.nDirLights; i++) {
+				block.dirLights[i].dir = dirLights[i]->GlobalForward();
+				block.dirLights[i].intensity = dirLights[i]->GetIntensity();
+				block.dirLights[i].color = dirLights[i]->GetColor();
+				block.dirLights[i].atlasRect = dirLights[i]->GetAtlasRect();
+				block.dirLights[i].nCascades = dirLights[i]->GetNCascades();
+				for (int c = 0; c < dirLights[i]->GetNCascades(); c++) {
+					block.dirLights[i].cascadeSplits[c] = dirLights[i]->GetCascadeSplit(c);
+					block.cascades[i * MAX_CASCADES + c].shadowMatrix = dirLights[i]->GetCascadeShadow(c);
+					block.cascades[i * MAX_CASCADES + c].atlasRect = dirLights[i]->GetCascadeAtlasRect(c);
+				}
+			}
+
+			block.nAmbientLights = glm::min((int)ambientLights.size(), MAX_LIGHTS);
+			for (int i = 0; i < block.nAmbientLights; i++) {
+				block.ambientLights[i].color = ambientLights[i]->GetColor();
+				block.ambientLights[i].intensity = ambientLights[i]->GetIntensity();
+			}
+
+			UploadChanges(block, slot);
+		}
+	};
+}
\ No newline at end of file
@@ -0,0 +1,209 @@
+#pragma once
+
+#include <GL/glew.h>
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include <sgGLState.h>
+#include <sgShaderProgram.h>
+#include <sgPointLight3D.h>
+
+// Froxel grid: screen tiles by exponential depth slices. Must match the lit and shadowed shaders.
+#define CLUSTER_X 16
+#define CLUSTER_Y 9
+#define CLUSTER_Z 24
+#define CLUSTER_COUNT (CLUSTER_X * CLUSTER_Y * CLUSTER_Z)
+#define MAX_CLUSTERED_LIGHTS 256
+#define CLUSTER_LIGHT_TEXELS 3
+
+namespace sg {
+	// Cluster-space box a light overlaps, inclusive
+	struct ClusterBounds {
+		int minX, minY, minZ;
+		int maxX, maxY, maxZ;
+	};
+
+	// Bins the point lights into view-space froxels every frame. The shaders find their froxel from
+	// gl_FragCoord and the view depth and loop only over the lights listed for it, so the cost of a
+	// fragment follows the lights that reach it rather than the lights in the scene.
+	// Everything lives in buffer textures: light data, one (offset, count) pair per froxel, and the
+	// light indices the pairs point into.
+	class LightClusters {
+	private:
+		GLuint _lightBuffer = 0;
+		GLuint _lightTexture = 0;
+		GLuint _rangeBuffer = 0;
+		GLuint _rangeTexture = 0;
+		GLuint _indexBuffer = 0;
+		GLuint _indexTexture = 0;
+		std::vector<glm::vec4> _lights;
+		std::vector<GLuint> _ranges;
+		std::vector<GLuint> _indices;
+		std::vector<ClusterBounds> _bounds;
+		float _scale = 0;
+		float _bias = 0;
+		glm::vec2 _tileSize = glm::vec2(1);
+		int _nLights = 0;
+		int _warnedLights = 0;
+
+		static void CreateBufferTexture(GLuint& buffer, GLuint& texture, GLenum format) {
+			buffer = GLState::CreateBuffer();
+			GLState::BufferData(GL_TEXTURE_BUFFER, buffer, 16, NULL, GL_STREAM_DRAW);
+			glGenTextures(1, &texture);
+			GLState::BindTextureForEdit(GL_TEXTURE_BUFFER, texture);
+			glTexBuffer(GL_TEXTURE_BUFFER, format, buffer);
+		}
+
+		// Orphans the old storage like the instance buffer does
+		static void Upload(GLuint buffer, const void* data, size_t size) {
+			if (size == 0) return;
+			GLState::BufferData(GL_TEXTURE_BUFFER, buffer, size, NULL, GL_STREAM_DRAW);
+			GLState::BufferSubData(GL_TEXTURE_BUFFER, buffer, 0, size, data);
+		}
+
+		int Slice(float depth, float nearPlane) {
+			if (depth <= nearPlane) return 0;
+			return glm::clamp((int)floorf(logf(depth) * _scale - _bias), 0, CLUSTER_Z - 1);
+		}
+
+		static int Tile(float ndc, int tiles) {
+			return glm::clamp((int)floorf((ndc * 0.5f + 0.5f) * tiles), 0, tiles - 1);
+		}
+
+		// Returns false when the light's sphere is outside the clustered depth range or off screen
+		bool Bound(glm::vec3 center, float radius, glm::mat4 projection, float nearPlane, float farPlane, ClusterBounds& bounds) {
+			float nearDepth = -center.z - radius;
+			float farDepth = -center.z + radius;
+			if (farDepth < nearPlane || nearDepth > farPlane) return false;
+			bounds.minZ = Slice(nearDepth, nearPlane);
+			bounds.maxZ = Slice(farDepth, nearPlane);
+
+			// A sphere reaching behind the near plane cannot be projected, so it covers every tile
+			if (nearDepth <= nearPlane) {
+				bounds.minX = 0;
+				bounds.minY = 0;
+				bounds.maxX = CLUSTER_X - 1;
+				bounds.maxY = CLUSTER_Y - 1;
+				return true;
+			}
+
+			glm::vec2 minNdc(1);
+			glm::vec2 maxNdc(-1);
+			for (int i = 0; i < 8; i++) {
+				glm::vec3 corner = center + glm::vec3((i & 1) ? radius : -radius, (i & 2) ? radius : -radius, (i & 4) ? radius : -radius);
+				glm::vec4 clip = projection * glm::vec4(corner, 1);
+				glm::vec2 ndc = glm::vec2(clip) / clip.w;
+				minNdc = glm::min(minNdc, ndc);
+				maxNdc = glm::max(maxNdc, ndc);
+			}
+			if (minNdc.x > 1 || minNdc.y > 1 || maxNdc.x < -1 || maxNdc.y < -1) return false;
+			bounds.minX = Tile(minNdc.x, CLUSTER_X);
+			bounds.minY = Tile(minNdc.y, CLUSTER_Y);
+			bounds.maxX = Tile(maxNdc.x, CLUSTER_X);
+			bounds.maxY = Tile(maxNdc.y, CLUSTER_Y);
+			return true;
+		}
+
+		static int ClusterIndex(int x, int y, int z) {
+			return x + CLUSTER_X * (y + CLUSTER_Y * z);
+		}
+
+	public:
+		void Init() {
+			CreateBufferTexture(_lightBuffer, _lightTexture, GL_RGBA32F);
+			CreateBufferTexture(_rangeBuffer, _rangeTexture, GL_RG32UI);
+			CreateBufferTexture(_indexBuffer, _indexTexture, GL_R32UI);
+			_ranges.assign(CLUSTER_COUNT * 2, 0);
+		}
+
+		// shadowSlots[i] is the pointShadowTextures slot of light i, or -1 when it casts no shadow this frame
+		void Update(std::vector<PointLight3D*>& pointLights, std::vector<int>& shadowSlots, glm::mat4 view, glm::mat4 projection,
+			float nearPlane, float farPlane, int width, int height) {
+			_nLights = glm::min((int)pointLights.size(), MAX_CLUSTERED_LIGHTS);
+			// Warned about once per count over the limit rather than every frame
+			int nPointLights = (int)pointLights.size();
+			if (nPointLights > MAX_CLUSTERED_LIGHTS && nPointLights != _warnedLights) {
+				printf("Warning: %d point lights, only the first %d are drawn\n", nPointLights, MAX_CLUSTERED_LIGHTS);
+			}
+			_warnedLights = nPointLights > MAX_CLUSTERED_LIGHTS ? nPointLights : 0;
+			_scale = CLUSTER_Z / logf(farPlane / nearPlane);
+			_bias = CLUSTER_Z * logf(nearPlane) / logf(farPlane / nearPlane);
+			_tileSize = glm::vec2((float)width / CLUSTER_X, (float)height / CLUSTER_Y);
+
+			_lights.resize(_nLights * CLUSTER_LIGHT_TEXELS);
+			_bounds.resize(_nLights);
+			std::vector<bool> visible(_nLights);
+			for (int i = 0; i < _nLights; i++) {
+				PointLight3D* light = pointLights[i];
+				_lights[i * CLUSTER_LIGHT_TEXELS] = glm::vec4(light->GetGlobalPosition(), light->GetIntensity());
+				_lights[i * CLUSTER_LIGHT_TEXELS + 1] = glm::vec4(light->GetColor(), light->GetRange());
+				_lights[i * CLUSTER_LIGHT_TEXELS + 2] = glm::vec4(light->GetFarPlane(), (float)shadowSlots[i], 0, 0);
+				glm::vec3 center = glm::vec3(view * glm::vec4(light->GetGlobalPosition(), 1));
+				visible[i] = Bound(center, light->GetRange(), projection, nearPlane, farPlane, _bounds[i]);
+			}
+
+			// Counting pass, then prefix sums into offsets, then the fill pass
+			std::fill(_ranges.begin(), _ranges.end(), 0);
+			for (int i = 0; i < _nLights; i++) {
+				if (!visible[i]) continue;
+				ClusterBounds& b = _bounds[i];
+				for (int z = b.minZ; z <= b.maxZ; z++)
+					for (int y = b.minY; y <= b.maxY; y++)
+						for (int x = b.minX; x <= b.maxX; x++)
+							_ranges[ClusterIndex(x, y, z) * 2 + 1]++;
+			}
+			GLuint offset = 0;
+			for (int c = 0; c < CLUSTER_COUNT; c++) {
+				_ranges[c * 2] = offset;
+				offset += _ranges[c * 2 + 1];
+				_ranges[c * 2 + 1] = 0;
+			}
+			_indices.resize(offset);
+			for (int i = 0; i < _nLights; i++) {
+				if (!visible[i]) continue;
+				ClusterBounds& b = _bounds[i];
+				for (int z = b.minZ; z <= b.maxZ; z++)
+					for (int y = b.minY; y <= b.maxY; y++)
+						for (int x = b.minX; x <= b.maxX; x++) {
+							int c = ClusterIndex(x, y, z);
+							_indices[_ranges[c * 2] + _ranges[c * 2 + 1]++] = i;
+						}
+			}
+
+			Upload(_lightBuffer, _lights.data(), _lights.size() * sizeof(glm::vec4));
+			Upload(_rangeBuffer, _ranges.data(), _ranges.size() * sizeof(GLuint));
+			Upload(_indexBuffer, _indices.data(), _indices.size() * sizeof(GLuint));
+		}
+
+		// Binds the three buffer textures from textureUnit on and returns the next free unit
+		int Bind(std::vector<ShaderProgram*>& programs, int textureUnit) {
+			GLState::BindTexture(textureUnit, GL_TEXTURE_BUFFER, _lightTexture);
+			GLState::BindTexture(textureUnit + 1, GL_TEXTURE_BUFFER, _rangeTexture);
+			GLState::BindTexture(textureUnit + 2, GL_TEXTURE_BUFFER, _indexTexture);
+			for (ShaderProgram* program : programs) {
+				program->SetInt(program->uniforms.clusterLights, textureUnit);
+				program->SetInt(program->uniforms.clusterRanges, textureUnit + 1);
+				program->SetInt(program->uniforms.clusterIndices, textureUnit + 2);
+				program->SetFloat(program->uniforms.clusterScale, _scale);
+				program->SetFloat(program->uniforms.clusterBias, _bias);
+				program->SetVec2(program->uniforms.clusterTileSize, _tileSize);
+			}
+			return textureUnit + 3;
+		}
+
+		int GetNLights() {
+			return _nLights;
+		}
+
+		void Destroy() {
+			if (_lightBuffer == 0) return;
+			GLState::DeleteTexture(_lightTexture);
+			GLState::DeleteTexture(_rangeTexture);
+			GLState::DeleteTexture(_indexTexture);
+			GLState::DeleteBuffer(_lightBuffer);
+			GLState::DeleteBuffer(_rangeBuffer);
+			GLState::DeleteBuffer(_indexBuffer);
+			_lightBuffer = 0;
+		}
+	};
+}
\ No newline at end of file
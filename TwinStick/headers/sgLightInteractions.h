@@ -0,0 +1,43 @@
+#pragma once
+
+#include <vector>
+#include <unordered_map>
+#include <glm/glm/glm.hpp>
+#include <sgSceneBVH.h>
+#include <sgShadowedLight3D.h>
+
+namespace sg {
+	// The static objects one light's frustums reach, as slots of the static tree with their face masks
+	struct LightInteraction {
+		glm::mat4 viewProjection;
+		int staticVersion;
+		std::vector<VisibleObject> staticSlots;
+	};
+
+	// Persistent light-object interaction lists. Static objects only move when the static version
+	// does, so a light's list is queried from the static tree again only when the light itself moved
+	// (its view-projection changed) or a static object did; dynamic objects are culled every frame.
+	class LightInteractions {
+	private:
+		std::unordered_map<ShadowedLight3D*, LightInteraction> _lights;
+
+	public:
+		const std::vector<VisibleObject>& GetStaticSlots(ShadowedLight3D* light, glm::mat4 viewProjection, int staticVersion,
+			SceneBVH& staticTree, const Frustum* frustums, int nFrustums) {
+			auto it = _lights.find(light);
+			if (it != _lights.end() && it->second.staticVersion == staticVersion && it->second.viewProjection == viewProjection) {
+				return it->second.staticSlots;
+			}
+			LightInteraction& interaction = _lights[light];
+			interaction.viewProjection = viewProjection;
+			interaction.staticVersion = staticVersion;
+			interaction.staticSlots.clear();
+			staticTree.Query(frustums, nFrustums, interaction.staticSlots, true);
+			return interaction.staticSlots;
+		}
+
+		void Forget(ShadowedLight3D* light) {
+			_lights.erase(light);
+		}
+	};
+}
\ No newline at end of file
@@ -0,0 +1,99 @@
+#pragma once
+
+#include <cstddef>
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+namespace sg {
+	// Read-only view of a whole file, mapped rather than read so that large files are paged in on demand
+	// and can be parsed from several threads at once. An empty file opens with no data.
+	class MappedFile {
+	private:
+		const char* _data = NULL;
+		size_t _size = 0;
+#ifdef _WIN32
+		HANDLE _file = INVALID_HANDLE_VALUE;
+		HANDLE _mapping = NULL;
+#else
+		int _file = -1;
+#endif
+
+	public:
+		bool Open(const char* path) {
+			Close();
+#ifdef _WIN32
+			_file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+			if (_file == INVALID_HANDLE_VALUE) return false;
+			LARGE_INTEGER size;
+			if (!GetFileSizeEx(_file, &size)) {
+				Close();
+				return false;
+			}
+			_size = (size_t)size.QuadPart;
+			if (_size == 0) return true;
+			_mapping = CreateFileMappingA(_file, NULL, PAGE_READONLY, 0, 0, NULL);
+			if (_mapping != NULL) _data = (const char*)MapViewOfFile(_mapping, FILE_MAP_READ, 0, 0, 0);
+#else
+			_file = open(path, O_RDONLY);
+			if (_file < 0) return false;
+			struct stat info;
+			if (fstat(_file, &info) != 0) {
+				Close();
+				return false;
+			}
+			_size = (size_t)info.st_size;
+			if (_size == 0) return true;
+			void* data = mmap(NULL, _size, PROT_READ, MAP_PRIVATE, _file, 0);
+			if (data != MAP_FAILED) {
+				_data = (const char*)data;
+				madvise(data, _size, MADV_SEQUENTIAL);
+			}
+#endif
+			if (_data == NULL) {
+				Close();
+				return false;
+			}
+			return true;
+		}
+
+		const char* GetData() {
+			return _data;
+		}
+
+		size_t GetSize() {
+			return _size;
+		}
+
+		void Close() {
+#ifdef _WIN32
+			if (_data != NULL) UnmapViewOfFile(_data);
+			if (_mapping != NULL) CloseHandle(_mapping);
+			if (_file != INVALID_HANDLE_VALUE) CloseHandle(_file);
+			_mapping = NULL;
+			_file = INVALID_HANDLE_VALUE;
+#else
+			if (_data != NULL) munmap((void*)_data, _size);
+			if (_file >= 0) close(_file);
+			_file = -1;
+#endif
+			_data = NULL;
+			_size = 0;
+		}
+
+		~MappedFile() {
+			Close();
+		}
+	};
+}
\ No newline at end of file
@@ -0,0 +1,204 @@
+#pragma once
+
+#include <vector>
+#include <algorithm>
+#include <glm/glm/glm.hpp>
+#include <sgStructures.h>
+
+// Post-transform cache size the triangle order is tuned for and measured against
+#define VERTEX_CACHE_SIZE 16
+
+namespace sg {
+	// Post-transform cache statistics of an index buffer under a FIFO cache of VERTEX_CACHE_SIZE entries
+	struct VertexCacheStats {
+		int transformed;	// cache misses
+		int triangles;
+		int vertices;	// distinct vertices referenced
+
+		float ACMR() { return triangles > 0 ? (float)transformed / triangles : 0; }
+		float ATVR() { return vertices > 0 ? (float)transformed / vertices : 0; }
+	};
+
+	// Index and vertex reordering after load: Tipsify triangle order for the post-transform cache,
+	// its clusters sorted outside-in so front surfaces tend to be drawn first, then vertices
+	// renumbered in order of first use so fetches walk the vertex buffer forwards.
+	class MeshOptimizer {
+	private:
+		// Most recently used vertex that still has triangles to emit, and is young enough in the cache
+		// to stay there while they are emitted; otherwise one from the dead-end stack or the next unfinished vertex
+		static int NextVertex(const std::vector<int>& candidates, const std::vector<int>& live, const std::vector<int>& stamps, int time,
+			std::vector<int>& deadEnds, int& cursor, int nVertices) {
+			int best = -1;
+			int bestPriority = -1;
+			for (int v : candidates) {
+				if (live[v] == 0) continue;
+				int priority = 0;
+				if (time - stamps[v] + 2 * live[v] <= VERTEX_CACHE_SIZE) priority = time - stamps[v];
+				if (priority > bestPriority) {
+					bestPriority = priority;
+					best = v;
+				}
+			}
+			if (best >= 0) return best;
+			while (!deadEnds.empty()) {
+				int v = deadEnds.back();
+				deadEnds.pop_back();
+				if (live[v] > 0) return v;
+			}
+			while (cursor < nVertices) {
+				if (live[cursor] > 0) return cursor;
+				cursor++;
+			}
+			return -1;
+		}
+
+		// Tipsify (Sander, Nehab and Barczak 2007). Returns the new order and, in clusters, the first
+		// triangle of every run that starts from a vertex no longer in the cache.
+		static std::vector<Triangle> Tipsify(const Triangle* triangles, int nTriangles, int nVertices, std::vector<int>& clusters) {
+			std::vector<int> firstAround(nVertices + 1, 0);
+			for (int t = 0; t < nTriangles; t++)
+				for (int k = 0; k < 3; k++) firstAround[triangles[t].index[k] + 1]++;
+			for (int v = 0; v < nVertices; v++) firstAround[v + 1] += firstAround[v];
+			std::vector<int> around(firstAround[nVertices]);
+			std::vector<int> fill(firstAround.begin(), firstAround.end() - 1);
+			for (int t = 0; t < nTriangles; t++)
+				for (int k = 0; k < 3; k++) around[fill[triangles[t].index[k]]++] = t;
+
+			std::vector<int> live(nVertices);
+			for (int v = 0; v < nVertices; v++) live[v] = firstAround[v + 1] - firstAround[v];
+			std::vector<int> stamps(nVertices, -VERTEX_CACHE_SIZE - 1);
+			std::vector<bool> emitted(nTriangles, false);
+			std::vector<int> deadEnds;
+			std::vector<int> candidates;
+			std::vector<Triangle> result;
+			result.reserve(nTriangles);
+			clusters.clear();
+
+			int time = VERTEX_CACHE_SIZE + 1;
+			int cursor = 0;
+			int fan = NextVertex(candidates, live, stamps, time, deadEnds, cursor, nVertices);
+			while (fan >= 0) {
+				if (time - stamps[fan] > VERTEX_CACHE_SIZE) clusters.push_back((int)result.size());
+				candidates.clear();
+				for (int i = firstAround[fan]; i < firstAround[fan + 1]; i++) {
+					int t = around[i];
+					if (emitted[t]) continue;
+					emitted[t] = true;
+					result.push_back(triangles[t]);
+					for (int k = 0; k < 3; k++) {
+						int v = triangles[t].index[k];
+						deadEnds.push_back(v);
+						candidates.push_back(v);
+						live[v]--;
+						if (time - stamps[v] > VERTEX_CACHE_SIZE) stamps[v] = time++;
+					}
+				}
+				fan = NextVertex(candidates, live, stamps, time, deadEnds, cursor, nVertices);
+			}
+			return result;
+		}
+
+		// Orders the clusters by how far they face out from the mesh centre, a view-independent stand-in
+		// for how likely they are to occlude the rest
+		static void SortClusters(const Vertex* vertices, std::vector<Triangle>& triangles, const std::vector<int>& clusters) {
+			if (clusters.size() < 2) return;
+			glm::vec3 meshCentroid(0);
+			float meshArea = 0;
+			std::vector<float> scores(clusters.size());
+			std::vector<glm::vec3> centroids(clusters.size());
+			std::vector<glm::vec3> normals(clusters.size());
+			for (int c = 0; c < clusters.size(); c++) {
+				int end = c + 1 < clusters.size() ? clusters[c + 1] : (int)triangles.size();
+				glm::vec3 centroid(0);
+				glm::vec3 normal(0);
+				float area = 0;
+				for (int t = clusters[c]; t < end; t++) {
+					glm::vec3 a = vertices[triangles[t].index[0]].coord;
+					glm::vec3 b = vertices[triangles[t].index[1]].coord;
+					glm::vec3 d = vertices[triangles[t].index[2]].coord;
+					glm::vec3 n = glm::cross(b - a, d - a);
+					float triangleArea = glm::length(n);
+					centroid += (a + b + d) / 3.0f * triangleArea;
+					normal += n;
+					area += triangleArea;
+				}
+				meshCentroid += centroid;
+				meshArea += area;
+				centroids[c] = area > 0 ? centroid / area : vertices[triangles[clusters[c]].index[0]].coord;
+				normals[c] = glm::length(normal) > 0 ? glm::normalize(normal) : glm::vec3(0);
+			}
+			if (meshArea > 0) meshCentroid /= meshArea;
+			for (int c = 0; c < clusters.size(); c++) {
+				scores[c] = glm::dot(centroids[c] - meshCentroid, normals[c]);
+			}
+
+			std::vector<int> order(clusters.size());
+			for (int c = 0; c < order.size(); c++) order[c] = c;
+			std::stable_sort(order.begin(), order.end(), [&scores](int a, int b) { return scores[a] > scores[b]; });
+			std::vector<Triangle> sorted;
+			sorted.reserve(triangles.size());
+			for (int c : order) {
+				int end = c + 1 < clusters.size() ? clusters[c + 1] : (int)triangles.size();
+				sorted.insert(sorted.end(), triangles.begin() + clusters[c], triangles.begin() + end);
+			}
+			triangles.swap(sorted);
+		}
+
+	public:
+		static VertexCacheStats AnalyzeVertexCache(const Triangle* triangles, int nTriangles, int nVertices) {
+			VertexCacheStats stats = { 0, nTriangles, 0 };
+			std::vector<int> stamps(nVertices, -1);
+			std::vector<bool> seen(nVertices, false);
+			int time = VERTEX_CACHE_SIZE;
+			for (int t = 0; t < nTriangles; t++) {
+				for (int k = 0; k < 3; k++) {
+					int v = triangles[t].index[k];
+					if (!seen[v]) {
+						seen[v] = true;
+						stats.vertices++;
+					}
+					if (stamps[v] < 0 || time - stamps[v] >= VERTEX_CACHE_SIZE) {
+						stamps[v] = ++time;
+						stats.transformed++;
+					}
+				}
+			}
+			return stats;
+		}
+
+		// Reorders the triangles in place
+		static void OptimizeTriangles(const Vertex* vertices, int nVertices, Triangle* triangles, int nTriangles) {
+			if (nTriangles == 0) return;
+			std::vector<int> clusters;
+			std::vector<Triangle> ordered = Tipsify(triangles, nTriangles, nVertices, clusters);
+			SortClusters(vertices, ordered, clusters);
+			std::copy(ordered.begin(), ordered.end(), triangles);
+		}
+
+		// Renumbers the vertices in order of first use by the index buffers, in the order given, and
+		// rewrites the indices; unused vertices go last
+		static void OptimizeVertexFetch(Vertex* vertices, int nVertices, std::vector<std::pair<Triangle*, int>>& indexBuffers) {
+			std::vector<int> remap(nVertices, -1);
+			std::vector<unsigned int> order;
+			order.reserve(nVertices);
+			for (auto& buffer : indexBuffers) {
+				for (int t = 0; t < buffer.second; t++) {
+					for (int k = 0; k < 3; k++) {
+						unsigned int& index = buffer.first[t].index[k];
+						if (remap[index] < 0) {
+							remap[index] = (int)order.size();
+							order.push_back(index);
+						}
+						index = remap[index];
+					}
+				}
+			}
+			for (int v = 0; v < nVertices; v++) {
+				if (remap[v] < 0) order.push_back(v);
+			}
+			std::vector<Vertex> reordered(nVertices);
+			for (int v = 0; v < nVertices; v++) reordered[v] = vertices[order[v]];
+			std::copy(reordered.begin(), reordered.end(), vertices);
+		}
+	};
+}
\ No newline at end of file
@@ -0,0 +1,235 @@
+#pragma once
+
+#include <vector>
+#include <algorithm>
+#include <glm/glm/glm.hpp>
+#include <sgStructures.h>
+
+namespace sg {
+	// Weighted sum of squared distances to a set of planes, stored as the upper half of a symmetric
+	// 4x4 matrix, along with the sum of the weights
+	struct Quadric {
+		double xx = 0, xy = 0, xz = 0, xw = 0, yy = 0, yz = 0, yw = 0, zz = 0, zw = 0, ww = 0;
+		double weight = 0;
+
+		void AddPlane(glm::dvec3 n, double d, double weight) {
+			xx += weight * n.x * n.x; xy += weight * n.x * n.y; xz += weight * n.x * n.z; xw += weight * n.x * d;
+			yy += weight * n.y * n.y; yz += weight * n.y * n.z; yw += weight * n.y * d;
+			zz += weight * n.z * n.z; zw += weight * n.z * d;
+			ww += weight * d * d;
+			this->weight += weight;
+		}
+
+		void Add(const Quadric& q) {
+			xx += q.xx; xy += q.xy; xz += q.xz; xw += q.xw;
+			yy += q.yy; yz += q.yz; yw += q.yw;
+			zz += q.zz; zw += q.zw;
+			ww += q.ww;
+			weight += q.weight;
+		}
+
+		double Error(glm::dvec3 p) const {
+			return xx * p.x * p.x + 2 * xy * p.x * p.y + 2 * xz * p.x * p.z + 2 * xw * p.x
+				+ yy * p.y * p.y + 2 * yz * p.y * p.z + 2 * yw * p.y
+				+ zz * p.z * p.z + 2 * zw * p.z
+				+ ww;
+		}
+
+		// Squared distance to the planes, averaged by their weights, so it can be compared with a length squared
+		double MeanError(glm::dvec3 p) const {
+			if (weight <= 0) return 0;
+			return Error(p) / weight;
+		}
+	};
+
+	// Quadric edge-collapse simplification of one index buffer over a shared vertex array. Vertices
+	// only ever collapse onto other existing vertices, so every level can keep using the model's
+	// vertex buffer. Vertices are welded by position first; positions split by a texture seam, and
+	// positions on an open border, are locked so the simplified mesh does not tear. Positions split
+	// only by normals, as on flat-shaded models, may collapse: each corner takes the destination
+	// vertex whose normal is closest to its own.
+	class MeshSimplifier {
+	private:
+		const Vertex* _vertices;
+		std::vector<int> _group;	// welded position of each vertex
+		std::vector<int> _representative;	// first vertex of each welded position
+		std::vector<int> _firstInGroup;	// vertices of each welded position, in compressed rows
+		std::vector<int> _groupVertices;
+		int _nGroups = 0;
+
+		struct Collapse {
+			int from;
+			int to;
+			double cost;
+		};
+
+		glm::dvec3 Position(int group) {
+			return glm::dvec3(_vertices[_representative[group]].coord);
+		}
+
+		static glm::dvec3 Normal(glm::dvec3 a, glm::dvec3 b, glm::dvec3 c) {
+			return glm::cross(b - a, c - a);
+		}
+
+		// The vertex of a welded position with the given texture coordinates and the normal nearest to normal
+		int Wedge(int group, glm::vec2 texture, glm::vec3 normal, int fallback) {
+			int best = fallback;
+			float bestDot = -2;
+			for (int i = _firstInGroup[group]; i < _firstInGroup[group + 1]; i++) {
+				const Vertex& v = _vertices[_groupVertices[i]];
+				if (v.texture != texture) continue;
+				float d = glm::dot(v.normal, normal);
+				if (d > bestDot) {
+					bestDot = d;
+					best = _groupVertices[i];
+				}
+			}
+			return best;
+		}
+
+	public:
+		MeshSimplifier(const Vertex* vertices, int nVertices) {
+			_vertices = vertices;
+			std::vector<int> order(nVertices);
+			for (int i = 0; i < nVertices; i++) order[i] = i;
+			auto less = [vertices](int a, int b) {
+				const glm::vec3& p = vertices[a].coord;
+				const glm::vec3& q = vertices[b].coord;
+				if (p.x != q.x) return p.x < q.x;
+				if (p.y != q.y) return p.y < q.y;
+				return p.z < q.z;
+			};
+			std::sort(order.begin(), order.end(), less);
+			_group.assign(nVertices, 0);
+			for (int i = 0; i < nVertices; i++) {
+				if (i == 0 || less(order[i - 1], order[i])) {
+					_representative.push_back(order[i]);
+					_nGroups++;
+				}
+				_group[order[i]] = _nGroups - 1;
+			}
+			// order is sorted by position, so each group's vertices are already contiguous in it
+			_groupVertices = order;
+			_firstInGroup.assign(_nGroups + 1, 0);
+			for (int i = 0; i < nVertices; i++) _firstInGroup[_group[order[i]] + 1]++;
+			for (int g = 0; g < _nGroups; g++) _firstInGroup[g + 1] += _firstInGroup[g];
+		}
+
+		// Collapses edges, cheapest first, until the mesh has at most targetTriangles triangles or
+		// the next collapse would move the surface by more than maxError, as the area-weighted root mean
+		// square of its distance to the planes around the pair
+		std::vector<Triangle> Simplify(const Triangle* triangles, int nTriangles, int targetTriangles, float maxError) {
+			std::vector<Triangle> tris(triangles, triangles + nTriangles);
+			std::vector<Quadric> quadrics(_nGroups);
+			std::vector<int> seen(_nGroups, -1);
+			std::vector<bool> locked(_nGroups, false);
+			std::vector<std::pair<int, int>> edges;
+			for (const Triangle& t : tris) {
+				int g[3] = { _group[t.index[0]], _group[t.index[1]], _group[t.index[2]] };
+				glm::dvec3 n = Normal(Position(g[0]), Position(g[1]), Position(g[2]));
+				double area = glm::length(n);
+				if (area > 0) {
+					n /= area;
+					for (int k = 0; k < 3; k++) quadrics[g[k]].AddPlane(n, -glm::dot(n, Position(g[0])), area);
+				}
+				for (int k = 0; k < 3; k++) {
+					int v = t.index[k];
+					if (seen[g[k]] >= 0 && _vertices[seen[g[k]]].texture != _vertices[v].texture) locked[g[k]] = true;
+					seen[g[k]] = v;
+					int a = g[k], b = g[(k + 1) % 3];
+					edges.push_back(std::make_pair(glm::min(a, b), glm::max(a, b)));
+				}
+			}
+			// An edge used by a single triangle lies on an open border
+			std::sort(edges.begin(), edges.end());
+			for (int i = 0; i < edges.size(); i++) {
+				bool shared = (i > 0 && edges[i - 1] == edges[i]) || (i + 1 < edges.size() && edges[i + 1] == edges[i]);
+				if (!shared) locked[edges[i].first] = locked[edges[i].second] = true;
+			}
+
+			double maxCost = (double)maxError * maxError;
+			std::vector<int> firstAround(_nGroups + 1);
+			std::vector<int> around;
+			std::vector<bool> touched(_nGroups);
+			std::vector<Collapse> collapses;
+			int remaining = (int)tris.size();
+			while (remaining > targetTriangles) {
+				// Triangles around each welded position, in compressed rows
+				std::fill(firstAround.begin(), firstAround.end(), 0);
+				for (const Triangle& t : tris)
+					for (int k = 0; k < 3; k++) firstAround[_group[t.index[k]] + 1]++;
+				for (int g = 0; g < _nGroups; g++) firstAround[g + 1] += firstAround[g];
+				around.resize(firstAround[_nGroups]);
+				std::vector<int> fill(firstAround.begin(), firstAround.end() - 1);
+				for (int i = 0; i < tris.size(); i++)
+					for (int k = 0; k < 3; k++) around[fill[_group[tris[i].index[k]]]++] = i;
+
+				collapses.clear();
+				for (const Triangle& t : tris) {
+					for (int k = 0; k < 3; k++) {
+						int a = _group[t.index[k]], b = _group[t.index[(k + 1) % 3]];
+						for (int dir = 0; dir < 2; dir++) {
+							int from = dir == 0 ? a : b;
+							int to = dir == 0 ? b : a;
+							if (locked[from]) continue;
+							Quadric q = quadrics[from];
+							q.Add(quadrics[to]);
+							collapses.push_back(Collapse{ from, to, q.MeanError(Position(to)) });
+						}
+					}
+				}
+				std::sort(collapses.begin(), collapses.end(), [](const Collapse& a, const Collapse& b) { return a.cost < b.cost; });
+
+				std::fill(touched.begin(), touched.end(), false);
+				int collapsed = 0;
+				for (const Collapse& c : collapses) {
+					if (remaining <= targetTriangles || c.cost > maxCost) break;
+					if (touched[c.from] || touched[c.to]) continue;
+
+					// Reject collapses that flip a triangle, and find the vertex of the destination this texture chart uses
+					int toVertex = -1;
+					bool flips = false;
+					for (int i = firstAround[c.from]; i < firstAround[c.from + 1] && !flips; i++) {
+						const Triangle& t = tris[around[i]];
+						int g[3] = { _group[t.index[0]], _group[t.index[1]], _group[t.index[2]] };
+						if (g[0] == c.to || g[1] == c.to || g[2] == c.to) {
+							for (int k = 0; k < 3; k++) if (g[k] == c.to) toVertex = t.index[k];
+							continue;
+						}
+						glm::dvec3 p[3] = { Position(g[0]), Position(g[1]), Position(g[2]) };
+						glm::dvec3 before = Normal(p[0], p[1], p[2]);
+						for (int k = 0; k < 3; k++) if (g[k] == c.from) p[k] = Position(c.to);
+						glm::dvec3 after = Normal(p[0], p[1], p[2]);
+						flips = glm::dot(before, after) <= 0;
+					}
+					if (flips || toVertex < 0) continue;
+
+					for (int i = firstAround[c.from]; i < firstAround[c.from + 1]; i++) {
+						Triangle& t = tris[around[i]];
+						bool degenerate = false;
+						for (int k = 0; k < 3; k++) {
+							if (_group[t.index[k]] == c.to) degenerate = true;
+							touched[_group[t.index[k]]] = true;
+						}
+						for (int k = 0; k < 3; k++) {
+							if (_group[t.index[k]] == c.from) {
+								t.index[k] = Wedge(c.to, _vertices[toVertex].texture, _vertices[t.index[k]].normal, toVertex);
+							}
+						}
+						if (degenerate) remaining--;
+					}
+					quadrics[c.to].Add(quadrics[c.from]);
+					collapsed++;
+				}
+				if (collapsed == 0) break;
+
+				tris.erase(std::remove_if(tris.begin(), tris.end(), [this](const Triangle& t) {
+					int a = _group[t.index[0]], b = _group[t.index[1]], c = _group[t.index[2]];
+					return a == b || b == c || c == a;
+				}), tris.end());
+				remaining = (int)tris.size();
+			}
+			return tris;
+		}
+	};
+}
\ No newline at end of file
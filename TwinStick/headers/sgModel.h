@@ -1,8 +1,28 @@
 #pragma once
 
 #include <unordered_map>
+#include <vector>
 #include <string>
+#include <cmath>
+#include <cfloat>
+#include <cstddef>
+#include <atomic>
+#include <future>
+#include <glm/glm/gtc/packing.hpp>
+#include <glm/glm/gtx/transform.hpp>
 #include <sgStructures.h>
+#include <sgMeshSimplifier.h>
+#include <sgMeshOptimizer.h>
+#include <sgJobSystem.h>
+#include <sgMappedFile.h>
+#include <sgObjParser.h>
+
+// Screen-space radius, in pixels, below which a model drops from full detail to its first simplified level;
+// every halving of the radius moves one level further
+#define LOD_FULL_DETAIL_PIXELS 200.0f
+// Surface error allowed for the first simplified level, as a fraction of the model's diagonal; it doubles per level
+#define LOD_ERROR 0.01f
+#define LOD_MIN_TRIANGLES 64
 
 namespace sg {
 
@@ -16,10 +36,23 @@ namespace sg {
 		Mesh* _meshes;
 		glm::vec3 _lowerBound;
 		glm::vec3 _upperBound;
+		GLuint _vao;
 		GLuint _vbo;
+		GLuint _ebo;
+		GLuint _positionVao;
+		GLuint _positionVbo;
+		int _nLods;
+		VertexCacheStats _unoptimizedCache;
+		VertexCacheStats _optimizedCache;
+		bool _packed;
+		glm::mat4 _dequantization;
+		GLenum _indexType;
+		std::atomic<bool> _loaded;
+		std::atomic<bool> _failed;
+		std::shared_future<bool> _loading;
 
 	public:
-		Model() { _nVertices = 0; _nMeshes = 0; _nMaterials = 0; _vertices = NULL;  _meshes = NULL;  _materials = NULL; _vbo = -1; }
+		Model() { _nVertices = 0; _nMeshes = 0; _nMaterials = 0; _vertices = NULL;  _meshes = NULL;  _materials = NULL; _vao = 0; _vbo = 0; _ebo = 0; _positionVao = 0; _positionVbo = 0; _nLods = 1; _unoptimizedCache = VertexCacheStats(); _optimizedCache = VertexCacheStats(); _packed = true; _dequantization = glm::mat4(1); _indexType = GL_UNSIGNED_INT; _loaded = false; _failed = false; }
 		unsigned int GetNVertices() { return _nVertices; }
 		unsigned int GetNMaterials() { return _nMaterials; }
 		unsigned int GetNMeshes() { return _nMeshes; }
@@ -45,6 +78,7 @@ namespace sg {
 			_meshes[0].materialName = _materials[0].name;
 			_meshes[0].hasMaterial = true;
 			_nMeshes = 1;
+			_loaded = true;
 		}
 		void InitFromVerticesMaterialsAndMeshes(sg::Vertex vertices[], int nVertices, sg::Material materials[], int nMaterials, sg::Mesh meshes[], int nMeshes) {
 			_vertices = vertices;
@@ -57,20 +91,265 @@ namespace sg {
 			_meshes = new Mesh[nMeshes];
 			for (int i = 0; i < nMaterials; i++) _meshes[i] = meshes[i];
 			_nMeshes = nMeshes;
+			_loaded = true;
+		}
+		// With a job system the file is parsed in parallel; the result is the same either way
+		bool LoadFromObj(char const* filename, bool invertYZ = false, JobSystem* jobs = NULL);
+		// Parses the file on a job thread and returns at once; the model can be handed to objects and the
+		// renderer straight away, which leave it out of drawing until IsLoaded
+		std::shared_future<bool> LoadFromObjAsync(char const* filename, JobSystem* jobs, bool invertYZ = false) {
+			if (jobs->GetNThreads() < 2) {
+				std::promise<bool> done;
+				done.set_value(LoadFromObj(filename, invertYZ, jobs));
+				_loading = done.get_future().share();
+				return _loading;
+			}
+			std::shared_ptr<std::promise<bool>> done = std::make_shared<std::promise<bool>>();
+			_loading = done->get_future().share();
+			std::string path = filename;
+			jobs->RunBackground([this, done, path, invertYZ, jobs]() { done->set_value(LoadFromObj(path.c_str(), invertYZ, jobs)); });
+			return _loading;
+		}
+		// True once the CPU data is complete; set last, so everything else is visible to whoever sees it
+		bool IsLoaded() {
+			return _loaded;
 		}
-		bool LoadFromObj(char const* filename, bool invertYZ = false);
-		void SetVBO(GLuint vao) {
-			if (_vbo == -1) {
-				glBindVertexArray(vao);
-				glGenBuffers(1, &_vbo);
-				glBindBuffer(GL_ARRAY_BUFFER, _vbo);
-				glBufferData(GL_ARRAY_BUFFER, sizeof(sg::Vertex) * _nVertices, _vertices, GL_STATIC_DRAW);
+		// True when LoadFromObj gave up; the model will never load
+		bool IsFailed() {
+			return _failed;
+		}
+		// Builds each mesh's chain of simplified index buffers, each level aiming at half the triangles
+		// of the previous one. A mesh stops early when simplification no longer gets anywhere.
+		void GenerateLods() {
+			MeshSimplifier simplifier(_vertices, _nVertices);
+			float diagonal = glm::length(_upperBound - _lowerBound);
+			_nLods = 1;
+			for (int i = 0; i < _nMeshes; i++) {
+				Mesh& mesh = _meshes[i];
+				mesh.nLods = 0;
+				for (int level = 1; level < MESH_MAX_LODS; level++) {
+					int previous = mesh.GetNTriangles(level - 1);
+					if (previous < LOD_MIN_TRIANGLES) break;
+					std::vector<Triangle> simplified = simplifier.Simplify(level == 1 ? mesh.triangles : mesh.lodTriangles[level - 2], previous,
+						previous / 2, diagonal * LOD_ERROR * (1 << (level - 1)));
+					if (simplified.size() > previous * 0.9f) break;
+					mesh.lodTriangles[level - 1] = new Triangle[simplified.size()];
+					std::copy(simplified.begin(), simplified.end(), mesh.lodTriangles[level - 1]);
+					mesh.lodNTriangles[level - 1] = (int)simplified.size();
+					mesh.nLods = level;
+				}
+				_nLods = glm::max(_nLods, mesh.nLods + 1);
 			}
 		}
-		GLuint GetVBO() {
-			return _vbo;
+		// Reorders every level's triangles for the vertex cache and overdraw, then the vertices for fetch
+		// locality, and keeps the full-detail cache efficiency before and after
+		void Optimize() {
+			_unoptimizedCache = AnalyzeVertexCache();
+			for (int i = 0; i < _nMeshes; i++) {
+				MeshOptimizer::OptimizeTriangles(_vertices, _nVertices, _meshes[i].triangles, _meshes[i].nTriangles);
+				for (int level = 0; level < _meshes[i].nLods; level++) {
+					MeshOptimizer::OptimizeTriangles(_vertices, _nVertices, _meshes[i].lodTriangles[level], _meshes[i].lodNTriangles[level]);
+				}
+			}
+			std::vector<std::pair<Triangle*, int>> indexBuffers;
+			for (int i = 0; i < _nMeshes; i++) {
+				indexBuffers.push_back(std::make_pair(_meshes[i].triangles, _meshes[i].nTriangles));
+			}
+			for (int i = 0; i < _nMeshes; i++) {
+				for (int level = 0; level < _meshes[i].nLods; level++) {
+					indexBuffers.push_back(std::make_pair(_meshes[i].lodTriangles[level], _meshes[i].lodNTriangles[level]));
+				}
+			}
+			MeshOptimizer::OptimizeVertexFetch(_vertices, _nVertices, indexBuffers);
+			_optimizedCache = AnalyzeVertexCache();
+		}
+		// Full-detail meshes drawn one after the other, as the renderer does
+		VertexCacheStats AnalyzeVertexCache() {
+			VertexCacheStats total = { 0, 0, 0 };
+			for (int i = 0; i < _nMeshes; i++) {
+				VertexCacheStats stats = MeshOptimizer::AnalyzeVertexCache(_meshes[i].triangles, _meshes[i].nTriangles, _nVertices);
+				total.transformed += stats.transformed;
+				total.triangles += stats.triangles;
+				total.vertices += stats.vertices;
+			}
+			return total;
+		}
+		int GetNLods() {
+			return _nLods;
+		}
+		VertexCacheStats GetUnoptimizedVertexCacheStats() {
+			return _unoptimizedCache;
+		}
+		VertexCacheStats GetVertexCacheStats() {
+			return _optimizedCache;
+		}
+		// Level for a model whose bounding sphere covers screenRadius pixels; a positive bias picks coarser levels
+		int SelectLod(float screenRadius, float bias) {
+			if (_nLods == 1) return 0;
+			float level = log2f(LOD_FULL_DETAIL_PIXELS / glm::max(screenRadius, 1e-3f)) + bias;
+			return glm::clamp((int)floorf(level), 0, _nLods - 1);
+		}
+		// Builds the vertex array with its vertex buffer and a single element buffer holding every mesh,
+		// so drawing only needs the VAO bound and each mesh's offset into the indices
+		void Upload() {
+			if (_vao != 0) return;
+			glGenVertexArrays(1, &_vao);
+			GLState::BindVertexArray(_vao);
+
+			// Packed positions are in [0, 1] across the bounding box; the renderer folds the
+			// dequantization into each instance's model matrix
+			std::vector<PackedVertex> packed;
+			if (_packed) {
+				glm::vec3 lower(FLT_MAX);
+				glm::vec3 upper(-FLT_MAX);
+				for (int i = 0; i < _nVertices; i++) {
+					lower = glm::min(lower, _vertices[i].coord);
+					upper = glm::max(upper, _vertices[i].coord);
+				}
+				glm::vec3 extent = upper - lower;
+				for (int c = 0; c < 3; c++) {
+					if (extent[c] <= 0) extent[c] = 1;
+				}
+				_dequantization = glm::translate(lower) * glm::scale(extent);
+				packed.resize(_nVertices);
+				for (int i = 0; i < _nVertices; i++) {
+					glm::vec3 q = glm::round(glm::clamp((_vertices[i].coord - lower) / extent, 0.0f, 1.0f) * 65535.0f);
+					packed[i].coord[0] = (unsigned short)q.x;
+					packed[i].coord[1] = (unsigned short)q.y;
+					packed[i].coord[2] = (unsigned short)q.z;
+					packed[i].coord[3] = 0;
+					packed[i].normal = glm::packSnorm3x10_1x2(glm::vec4(_vertices[i].normal, 0));
+					packed[i].texture = glm::packHalf2x16(_vertices[i].texture);
+				}
+			}
+
+			_vbo = GLState::CreateBuffer();
+			GLState::BindBuffer(GL_ARRAY_BUFFER, _vbo);
+			glEnableVertexAttribArray(0);
+			glEnableVertexAttribArray(1);
+			glEnableVertexAttribArray(2);
+			if (_packed) {
+				GLState::BufferData(GL_ARRAY_BUFFER, _vbo, sizeof(PackedVertex) * _nVertices, packed.data(), GL_STATIC_DRAW);
+				glVertexAttribPointer(0, 3, GL_UNSIGNED_SHORT, GL_TRUE, sizeof(PackedVertex), (GLvoid*)offsetof(PackedVertex, coord));
+				glVertexAttribPointer(1, 2, GL_HALF_FLOAT, GL_FALSE, sizeof(PackedVertex), (GLvoid*)offsetof(PackedVertex, texture));
+				glVertexAttribPointer(2, 4, GL_INT_2_10_10_10_REV, GL_TRUE, sizeof(PackedVertex), (GLvoid*)offsetof(PackedVertex, normal));
+			} else {
+				GLState::BufferData(GL_ARRAY_BUFFER, _vbo, sizeof(sg::Vertex) * _nVertices, _vertices, GL_STATIC_DRAW);
+				glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(sg::Vertex), (GLvoid*)0);
+				glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, sizeof(sg::Vertex), (GLvoid*)(sizeof(float) * 3));
+				glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, sizeof(sg::Vertex), (GLvoid*)(sizeof(float) * 5));
+			}
+			for (int i = 0; i < 4; i++) {
+				glEnableVertexAttribArray(INSTANCE_MODEL_LOCATION + i);
+				glVertexAttribDivisor(INSTANCE_MODEL_LOCATION + i, 1);
+			}
+			for (int i = 0; i < 3; i++) {
+				glEnableVertexAttribArray(INSTANCE_NORMAL_LOCATION + i);
+				glVertexAttribDivisor(INSTANCE_NORMAL_LOCATION + i, 1);
+			}
+			glEnableVertexAttribArray(INSTANCE_LIGHT_MASK_LOCATION);
+			glVertexAttribDivisor(INSTANCE_LIGHT_MASK_LOCATION, 1);
+
+			// Every level of every mesh goes in the same element buffer, with 16-bit indices when they fit
+			_indexType = _nVertices < 65536 ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+			size_t triangleSize = (_indexType == GL_UNSIGNED_SHORT ? sizeof(unsigned short) : sizeof(unsigned int)) * 3;
+			size_t nTriangles = 0;
+			for (int i = 0; i < _nMeshes; i++) {
+				for (int level = 0; level <= _meshes[i].nLods; level++) {
+					nTriangles += _meshes[i].GetNTriangles(level);
+				}
+			}
+			_ebo = GLState::CreateBuffer();
+			glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, _ebo);
+			GLState::BufferData(GL_ELEMENT_ARRAY_BUFFER, _ebo, triangleSize * nTriangles, NULL, GL_STATIC_DRAW);
+			size_t offset = 0;
+			for (int i = 0; i < _nMeshes; i++) {
+				for (int level = 0; level <= _meshes[i].nLods; level++) {
+					Triangle* triangles = level == 0 ? _meshes[i].triangles : _meshes[i].lodTriangles[level - 1];
+					int count = _meshes[i].GetNTriangles(level);
+					if (level == 0) _meshes[i].indexOffset = offset;
+					else _meshes[i].lodIndexOffsets[level - 1] = offset;
+					if (_indexType == GL_UNSIGNED_SHORT) {
+						std::vector<unsigned short> indices(count * 3);
+						for (int t = 0; t < count * 3; t++) indices[t] = (unsigned short)triangles[t / 3].index[t % 3];
+						GLState::BufferSubData(GL_ELEMENT_ARRAY_BUFFER, _ebo, offset, triangleSize * count, indices.data());
+					} else {
+						GLState::BufferSubData(GL_ELEMENT_ARRAY_BUFFER, _ebo, offset, triangleSize * count, triangles);
+					}
+					offset += triangleSize * count;
+				}
+			}
+
+			// A second vertex array reading tightly packed positions, for the depth-only passes:
+			// a third of the vertex fetch bandwidth, and the same element buffer
+			glGenVertexArrays(1, &_positionVao);
+			GLState::BindVertexArray(_positionVao);
+			_positionVbo = GLState::CreateBuffer();
+			GLState::BindBuffer(GL_ARRAY_BUFFER, _positionVbo);
+			glEnableVertexAttribArray(0);
+			if (_packed) {
+				std::vector<unsigned short> positions(_nVertices * 4);
+				for (int i = 0; i < _nVertices; i++) {
+					std::copy(packed[i].coord, packed[i].coord + 4, &positions[i * 4]);
+				}
+				GLState::BufferData(GL_ARRAY_BUFFER, _positionVbo, sizeof(unsigned short) * 4 * _nVertices, positions.data(), GL_STATIC_DRAW);
+				glVertexAttribPointer(0, 3, GL_UNSIGNED_SHORT, GL_TRUE, sizeof(unsigned short) * 4, (GLvoid*)0);
+			} else {
+				std::vector<glm::vec3> positions(_nVertices);
+				for (int i = 0; i < _nVertices; i++) {
+					positions[i] = _vertices[i].coord;
+				}
+				GLState::BufferData(GL_ARRAY_BUFFER, _positionVbo, sizeof(glm::vec3) * _nVertices, positions.data(), GL_STATIC_DRAW);
+				glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(glm::vec3), (GLvoid*)0);
+			}
+			for (int i = 0; i < 4; i++) {
+				glEnableVertexAttribArray(INSTANCE_MODEL_LOCATION + i);
+				glVertexAttribDivisor(INSTANCE_MODEL_LOCATION + i, 1);
+			}
+			glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, _ebo);
+
+			GLState::BindVertexArray(0);
+		}
+		// Packed vertices are on by default; call before Upload to keep the full float layout
+		void SetPackedVertices(bool packed) {
+			_packed = packed;
+		}
+		// Maps the uploaded positions back to model space, identity unless the vertices are packed
+		glm::mat4 GetDequantization() {
+			return _dequantization;
+		}
+		GLenum GetIndexType() {
+			return _indexType;
+		}
+		bool IsUploaded() {
+			return _vao != 0;
+		}
+		GLuint GetVAO() {
+			return _vao;
+		}
+		GLuint GetPositionVAO() {
+			return _positionVao;
+		}
+		// A load still running on a job thread must not be left writing into freed memory
+		~Model() {
+			if (_loading.valid()) _loading.wait();
 		}
 		void Destroy() {
+			if (_loading.valid()) _loading.wait();
+			if (_vao != 0) {
+				GLState::DeleteVertexArray(_vao);
+				GLState::DeleteBuffer(_vbo);
+				GLState::DeleteBuffer(_ebo);
+				GLState::DeleteVertexArray(_positionVao);
+				GLState::DeleteBuffer(_positionVbo);
+				_vao = 0;
+				_positionVao = 0;
+			}
+			for (int i = 0; i < _nMeshes; i++) {
+				for (int level = 0; level < _meshes[i].nLods; level++) {
+					delete[] _meshes[i].lodTriangles[level];
+				}
+			}
 			delete(_vertices);
 			delete(_meshes);
 			delete(_materials);
@@ -78,7 +357,7 @@ namespace sg {
 
 	private:
 		void ClearData() { delete(_vertices); delete(_meshes); delete(_materials); _nVertices = 0; ; _nMaterials = 0; _nMeshes = 0; _lowerBound = glm::vec3(5000000); _upperBound = glm::vec3(-5000000); }
-		bool ReadMaterial(char const* folder, char const* filename);
+		bool ReadMaterial(char const* folder, char const* filename, ObjParser& parser);
 		void SeparateFolderFromFilename(char** folder, char const** filename) {
 			int lastDiv = -1;
 			int i = 0;
@@ -104,341 +383,67 @@ namespace sg {
 			if (coord.y > _upperBound.y) _upperBound.y = coord.y;
 			if (coord.z > _upperBound.z) _upperBound.z = coord.z;
 		}
-		FILE* ReadFile(char const* folder, char const* filename) {
-			FILE* fp;
-			std::string folderStr = folder;
-			std::string fileStr = filename;
-			fopen_s(&fp, (folderStr + fileStr).c_str(), "r");
-			return fp;
-		}
-		void Concat(char** dest, const char* first, const char* second, bool addSlash = true) {
-			char full[50];
-			int i = 0;
-			char c;
-			while ((c = first[i]) != '\0') {
-				full[i] = c;
-				i++;
-			}
-			if (addSlash) {
-				full[i] = '/';
-				i++;
-			}
-			int j = 0;
-			while ((c = *(second + j)) != '\0') {
-				full[i + j] = c;
-				j++;
-			}
-			full[i + j] = '\0';
-			*dest = new char[i + j + 1];
-			strcpy_s(*dest, i+j+1, full);
-		}
 	};
 
-	class Buffer {
-		char data[1024];
-		int readLine;
-	public:
-		int ReadLine(FILE* fp) {
-			char c = fgetc(fp);
-			while (!feof(fp)) {
-				while (isspace(c) && (!feof(fp) || c != '\0')) c = fgetc(fp);	// skip empty space
-				if (c == '#') while (!feof(fp) && c != '\n' && c != '\r' && c != '\0') c = fgetc(fp);	// skip comment line
-				else break;
-			}
-			int i = 0;
-			bool inspace = false;
-			while (i < 1024 - 1) {
-				if (feof(fp) || c == '\n' || c == '\r' || c == '\0') break;
-				if (isspace(c)) {	// only use a single space as the space character
-					inspace = true;
-				}
-				else {
-					if (inspace) data[i++] = ' ';
-					inspace = false;
-					data[i++] = c;
-				}
-				c = fgetc(fp);
-			}
-			data[i] = '\0';
-			readLine = i;
-			return i;
-		}
-		char& operator[](int i) { return data[i]; }
-		void ReadFloat3(float f[3]) const { f[2] = f[1] = f[0] = 0; int n = sscanf_s(data + 2, "%f %f %f", &f[0], &f[1], &f[2]); if (n == 1) f[2] = f[1] = f[0]; }
-		void ReadFloat(float* f) const { sscanf_s(data + 2, "%f", f); }
-		void ReadInt(int* i, int start) const { sscanf_s(data + start, "%d", i); }
-		bool IsCommand(char const* cmd) const {
-			int i = 0;
-			while (cmd[i] != '\0') {
-				if (cmd[i] != data[i]) return false;
-				i++;
-			}
-			return (data[i] == '\0' || data[i] == ' ');
-		}
-		char const* Data(int start = 0) { return data + start; }
-		void Copy(const char* str, int start = 0) {
-			while (data[start] != '\0' && data[start] <= ' ') start++;
-			str = Data(start);
-		}
-		void DeepCopy(char** str, int start = 0) {
-			while (data[start] != '\0' && data[start] <= ' ') start++;
-			int i = 0;
-			while (data[start+i] != '\0') i++;
-			*str = new char[i + 1];
-			for (int j = 0; j < i+1; j++) {
-				(*str)[j] = data[start+j];
-			}
-		}
-	};
-
-	inline bool Model::LoadFromObj(char const* filename, bool invertYZ) {
+	inline bool Model::LoadFromObj(char const* filename, bool invertYZ, JobSystem* jobs) {
 		printf("Initializing parsing\n");
-		std::unordered_map<std::string, unsigned int> map = std::unordered_map<std::string, unsigned int>();
-		std::list<Vertex> vertexList = std::list<Vertex>();
-		unsigned int indexCounter = 0;
 		char* folder;
 
 		SeparateFolderFromFilename(&folder, &filename);
 
-		FILE* fp = ReadFile(folder, filename);
-		if (!fp) {
+		MappedFile file;
+		if (!file.Open((std::string(folder) + filename).c_str())) {
 			printf("ERROR: Cannot open file %s\n", filename);
+			_failed = true;
 			return false;
 		}
 
 		printf("File opened: %s\n", filename);
 
 		ClearData();
-		Buffer buffer;
-		std::vector<glm::vec3> vCoords;
-		std::vector<glm::vec2> vTextures;
-		std::vector<glm::vec3> vNormals;
-
-		std::list<Triangle> currentTriangles = std::list<Triangle>();
-		std::list<Mesh> meshList;
-		int meshCount = 0;
-		Mesh* currentMesh = NULL;
-
-		bool needToCreateMesh = true;
-		while (int rb = buffer.ReadLine(fp)) {
-			if (buffer.IsCommand("mtllib")) {
-				const char* mtlFilename = buffer.Data(7);
-				ReadMaterial(folder, mtlFilename);
-				needToCreateMesh = true;
-			} else if (buffer.IsCommand("g") || buffer.IsCommand("o") || (buffer.IsCommand("usemtl") && needToCreateMesh)) {
-				printf("Reading new object: ");
-				if (currentMesh != NULL) {
-					currentMesh -> triangles = new Triangle[currentTriangles.size()];
-					currentMesh -> nTriangles = currentTriangles.size();
-					int i = 0;
-					for (Triangle t : currentTriangles) {
-						currentMesh->triangles[i] = t;
-						i++;
-					}
-					currentTriangles.clear();
-					meshList.push_back(*currentMesh);
-				}
-				meshCount++;
-				currentMesh = new Mesh();
-				buffer.DeepCopy(&(currentMesh->name), 2);
-				printf("%s\n", currentMesh->name);
-				needToCreateMesh = false;
-				if (buffer.IsCommand("usemtl")) {
-					currentMesh->hasMaterial = true;
-					buffer.DeepCopy(&(currentMesh->materialName), 7);
-					needToCreateMesh = true;
-				}
-			} else if (buffer.IsCommand("usemtl")) {
-				currentMesh->hasMaterial = true;
-				buffer.DeepCopy(&(currentMesh->materialName), 7);
-				needToCreateMesh = true;
-			} else if (buffer.IsCommand("v")) {
-				float coord[3];
-				buffer.ReadFloat3(coord);
-				glm::vec3 coordV = glm::vec3(coord[0], coord[1], coord[2]);
-				vCoords.push_back(coordV);
-			} else if (buffer.IsCommand("vt")) {
-				float texture[3];
-				buffer.ReadFloat3(texture);
-				glm::vec2 textureV = glm::vec2(texture[0], texture[1]);
-				vTextures.push_back(textureV);
-			} else if (buffer.IsCommand("vn")) {
-				float normal[3];
-				buffer.ReadFloat3(normal);
-				glm::vec3 normalV = glm::vec3(normal[0], normal[1], normal[2]);
-				vNormals.push_back(normalV);
-			} else if (buffer.IsCommand("f")) {
-				const char *line = buffer.Data(2);
-				char* triples[4];
-				int tripleStart = 0;
-				int i = 0;
-				int vIndex = 0;
-				while (true) {
-					if (line[i] == ' ' || line[i] == '\0') {
-						triples[vIndex] = new char[i - tripleStart + 1];
-						for (int j = tripleStart; j < i; j++) {
-							triples[vIndex][j - tripleStart] = line[j];
-						}
-						triples[vIndex][i - tripleStart] = '\0';
-						tripleStart = i;
-						vIndex++;
-						if (line[i] == '\0') break;
-					}
-					i++;
-				}
-				unsigned int faceIndices[4];
-				for (i = 0; i < glm::min(vIndex, 4); i++) {
-					std::string str = triples[i];
-					if (map[str]) {
-						faceIndices[i] = map[str];
-					} else {
-						faceIndices[i] = indexCounter;
-						map[str] = indexCounter;
-						indexCounter++;
-
-						int infoIndices[3];
-						sscanf_s(triples[i], "%d/%d/%d", &infoIndices[0], &infoIndices[1], &infoIndices[2]);
-						infoIndices[0]--; infoIndices[1]--; infoIndices[2]--;
-
-						Vertex v = Vertex();
-						if (invertYZ) {
-							v.coord.x = { vCoords[infoIndices[0]].x };
-							v.coord.y = { vCoords[infoIndices[0]].z };
-							v.coord.z = { vCoords[infoIndices[0]].y };
-							v.texture.x = { vTextures[infoIndices[1]].x };
-							v.texture.y = { vTextures[infoIndices[1]].y };
-							v.normal.x = { vNormals[infoIndices[2]].x };
-							v.normal.y = { vNormals[infoIndices[2]].z };
-							v.normal.z = { vNormals[infoIndices[2]].y };
-						} else {
-							v.coord.x = { vCoords[infoIndices[0]].x };
-							v.coord.y = { vCoords[infoIndices[0]].y };
-							v.coord.z = { vCoords[infoIndices[0]].z };
-							v.texture.x = { vTextures[infoIndices[1]].x };
-							v.texture.y = { vTextures[infoIndices[1]].y };
-							v.normal.x = { vNormals[infoIndices[2]].x };
-							v.normal.y = { vNormals[infoIndices[2]].y };
-							v.normal.z = { vNormals[infoIndices[2]].z };
-						}
-						UpdateBoundingBox(v.coord);
-						vertexList.push_back(v);
-					}
-				}
-
-				if (vIndex == 3) {
-					Triangle t = Triangle();
-					t.index[0] = faceIndices[0]; t.index[1] = faceIndices[1]; t.index[2] = faceIndices[2];
-					currentTriangles.push_back(t);
-				} else if (vIndex == 4) {
-					Triangle t1 = Triangle();
-					Triangle t2 = Triangle();
-					t1.index[0] = faceIndices[0]; t1.index[1] = faceIndices[1]; t1.index[2] = faceIndices[2];
-					t2.index[0] = faceIndices[0]; t2.index[1] = faceIndices[2]; t2.index[2] = faceIndices[3];
-					currentTriangles.push_back(t1);
-					currentTriangles.push_back(t2);
-				}
-			}
+		ObjParser parser;
+		if (!parser.Parse(file.GetData(), file.GetSize(), invertYZ, jobs)) {
+			printf("ERROR: Cannot parse file %s\n", filename);
+			_failed = true;
+			return false;
 		}
-		if (currentMesh != NULL) {
-			currentMesh->triangles = new Triangle[currentTriangles.size()];
-			currentMesh->nTriangles = currentTriangles.size();
-			int i = 0;
-			for (Triangle t : currentTriangles) {
-				currentMesh->triangles[i] = t;
-				i++;
-			}
-			meshList.push_back(*currentMesh);
+		file.Close();
+		for (std::string& library : parser.materialLibraries) {
+			ReadMaterial(folder, library.c_str(), parser);
 		}
-		printf("File read\n");
-		_vertices = new Vertex[vertexList.size()];
-		_nVertices = vertexList.size();
-		int i = 0;
-		for (Vertex v : vertexList) {
-			_vertices[i] = v;
-			i++;
+		_nMaterials = parser.materials.size();
+		_materials = new Material[_nMaterials];
+		for (int i = 0; i < _nMaterials; i++) {
+			_materials[i] = parser.materials[i];
 		}
-		_meshes = new Mesh[meshList.size()];
-		_nMeshes = meshList.size();
-		i = 0;
-		for (Mesh m : meshList) {
-			_meshes[i] = m;
-			i++;
+		printf("Materials read: %d\n", _nMaterials);
+		printf("File read: %d objects\n", (int)parser.meshes.size());
+
+		_nVertices = parser.vertices.size();
+		_vertices = new Vertex[_nVertices];
+		for (int i = 0; i < _nVertices; i++) {
+			_vertices[i] = parser.vertices[i];
+			UpdateBoundingBox(_vertices[i].coord);
+		}
+		_nMeshes = parser.meshes.size();
+		_meshes = new Mesh[_nMeshes];
+		for (int i = 0; i < _nMeshes; i++) {
+			_meshes[i] = parser.meshes[i];
 		}
 		printf("Parsing completed: %d vertices\n", _nVertices);
+		GenerateLods();
+		Optimize();
+		_loaded = true;
 		return true;
 	}
 
-	inline bool Model::ReadMaterial(char const* folder, char const* filename) {
-		printf("Reading materials\n");
-		FILE* fp = ReadFile(folder, filename);
-		if (!fp) {
+	inline bool Model::ReadMaterial(char const* folder, char const* filename, ObjParser& parser) {
+		MappedFile file;
+		if (!file.Open((std::string(folder) + filename).c_str())) {
 			printf("ERROR: Cannot open file %s\n", filename);
 			return false;
 		}
-
-		Buffer buffer;
-		std::list<Material> matList;
-		int matCount = 0;
-		Material* currentMat = NULL;
-
-		std::string folderStr = folder;
-		while (int rb = buffer.ReadLine(fp)) {
-			if (buffer.IsCommand("newmtl")) {
-				if (currentMat != NULL) matList.push_back(*currentMat);
-				matCount++;
-				currentMat = new Material();
-				buffer.DeepCopy(&(currentMat->name), 7);
-			}
-			else if (buffer.IsCommand("Kd")) {
-				buffer.ReadFloat3(currentMat->Kd);
-			}
-			else if (buffer.IsCommand("Ks")) {
-				buffer.ReadFloat3(currentMat->Ks);
-			}
-			else if (buffer.IsCommand("Ke")) {
-				buffer.ReadFloat3(currentMat->Ke);
-			}
-			else if (buffer.IsCommand("Tf")) {
-				buffer.ReadFloat3(currentMat->Tf);
-			}
-			else if (buffer.IsCommand("Ns")) {
-				buffer.ReadFloat(&(currentMat->Ns));
-			}
-			else if (buffer.IsCommand("Ni")) {
-				buffer.ReadFloat(&(currentMat->Ni));
-			}
-			else if (buffer.IsCommand("illum")) {
-				buffer.ReadInt(&(currentMat->illum), 5);
-			}
-			else if (buffer.IsCommand("d")) {
-				buffer.ReadFloat(&(currentMat->d));
-			}
-			else if (buffer.IsCommand("Tr")) {
-				buffer.ReadFloat(&(currentMat->Tr));
-			}
-			else if (buffer.IsCommand("map_Kd")) {
-				Texture t_kd = Texture();
-				Concat(&(t_kd.map), folder, buffer.Data(7), false);
-				t_kd.isPresent = true;
-				currentMat->texture_Kd = t_kd;
-			}
-			else if (buffer.IsCommand("map_Ks")) {
-				Texture t_ks = Texture();
-				Concat(&(t_ks.map), folder, buffer.Data(7));
-				t_ks.isPresent = true;
-				currentMat->texture_Ks = t_ks;
-			}
-		}
-		if (currentMat != NULL) matList.push_back(*currentMat);
-
-		_nMaterials = matCount;
-		_materials = new Material[_nMaterials];
-		int i = 0;
-		for (Material m : matList) {
-			_materials[i] = m;
-			i++;
-		}
-		printf("Materials read: %d\n", _nMaterials);
+		parser.ParseMaterials(file.GetData(), file.GetSize(), folder);
 		return true;
 	}
 
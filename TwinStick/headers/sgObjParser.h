@@ -0,0 +1,518 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <cstring>
+#include <climits>
+#include <cmath>
+#include <algorithm>
+#include <functional>
+#include <unordered_map>
+#include <glm/glm/glm.hpp>
+#include <sgStructures.h>
+#include <sgJobSystem.h>
+
+// The file is cut at line ends into chunks of about this many bytes, which are parsed in parallel
+#define OBJ_CHUNK_SIZE (1 << 20)
+// Index of a texture or normal a face corner leaves out
+#define OBJ_NO_INDEX INT_MIN
+
+namespace sg {
+	// Zero-based position, texture and normal indices of a face corner
+	struct ObjCorner {
+		int v, t, n;
+
+		bool operator==(const ObjCorner& other) const {
+			return v == other.v && t == other.t && n == other.n;
+		}
+	};
+
+	struct ObjCornerHash {
+		size_t operator()(const ObjCorner& corner) const {
+			unsigned long long h = (unsigned int)corner.v;
+			h = h * 0x9E3779B97F4A7C15ull + (unsigned int)corner.t;
+			h = h * 0x9E3779B97F4A7C15ull + (unsigned int)corner.n;
+			return (size_t)(h ^ (h >> 29));
+		}
+	};
+
+	enum ObjStatementType {
+		ObjGroup,
+		ObjUseMaterial,
+		ObjMaterialLibrary
+	};
+
+	// A statement that changes how the faces after it are grouped, and how many faces of its chunk come before it
+	struct ObjStatement {
+		ObjStatementType type;
+		int face;
+		std::string argument;
+	};
+
+	// What one chunk of the file holds. Negative indices count back from the attributes read so far,
+	// which the chunk only knows locally: they are resolved against its own counts and listed in
+	// relative, as corner * 3 + component, to be moved by the counts of the chunks before it.
+	struct ObjChunk {
+		const char* begin;
+		const char* end;
+		std::vector<glm::vec3> coords;
+		std::vector<glm::vec2> textures;
+		std::vector<glm::vec3> normals;
+		std::vector<ObjCorner> corners;
+		std::vector<int> faceStarts;
+		std::vector<int> relative;
+		std::vector<ObjStatement> statements;
+		bool valid;
+	};
+
+	// Wavefront OBJ parser. Chunks are parsed on the job threads, then their attributes are
+	// concatenated and the corners welded into vertices in file order, so the result does not depend
+	// on the thread count. Faces may leave out texture and normal indices: missing texture
+	// coordinates are zero and missing normals are smoothed from the faces around the vertex.
+	class ObjParser {
+	private:
+		std::vector<ObjChunk> _chunks;
+		std::vector<glm::vec3> _coords;
+		std::vector<glm::vec2> _textures;
+		std::vector<glm::vec3> _normals;
+
+		static bool IsBlank(char c) {
+			return c == ' ' || c == '\t' || c == '\r';
+		}
+
+		static bool IsDigit(char c) {
+			return c >= '0' && c <= '9';
+		}
+
+		static const char* SkipBlanks(const char* p, const char* end) {
+			while (p < end && IsBlank(*p)) p++;
+			return p;
+		}
+
+		static bool IsCommand(const char* p, const char* end, const char* command) {
+			int length = (int)strlen(command);
+			if (end - p <= length || memcmp(p, command, length) != 0) return false;
+			return IsBlank(p[length]);
+		}
+
+		// The rest of the line, without the blanks around it
+		static std::string Argument(const char* p, const char* end) {
+			p = SkipBlanks(p, end);
+			while (end > p && IsBlank(end[-1])) end--;
+			return std::string(p, end);
+		}
+
+		// Up to 19 significant digits scaled by an exact power of ten, which rounds correctly for the
+		// numbers exporters write; more digits or larger exponents lose a little precision
+		static const char* ParseFloat(const char* p, const char* end, float& value) {
+			static const double powers[] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+				1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22 };
+			p = SkipBlanks(p, end);
+			bool negative = false;
+			if (p < end && (*p == '-' || *p == '+')) negative = *p++ == '-';
+			unsigned long long mantissa = 0;
+			int digits = 0;
+			int exponent = 0;
+			while (p < end && IsDigit(*p)) {
+				if (digits < 19) mantissa = mantissa * 10 + (*p - '0');
+				else exponent++;
+				if (mantissa != 0) digits++;
+				p++;
+			}
+			if (p < end && *p == '.') {
+				p++;
+				while (p < end && IsDigit(*p)) {
+					if (digits < 19) {
+						mantissa = mantissa * 10 + (*p - '0');
+						exponent--;
+						if (mantissa != 0) digits++;
+					}
+					p++;
+				}
+			}
+			if (p < end && (*p == 'e' || *p == 'E')) {
+				p++;
+				bool negativeExponent = false;
+				if (p < end && (*p == '-' || *p == '+')) negativeExponent = *p++ == '-';
+				int e = 0;
+				while (p < end && IsDigit(*p)) {
+					if (e < 10000) e = e * 10 + (*p - '0');
+					p++;
+				}
+				exponent += negativeExponent ? -e : e;
+			}
+			double result = (double)mantissa;
+			if (exponent < 0) result = exponent >= -22 ? result / powers[-exponent] : result * pow(10.0, exponent);
+			else if (exponent > 0) result = exponent <= 22 ? result * powers[exponent] : result * pow(10.0, exponent);
+			value = (float)(negative ? -result : result);
+			return p;
+		}
+
+		// Reads up to n floats, leaving the ones the line does not have at zero, and returns how many it read
+		static int ParseFloats(const char* p, const char* end, float* values, int n) {
+			int read = 0;
+			for (int i = 0; i < n; i++) {
+				values[i] = 0;
+				p = SkipBlanks(p, end);
+				if (p >= end) continue;
+				p = ParseFloat(p, end, values[i]);
+				read++;
+			}
+			return read;
+		}
+
+		// An MTL color, where a single value stands for all three channels
+		static void ParseColor(const char* p, const char* end, float* color) {
+			if (ParseFloats(p, end, color, 3) == 1) color[2] = color[1] = color[0];
+		}
+
+		static const char* ParseInt(const char* p, const char* end, int& value) {
+			bool negative = false;
+			if (p < end && (*p == '-' || *p == '+')) negative = *p++ == '-';
+			long long result = 0;
+			while (p < end && IsDigit(*p)) {
+				if (result <= INT_MAX) result = result * 10 + (*p - '0');
+				p++;
+			}
+			if (result > INT_MAX) result = INT_MAX;
+			value = (int)(negative ? -result : result);
+			return p;
+		}
+
+		// One-based indices become zero-based; negative ones are resolved against the chunk's counts
+		// and remembered, and 0, which no valid file has, is kept as an error for Resolve
+		static void AddIndex(ObjChunk& chunk, int& slot, int index, int count, int component) {
+			if (index > 0) {
+				slot = index - 1;
+			} else if (index < 0) {
+				slot = count + index;
+				chunk.relative.push_back((int)chunk.corners.size() * 3 + component);
+			} else {
+				slot = -1;
+			}
+		}
+
+		static void ParseFace(ObjChunk& chunk, const char* p, const char* end) {
+			int first = (int)chunk.corners.size();
+			while (true) {
+				p = SkipBlanks(p, end);
+				if (p >= end) break;
+				ObjCorner corner = { OBJ_NO_INDEX, OBJ_NO_INDEX, OBJ_NO_INDEX };
+				int index = 0;
+				p = ParseInt(p, end, index);
+				AddIndex(chunk, corner.v, index, (int)chunk.coords.size(), 0);
+				if (p < end && *p == '/') {
+					p++;
+					if (p < end && *p != '/' && !IsBlank(*p)) {
+						p = ParseInt(p, end, index);
+						AddIndex(chunk, corner.t, index, (int)chunk.textures.size(), 1);
+					}
+					if (p < end && *p == '/') {
+						p++;
+						p = ParseInt(p, end, index);
+						AddIndex(chunk, corner.n, index, (int)chunk.normals.size(), 2);
+					}
+				}
+				while (p < end && !IsBlank(*p)) p++;	// anything else in the corner is ignored
+				chunk.corners.push_back(corner);
+			}
+			if (chunk.corners.size() - first < 3) {
+				chunk.corners.resize(first);
+				while (!chunk.relative.empty() && chunk.relative.back() >= first * 3) chunk.relative.pop_back();
+				return;
+			}
+			chunk.faceStarts.push_back(first);
+		}
+
+		static void ParseChunk(ObjChunk& chunk) {
+			const char* p = chunk.begin;
+			while (p < chunk.end) {
+				const char* lineEnd = (const char*)memchr(p, '\n', chunk.end - p);
+				if (lineEnd == NULL) lineEnd = chunk.end;
+				p = SkipBlanks(p, lineEnd);
+				if (lineEnd - p >= 2) {
+					if (p[0] == 'v' && IsBlank(p[1])) {
+						glm::vec3 coord;
+						ParseFloats(p + 2, lineEnd, &coord.x, 3);
+						chunk.coords.push_back(coord);
+					} else if (p[0] == 'v' && p[1] == 't' && IsCommand(p, lineEnd, "vt")) {
+						float texture[3];
+						ParseFloats(p + 3, lineEnd, texture, 3);
+						chunk.textures.push_back(glm::vec2(texture[0], texture[1]));
+					} else if (p[0] == 'v' && p[1] == 'n' && IsCommand(p, lineEnd, "vn")) {
+						glm::vec3 normal;
+						ParseFloats(p + 3, lineEnd, &normal.x, 3);
+						chunk.normals.push_back(normal);
+					} else if (p[0] == 'f' && IsBlank(p[1])) {
+						ParseFace(chunk, p + 2, lineEnd);
+					} else if ((p[0] == 'g' || p[0] == 'o') && IsBlank(p[1])) {
+						chunk.statements.push_back(ObjStatement{ ObjGroup, (int)chunk.faceStarts.size(), Argument(p + 2, lineEnd) });
+					} else if (IsCommand(p, lineEnd, "usemtl")) {
+						chunk.statements.push_back(ObjStatement{ ObjUseMaterial, (int)chunk.faceStarts.size(), Argument(p + 7, lineEnd) });
+					} else if (IsCommand(p, lineEnd, "mtllib")) {
+						chunk.statements.push_back(ObjStatement{ ObjMaterialLibrary, (int)chunk.faceStarts.size(), Argument(p + 7, lineEnd) });
+					}
+				}
+				p = lineEnd + 1;
+			}
+			chunk.faceStarts.push_back((int)chunk.corners.size());
+		}
+
+		static bool InRange(int index, int count, bool optional) {
+			if (index == OBJ_NO_INDEX) return optional;
+			return index >= 0 && index < count;
+		}
+
+		// Moves the chunk's relative indices by the attributes of the chunks before it, checks every
+		// index and copies its attributes to their place in the file-wide arrays
+		void Resolve(ObjChunk& chunk, int coordOffset, int textureOffset, int normalOffset) {
+			int offsets[3] = { coordOffset, textureOffset, normalOffset };
+			int* indices = (int*)chunk.corners.data();
+			for (int slot : chunk.relative) {
+				indices[slot] += offsets[slot % 3];
+			}
+			chunk.valid = true;
+			for (ObjCorner& corner : chunk.corners) {
+				if (!InRange(corner.v, (int)_coords.size(), false) || !InRange(corner.t, (int)_textures.size(), true) ||
+					!InRange(corner.n, (int)_normals.size(), true)) {
+					chunk.valid = false;
+					break;
+				}
+			}
+			std::copy(chunk.coords.begin(), chunk.coords.end(), _coords.begin() + coordOffset);
+			std::copy(chunk.textures.begin(), chunk.textures.end(), _textures.begin() + textureOffset);
+			std::copy(chunk.normals.begin(), chunk.normals.end(), _normals.begin() + normalOffset);
+		}
+
+		static char* CopyString(const std::string& str) {
+			char* copy = new char[str.size() + 1];
+			memcpy(copy, str.c_str(), str.size() + 1);
+			return copy;
+		}
+
+		static void ParseMaterialStatement(Material& material, const char* p, const char* end, const std::string& folder) {
+			if (IsCommand(p, end, "Kd")) {
+				ParseColor(p + 2, end, material.Kd);
+			} else if (IsCommand(p, end, "Ks")) {
+				ParseColor(p + 2, end, material.Ks);
+			} else if (IsCommand(p, end, "Ke")) {
+				ParseColor(p + 2, end, material.Ke);
+			} else if (IsCommand(p, end, "Tf")) {
+				ParseColor(p + 2, end, material.Tf);
+			} else if (IsCommand(p, end, "Ns")) {
+				ParseFloat(p + 2, end, material.Ns);
+			} else if (IsCommand(p, end, "Ni")) {
+				ParseFloat(p + 2, end, material.Ni);
+			} else if (IsCommand(p, end, "illum")) {
+				ParseInt(SkipBlanks(p + 5, end), end, material.illum);
+			} else if (IsCommand(p, end, "d")) {
+				ParseFloat(p + 1, end, material.d);
+			} else if (IsCommand(p, end, "Tr")) {
+				ParseFloat(p + 2, end, material.Tr);
+			} else if (IsCommand(p, end, "map_Kd")) {
+				material.texture_Kd.map = CopyString(folder + Argument(p + 6, end));
+				material.texture_Kd.isPresent = true;
+			} else if (IsCommand(p, end, "map_Ks")) {
+				material.texture_Ks.map = CopyString(folder + Argument(p + 6, end));
+				material.texture_Ks.isPresent = true;
+			}
+		}
+
+		void FinishMesh(Mesh& mesh, std::vector<Triangle>& triangles) {
+			mesh.nTriangles = (int)triangles.size();
+			mesh.triangles = new Triangle[triangles.size()];
+			if (!triangles.empty()) memcpy(mesh.triangles, triangles.data(), sizeof(Triangle) * triangles.size());
+			triangles.clear();
+			meshes.push_back(mesh);
+		}
+
+		// Area-weighted face normals summed over the vertices that have none of their own
+		void SmoothMissingNormals(std::vector<bool>& missing, bool invertYZ) {
+			for (Mesh& mesh : meshes) {
+				for (int i = 0; i < mesh.nTriangles; i++) {
+					unsigned int* index = mesh.triangles[i].index;
+					if (!missing[index[0]] && !missing[index[1]] && !missing[index[2]]) continue;
+					glm::vec3 a = vertices[index[0]].coord;
+					glm::vec3 normal = glm::cross(vertices[index[1]].coord - a, vertices[index[2]].coord - a);
+					if (invertYZ) normal = -normal;	// swapping two axes mirrors the winding
+					for (int j = 0; j < 3; j++) {
+						if (missing[index[j]]) vertices[index[j]].normal += normal;
+					}
+				}
+			}
+			for (int i = 0; i < vertices.size(); i++) {
+				if (missing[i] && glm::dot(vertices[i].normal, vertices[i].normal) > 0) vertices[i].normal = glm::normalize(vertices[i].normal);
+			}
+		}
+
+	public:
+		std::vector<Vertex> vertices;
+		std::vector<Mesh> meshes;
+		std::vector<std::string> materialLibraries;
+		std::vector<Material> materials;
+
+		// Parses size bytes of OBJ text. Without a job system, or with a single thread, the chunks
+		// are parsed one after the other. Returns false when a face refers to a missing attribute.
+		bool Parse(const char* data, size_t size, bool invertYZ, JobSystem* jobs) {
+			int nChunks = (int)std::max(size / OBJ_CHUNK_SIZE, (size_t)1);
+			_chunks.assign(nChunks, ObjChunk());
+			const char* end = data + size;
+			const char* begin = data;
+			for (int i = 0; i < nChunks; i++) {
+				const char* cut = i == nChunks - 1 ? end : data + size / nChunks * (i + 1);
+				if (cut < begin) cut = begin;
+				const char* lineEnd = cut < end ? (const char*)memchr(cut, '\n', end - cut) : NULL;
+				cut = lineEnd == NULL ? end : lineEnd + 1;
+				_chunks[i].begin = begin;
+				_chunks[i].end = cut;
+				begin = cut;
+			}
+
+			auto forEachChunk = [this, jobs](const std::function<void(ObjChunk&, int)>& body) {
+				auto batch = [this, &body](int first, int last) {
+					for (int i = first; i < last; i++) body(_chunks[i], i);
+				};
+				if (jobs != NULL) jobs->ParallelFor((int)_chunks.size(), 1, batch);
+				else batch(0, (int)_chunks.size());
+			};
+			forEachChunk([](ObjChunk& chunk, int i) { ParseChunk(chunk); });
+
+			std::vector<int> coordOffsets(nChunks), textureOffsets(nChunks), normalOffsets(nChunks);
+			size_t nCoords = 0, nTextures = 0, nNormals = 0, nCorners = 0;
+			for (int i = 0; i < nChunks; i++) {
+				coordOffsets[i] = (int)nCoords;
+				textureOffsets[i] = (int)nTextures;
+				normalOffsets[i] = (int)nNormals;
+				nCoords += _chunks[i].coords.size();
+				nTextures += _chunks[i].textures.size();
+				nNormals += _chunks[i].normals.size();
+				nCorners += _chunks[i].corners.size();
+			}
+			_coords.resize(nCoords);
+			_textures.resize(nTextures);
+			_normals.resize(nNormals);
+			forEachChunk([this, &coordOffsets, &textureOffsets, &normalOffsets](ObjChunk& chunk, int i) {
+				Resolve(chunk, coordOffsets[i], textureOffsets[i], normalOffsets[i]);
+			});
+			for (ObjChunk& chunk : _chunks) {
+				if (!chunk.valid) {
+					printf("ERROR: a face refers to a vertex attribute that is not in the file\n");
+					return false;
+				}
+			}
+
+			// Welding and grouping, in file order. A group or object starts a mesh, and so does a
+			// material change after the current mesh already picked one; faces before the first
+			// mesh go into it.
+			std::unordered_map<ObjCorner, unsigned int, ObjCornerHash> welded;
+			welded.reserve(nCorners / 2);
+			std::vector<bool> missingNormals;
+			bool anyMissing = false;
+			std::vector<Triangle> triangles;
+			std::vector<unsigned int> faceIndices;
+			Mesh mesh;
+			bool hasMesh = false;
+			bool needToCreateMesh = true;
+			vertices.clear();
+			meshes.clear();
+			materialLibraries.clear();
+
+			for (ObjChunk& chunk : _chunks) {
+				int statement = 0;
+				int nFaces = (int)chunk.faceStarts.size() - 1;
+				for (int face = 0; face <= nFaces; face++) {
+					for (; statement < chunk.statements.size() && chunk.statements[statement].face == face; statement++) {
+						ObjStatement& s = chunk.statements[statement];
+						if (s.type == ObjMaterialLibrary) {
+							materialLibraries.push_back(s.argument);
+							needToCreateMesh = true;
+						} else if (s.type == ObjGroup || needToCreateMesh) {
+							if (hasMesh) FinishMesh(mesh, triangles);
+							mesh = Mesh();
+							mesh.name = CopyString(s.argument);
+							hasMesh = true;
+							needToCreateMesh = false;
+							if (s.type == ObjUseMaterial) {
+								mesh.hasMaterial = true;
+								mesh.materialName = CopyString(s.argument);
+								needToCreateMesh = true;
+							}
+						} else {
+							mesh.hasMaterial = true;
+							mesh.materialName = CopyString(s.argument);
+							needToCreateMesh = true;
+						}
+					}
+					if (face == nFaces) break;
+
+					faceIndices.clear();
+					for (int c = chunk.faceStarts[face]; c < chunk.faceStarts[face + 1]; c++) {
+						ObjCorner corner = chunk.corners[c];
+						auto found = welded.find(corner);
+						if (found != welded.end()) {
+							faceIndices.push_back(found->second);
+							continue;
+						}
+						unsigned int index = (unsigned int)vertices.size();
+						welded.emplace(corner, index);
+						faceIndices.push_back(index);
+
+						Vertex v = Vertex();
+						v.coord = _coords[corner.v];
+						if (corner.t != OBJ_NO_INDEX) v.texture = _textures[corner.t];
+						if (corner.n != OBJ_NO_INDEX) v.normal = _normals[corner.n];
+						if (invertYZ) {
+							std::swap(v.coord.y, v.coord.z);
+							std::swap(v.normal.y, v.normal.z);
+						}
+						vertices.push_back(v);
+						missingNormals.push_back(corner.n == OBJ_NO_INDEX);
+						anyMissing |= corner.n == OBJ_NO_INDEX;
+					}
+					// Polygons are split into a fan around their first corner
+					for (int c = 1; c + 1 < faceIndices.size(); c++) {
+						Triangle t = Triangle();
+						t.index[0] = faceIndices[0];
+						t.index[1] = faceIndices[c];
+						t.index[2] = faceIndices[c + 1];
+						triangles.push_back(t);
+					}
+				}
+			}
+			if (!hasMesh && !triangles.empty()) {
+				mesh = Mesh();
+				mesh.name = CopyString("default");
+				hasMesh = true;
+			}
+			if (hasMesh) FinishMesh(mesh, triangles);
+			if (anyMissing) SmoothMissingNormals(missingNormals, invertYZ);
+
+			_chunks.clear();
+			_coords.clear();
+			_textures.clear();
+			_normals.clear();
+			return true;
+		}
+
+		// Parses size bytes of an MTL library and appends its materials to the ones read so far.
+		// Texture paths are made relative to folder; statements before the first newmtl are ignored.
+		void ParseMaterials(const char* data, size_t size, const std::string& folder) {
+			const char* end = data + size;
+			const char* p = data;
+			Material* material = NULL;
+			while (p < end) {
+				const char* lineEnd = (const char*)memchr(p, '\n', end - p);
+				if (lineEnd == NULL) lineEnd = end;
+				p = SkipBlanks(p, lineEnd);
+				if (IsCommand(p, lineEnd, "newmtl")) {
+					materials.push_back(Material());
+					material = &materials.back();
+					material->name = CopyString(Argument(p + 6, lineEnd));
+				} else if (material != NULL) {
+					ParseMaterialStatement(*material, p, lineEnd, folder);
+				}
+				p = lineEnd + 1;
+			}
+		}
+	};
+}
\ No newline at end of file
@@ -13,36 +13,25 @@ namespace sg {
 		glm::mat4 _modelMatrix;
 		bool _copiedModel;
 
-		bool FrustumCheck(sg::Frustum frustum) {
+		// World box enclosing the model's box under the model matrix: the rotated and scaled
+		// half-extents projected back onto the world axes
+		void WorldBounds(glm::vec3& globalCenter, glm::vec3& globalExtents) {
 			glm::vec3 center = _model3D->GetBoundingBoxCenter();
 			glm::vec3 extents = _model3D->GetBoundingBoxUpper() - center;
+			globalCenter = glm::vec3(_modelMatrix * glm::vec4(center, 1.f));
 
-			//Get global scale thanks to our transform
-			const glm::vec3 globalCenter{ _modelMatrix * glm::vec4(center, 1.f) };
-
-			// Scaled orientation
-			const glm::vec3 right = LocalRight() * extents.x;
-			const glm::vec3 up = LocalUp() * extents.y;
-			const glm::vec3 forward = LocalForward() * extents.z;
-
-			const float newIi = std::abs(right.x) + std::abs(up.x) + std::abs(forward.x);
-			const float newIj = std::abs(right.y) + std::abs(up.y) + std::abs(forward.y);
-			const float newIk = std::abs(right.z) + std::abs(up.z) + std::abs(forward.z);
-
-			glm::vec3 globalExtents = {newIi, newIj, newIk};
-			return (isOnOrForwardPlane(frustum.leftFace, globalCenter, globalExtents) &&
-				isOnOrForwardPlane(frustum.rightFace, globalCenter, globalExtents) &&
-				isOnOrForwardPlane(frustum.topFace, globalCenter, globalExtents) &&
-				isOnOrForwardPlane(frustum.bottomFace, globalCenter, globalExtents) &&
-				isOnOrForwardPlane(frustum.nearFace, globalCenter, globalExtents) &&
-				isOnOrForwardPlane(frustum.farFace, globalCenter, globalExtents));
+			glm::mat3 orientation = glm::mat3(_modelMatrix);
+			for (int i = 0; i < 3; i++) {
+				orientation[i] = glm::abs(orientation[i]);
+			}
+			globalExtents = orientation * extents;
 		}
 
-		bool isOnOrForwardPlane(const Plane& plane, glm::vec3 center, glm::vec3 extents) const
-		{
-			// Compute the projection interval radius of b onto L(t) = b.c + t * p.n
-			const float r = glm::dot(extents, glm::abs(plane.normal));
-			return -r <= glm::dot(plane.normal, center) - plane.distance;
+		static bool SameMaterial(const Material& a, const Material& b) {
+			return memcmp(a.Kd, b.Kd, sizeof(a.Kd)) == 0 && memcmp(a.Ks, b.Ks, sizeof(a.Ks)) == 0
+				&& a.Ns == b.Ns && a.d == b.d
+				&& a.texture_Kd.isPresent == b.texture_Kd.isPresent && a.texture_Kd.map == b.texture_Kd.map
+				&& a.texture_Ks.isPresent == b.texture_Ks.isPresent && a.texture_Ks.map == b.texture_Ks.map;
 		}
 
 		void CopyMaterialsFromModel() {
@@ -68,6 +57,7 @@ namespace sg {
 		bool ReceivesShadows;
 		bool Lit;
 		bool PerformFrustumCheck;
+		bool Static;	// never moves once placed, so its shadows can be cached
 
 		Object3D() : Entity3D() {
 			_modelMatrix = glm::mat4(1);
@@ -78,6 +68,7 @@ namespace sg {
 			ReceivesShadows = false;
 			Lit = false;
 			PerformFrustumCheck = true;
+			Static = false;
 		}
 
 		glm::mat4 GetModelMatrix() {
@@ -94,6 +85,12 @@ namespace sg {
 			return false;
 		}
 
+		// The materials are copied by RefreshMaterials once the model has loaded
+		std::shared_future<bool> LoadModelFromObjAsync(const char* path, JobSystem* jobs) {
+			_model3D = new Model();
+			return _model3D->LoadFromObjAsync(path, jobs);
+		}
+
 		void LoadModelFromData(sg::Vertex vertices[], int nVertices, sg::Triangle triangles[], int nTriangles) {
 			_model3D = new Model();
 			_model3D->InitFromVerticesAndTriangles(vertices, nVertices, triangles, nTriangles);
@@ -108,10 +105,15 @@ namespace sg {
 
 		void SetModel(sg::Model* model) {
 			_model3D = model;
-			CopyMaterialsFromModel();
+			if (model->IsLoaded()) CopyMaterialsFromModel();
 			_copiedModel = true;
 		}
 
+		// Takes the materials of a model that was still loading when it was set
+		void RefreshMaterials() {
+			if (_materials == NULL && _model3D->IsLoaded()) CopyMaterialsFromModel();
+		}
+
 		Material GetMaterialAt(unsigned int index) { return _materials[index]; }
 
 		Material* GetMaterialReferenceAt(unsigned int index) { return &_materials[index]; }
@@ -152,26 +154,42 @@ namespace sg {
 			return _model3D;
 		}
 
-		void Draw(GLuint program, glm::mat4 vp, sg::Frustum frustum) {
-			BuildModelMatrix();
-			glm::mat4 mvp = vp * _modelMatrix;
-			if (!PerformFrustumCheck || FrustumCheck(frustum)) {
-				glUseProgram(program);
-				glUniformMatrix4fv(glGetUniformLocation(program, "mvp"), 1, false, glm::value_ptr(mvp));
-
-				glBindBuffer(GL_ARRAY_BUFFER, _model3D->GetVBO());
-				glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(sg::Vertex), (GLvoid*)0);
-				glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, sizeof(sg::Vertex), (GLvoid*)(sizeof(float) * 3));
-				glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, sizeof(sg::Vertex), (GLvoid*)(sizeof(float) * 5));
-				for (int i = 0; i < _model3D->GetNMeshes(); i++) {
-					sg::Mesh m = _model3D->GetMeshAt(i);
-					sg::TextureManager::Instance()->SetMaterialData(program, GetMaterialByName(m.materialName));
-					if (_patches > 0) {
-						glDrawArrays(GL_PATCHES, 0, _patches);
-					} else {
-						glDrawElements(GL_TRIANGLES, m.nTriangles * 3, GL_UNSIGNED_INT, m.triangles);
-					}
-				}
+		// World axis-aligned box, also from the model matrix built by the last call to GetModelMatrix
+		void GetWorldBounds(glm::vec3& min, glm::vec3& max) {
+			glm::vec3 center;
+			glm::vec3 extents;
+			WorldBounds(center, extents);
+			min = center - extents;
+			max = center + extents;
+		}
+
+		bool CanShareBatchWith(Object3D* other, bool compareMaterials) {
+			if (other->_model3D != _model3D || other->_patches != _patches) return false;
+			if (!compareMaterials) return true;
+			for (int i = 0; i < _nMaterials; i++) {
+				if (!SameMaterial(_materials[i], other->_materials[i])) return false;
+			}
+			return true;
+		}
+
+		// Draws one mesh instanceCount times with this object's material for it. The caller binds
+		// the model's vertex array and points the instance attributes at the batch.
+		void DrawMeshInstanced(ShaderProgram* program, int meshIndex, int instanceCount, int lod = 0) {
+			program->Use();
+			sg::Mesh m = _model3D->GetMeshAt(meshIndex);
+			if (program->uniforms.material.Kd >= 0 || program->uniforms.material.dTextureSet >= 0) {
+				sg::TextureManager::Instance()->SetMaterialData(program, GetMaterialByName(m.materialName));
+			}
+			if (_patches > 0) {
+				glDrawArraysInstanced(GL_PATCHES, 0, _patches, instanceCount);
+			} else {
+				glDrawElementsInstanced(GL_TRIANGLES, m.GetNTriangles(lod) * 3, _model3D->GetIndexType(), (GLvoid*)m.GetIndexOffset(lod), instanceCount);
+			}
+		}
+
+		void DrawInstanced(ShaderProgram* program, int instanceCount, int lod = 0) {
+			for (int i = 0; i < _model3D->GetNMeshes(); i++) {
+				DrawMeshInstanced(program, i, instanceCount, lod);
 			}
 		}
 
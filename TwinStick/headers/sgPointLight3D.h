@@ -20,6 +20,7 @@ namespace sg {
 		float _range;
 		Frustum _frustums[6];
 		FrameBufferCube *_depthCubeBuffer;
+		FrameBufferCube *_staticDepthCubeBuffer;
 
 		void UpdateProjectionMatrix() {
 			_projectionMatrix = glm::perspective(FOV, 1.0f, _nearPlane, _farPlane);
@@ -69,6 +70,7 @@ namespace sg {
 			_range = farPlane;
 			_lightType = TypePointLight;
 			_depthCubeBuffer = new sg::FrameBufferCube(resolution, false, true, false);
+			_staticDepthCubeBuffer = new sg::FrameBufferCube(resolution, false, true, false);
 			UpdateProjectionMatrix();
 			UpdateViewMatrices();
 		}
@@ -81,6 +83,10 @@ namespace sg {
 			return *_depthCubeBuffer;
 		}
 
+		sg::FrameBufferCube GetStaticShadowBuffer() const {
+			return *_staticDepthCubeBuffer;
+		}
+
 		sg::Frustum GetFrustum(int index) {
 			return _frustums[index];
 		}
@@ -123,6 +129,8 @@ namespace sg {
 		~PointLight3D() {
 			_depthCubeBuffer->FreeTextures();
 			delete(_depthCubeBuffer);
+			_staticDepthCubeBuffer->FreeTextures();
+			delete(_staticDepthCubeBuffer);
 		}
 	};
 }
\ No newline at end of file
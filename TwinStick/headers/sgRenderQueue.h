@@ -0,0 +1,133 @@
+#pragma once
+
+#include <vector>
+#include <map>
+#include <string>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <sgObject3D.h>
+#include <sgInstanceBuffer.h>
+
+namespace sg {
+	// Sort key layout, most significant bits first:
+	// 63-60 coarse depth bucket, 59-52 program, 51-32 texture set, 31-0 fine depth
+	#define QUEUE_BUCKET_SHIFT 60
+	#define QUEUE_PROGRAM_SHIFT 52
+	#define QUEUE_TEXTURES_SHIFT 32
+	#define QUEUE_DEPTH_BUCKETS 16
+
+	struct DrawItem {
+		uint64_t key;
+		int batch;
+		int mesh;
+		int program;
+		int textures;
+	};
+
+	struct RenderQueueStats {
+		int items;
+		int programSwitches;
+		int textureSwitches;
+		int programSwitchesAvoided;
+		int textureSwitchesAvoided;
+	};
+
+	// Collects the draws of the main pass and orders them front to back by depth bucket,
+	// grouping program and texture changes inside each bucket
+	class RenderQueue {
+	private:
+		std::vector<DrawItem> _items;
+		std::vector<ShaderProgram*> _programs;
+		std::map<std::pair<std::string, std::string>, int> _textureSets;
+		RenderQueueStats _stats = RenderQueueStats();
+
+		int ProgramIndex(ShaderProgram* program) {
+			for (int i = 0; i < _programs.size(); i++) {
+				if (_programs[i] == program) return i;
+			}
+			_programs.push_back(program);
+			return (int)_programs.size() - 1;
+		}
+
+		// Materials that sample the same files bind the same textures, so they share an id. The
+		// paths are compared by content: every material holds its own copy of them, and the GL
+		// textures may not be loaded yet when the first frame is queued.
+		int TextureSetIndex(Material* mat) {
+			if (mat == NULL) return 0;
+			std::pair<std::string, std::string> maps(
+				mat->texture_Kd.isPresent ? mat->texture_Kd.map : "",
+				mat->texture_Ks.isPresent ? mat->texture_Ks.map : "");
+			auto it = _textureSets.find(maps);
+			if (it != _textureSets.end()) return it->second;
+			int index = (int)_textureSets.size() + 1;
+			_textureSets[maps] = index;
+			return index;
+		}
+
+		// Buckets grow by powers of two, so near objects are ordered more finely than far ones
+		static uint64_t DepthBucket(float depth) {
+			if (depth <= 1) return 0;
+			return (uint64_t)glm::min((int)glm::log2(depth), QUEUE_DEPTH_BUCKETS - 1);
+		}
+
+		static uint32_t DepthBits(float depth) {
+			depth = glm::max(depth, 0.0f);
+			uint32_t bits;
+			memcpy(&bits, &depth, sizeof(float));	// non-negative floats sort like their bit patterns
+			return bits;
+		}
+
+		static void CountSwitches(const std::vector<DrawItem>& items, int& programSwitches, int& textureSwitches) {
+			programSwitches = 0;
+			textureSwitches = 0;
+			for (int i = 0; i < items.size(); i++) {
+				if (i == 0 || items[i].program != items[i - 1].program) programSwitches++;
+				if (i == 0 || items[i].textures != items[i - 1].textures) textureSwitches++;
+			}
+		}
+
+	public:
+		void Clear() {
+			_items.clear();
+		}
+
+		void Add(int batchIndex, InstanceBatch& batch) {
+			Model* model = batch.object->GetModel();
+			int program = ProgramIndex(batch.program) & 0xFF;
+			for (int i = 0; i < model->GetNMeshes(); i++) {
+				DrawItem item;
+				item.batch = batchIndex;
+				item.mesh = i;
+				item.program = program;
+				item.textures = TextureSetIndex(batch.object->GetMaterialByName(model->GetMeshAt(i).materialName)) & 0xFFFFF;
+				item.key = (DepthBucket(batch.depth) << QUEUE_BUCKET_SHIFT)
+					| ((uint64_t)item.program << QUEUE_PROGRAM_SHIFT)
+					| ((uint64_t)item.textures << QUEUE_TEXTURES_SHIFT)
+					| DepthBits(batch.depth);
+				_items.push_back(item);
+			}
+		}
+
+		// Sorts the queue and records how many switches the order saved compared to submission order
+		void Sort() {
+			int unsortedPrograms, unsortedTextures;
+			CountSwitches(_items, unsortedPrograms, unsortedTextures);
+
+			std::sort(_items.begin(), _items.end(), [](const DrawItem& a, const DrawItem& b) { return a.key < b.key; });
+
+			_stats.items = (int)_items.size();
+			CountSwitches(_items, _stats.programSwitches, _stats.textureSwitches);
+			_stats.programSwitchesAvoided = unsortedPrograms - _stats.programSwitches;
+			_stats.textureSwitchesAvoided = unsortedTextures - _stats.textureSwitches;
+		}
+
+		const std::vector<DrawItem>& GetItems() {
+			return _items;
+		}
+
+		RenderQueueStats GetStats() {
+			return _stats;
+		}
+	};
+}
\ No newline at end of file
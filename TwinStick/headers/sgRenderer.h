@@ -10,25 +10,133 @@
 #include <sgPointLight3D.h>
 #include <sgCamera3D.h>
 #include <sgSkyboxRenderer.h>
+#include <sgLightBuffer.h>
+#include <sgInstanceBuffer.h>
+#include <sgRenderQueue.h>
+#include <sgShadowAtlas.h>
+#include <sgLightClusters.h>
+#include <sgDeferredShading.h>
+#include <sgSceneBVH.h>
+#include <sgLightInteractions.h>
+#include <sgJobSystem.h>
+#include <sgCommandBuffer.h>
+#include <sgSimulationThread.h>
+#include <sgFramePipeline.h>
 #include <thread>
 
+// Which objects BuildBatches takes
+#define BATCH_ALL_OBJECTS 0
+#define BATCH_ALL_CASTERS 1
+#define BATCH_STATIC_CASTERS 2
+#define BATCH_DYNAMIC_CASTERS 3
+#define BATCH_LIT_OBJECTS 4
+#define BATCH_UNLIT_OBJECTS 5
+
+// Shadow passes draw this many levels of detail coarser than the main view
+#define LOD_SHADOW_BIAS 1.0f
+// Objects whose bounding sphere covers fewer pixels than this are not drawn at all
+#define LOD_CULL_PIXELS 1.0f
+// Milliseconds per frame spent uploading assets that finished loading
+#define ASSET_UPLOAD_BUDGET_MS 2.0
+
 namespace sg {
+    // The batches of one shadowed light. When the light is cached, the static casters are drawn
+    // into its static map only if refreshStatic is set, and the dynamic casters on top of a copy of it.
+    struct ShadowPass {
+        BatchRange staticCasters;
+        BatchRange dynamicCasters;
+        glm::mat4 viewProjection;
+        bool cached;
+        bool refreshStatic;
+    };
+
+    // A tile of the shadow atlas: a whole spot or directional light, or one cascade of a directional light
+    struct AtlasEntry {
+        AngledLight3D* light;
+        int cascade;	// -1 for the whole light
+    };
+
+    struct PointShadowState {
+        glm::vec3 position;
+        float farPlane;
+        glm::mat4 faceViewProjections[CUBE_FACES];
+    };
+
+    // What the GL passes read from the camera and the lights, copied at the sync point so that the
+    // simulation can go on moving them while the frame is submitted
+    struct FrameState {
+        glm::mat4 view;
+        glm::mat4 projection;
+        glm::mat4 viewProjection;
+        std::vector<PointShadowState> pointShadows;
+        std::vector<glm::mat4> spotViewProjections;
+    };
+
 	class Renderer {
     private:
-        GLuint _shadowedProgram;
-        GLuint _depthProgram;
-        GLuint _depthLinearProgram;
-        GLuint _unlitProgram;
-        GLuint _litProgram;
-        GLuint _triangulationProgram;
+        ShaderProgram* _shadowedProgram;
+        ShaderProgram* _depthProgram;
+        ShaderProgram* _depthLinearProgram;
+        ShaderProgram* _unlitProgram;
+        ShaderProgram* _litProgram;
+        ShaderProgram* _triangulationProgram;
         bool _showTriangulation;
+        std::vector<ShaderProgram*> _lightPrograms;
+        LightBuffer _lightBuffer;
+        LightClusters _clusters;
+        DeferredShading _deferredShading;
+        bool _deferred = false;
+        bool _depthPrepass = false;
         SkyboxRenderer _skybox;
 
+        InstanceBuffer _instances;
+        std::vector<InstanceBatch> _batches;
+        std::vector<int> _batchMembers;
+        std::vector<glm::mat4> _modelMatrices;
+        std::vector<glm::mat3> _normalMatrices;
+        std::vector<glm::mat4> _instanceMatrices;
+        std::vector<float> _viewDepths;
+        std::vector<float> _screenRadii;
+        RenderQueue _queue;
+        BatchRange _mainPass;
+        BatchRange _prepass;
+        BatchRange _trianglePass;
+        BatchRange _forwardPass;
+        ShadowAtlas _shadowAtlas;
+        std::vector<AtlasEntry> _atlasEntries;
+        std::vector<ShadowPass> _atlasPasses;
+        std::vector<ShadowPass> _pointPasses;
+        std::vector<PointLight3D*> _shadowedPointLights;
+        std::vector<int> _pointShadowSlots;
+        std::vector<Object3D*> _staticObjects;
+        std::vector<glm::mat4> _staticObjectMatrices;
+        int _staticVersion = 0;
+        SceneBVH _staticTree;
+        SceneBVH _dynamicTree;
+        std::vector<Object3D*> _dynamicObjects;
+        std::vector<int> _staticMembers;
+        std::vector<int> _dynamicMembers;
+        std::vector<int> _unculledMembers;
+        std::vector<glm::vec3> _boundsMin;
+        std::vector<glm::vec3> _boundsMax;
+        std::vector<VisibleObject> _mainVisible;
+        std::vector<VisibleObject> _lightVisible;
+        LightInteractions _interactions;
+        std::vector<int> _lightMasks;
+        JobSystem _jobs;
+        std::vector<CommandBuffer> _commands;
+        std::vector<Entity3D*> _parallelUpdates;
+        SimulationThread _simulation;
+        bool _threadedSimulation = true;
+        bool _updating = false;	// set only between ticks, so every thread that reads it is ordered after the write
+        FrameState _frame;
+        FramePipeline _pipeline;
+        bool _copyImage = false;
+
         GLFWwindow* _window;
         GLint _origFB;
         int _width;
         int _height;
-        GLuint _vao;
 
         Camera3D* _mainCamera;
         std::vector<SpotLight3D*> _spotLights;
@@ -36,12 +144,13 @@ namespace sg {
         std::vector<PointLight3D*> _pointLights;
         std::vector<AmbientLight*> _ambientLights;
         std::vector<Object3D*> _objects;
+        std::vector<Object3D*> _pendingObjects;
         std::vector<Entity3D*> _entities;
 
         double _timestep = 1000.0 / 40;
         int _tessellationLevel = 1;
         bool _firstFrame = true;
-        double _lastDt;
+        double _lastDt = 0;
 
         void StartAll() {
             for (int i = 0; i < _entities.size(); i++) {
@@ -50,6 +159,9 @@ namespace sg {
             for (int i = 0; i < _objects.size(); i++) {
                 _objects[i]->Start();
             }
+            for (int i = 0; i < _pendingObjects.size(); i++) {
+                _pendingObjects[i]->Start();
+            }
             for (int i = 0; i < _spotLights.size(); i++) {
                 _spotLights[i]->Start();
             }
@@ -64,49 +176,172 @@ namespace sg {
 
         void UpdateAll(double dt) {
             dt /= 1000;
+            // Serial updates first, in the usual order; the entities that allow it are set aside and
+            // updated together on the job threads afterwards
+            _parallelUpdates.clear();
             for (int i = 0; i < _entities.size(); i++) {
-                _entities[i]->Update(dt);
+                UpdateOrDefer(_entities[i], dt);
             }
             for (int i = 0; i < _objects.size(); i++) {
-                _objects[i]->Update(dt);
+                UpdateOrDefer(_objects[i], dt);
+            }
+            for (int i = 0; i < _pendingObjects.size(); i++) {
+                UpdateOrDefer(_pendingObjects[i], dt);
             }
             for (int i = 0; i < _spotLights.size(); i++) {
-                _spotLights[i]->Update(dt);
+                UpdateOrDefer(_spotLights[i], dt);
             }
             for (int i = 0; i < _directionalLights.size(); i++) {
-                _directionalLights[i]->Update(dt);
+                UpdateOrDefer(_directionalLights[i], dt);
             }
             for (int i = 0; i < _ambientLights.size(); i++) {
-                _ambientLights[i]->Update(dt);
+                UpdateOrDefer(_ambientLights[i], dt);
             }
-            _mainCamera->Update(dt);
+            UpdateOrDefer(_mainCamera, dt);
+            _jobs.ParallelFor((int)_parallelUpdates.size(), 0, [this, dt](int first, int last) {
+                for (int i = first; i < last; i++) {
+                    _parallelUpdates[i]->Update(dt);
+                }
+            });
         }
 
-        void UpdateOrStart() {
-            if (!_firstFrame) {
-                UpdateAll(_lastDt);
+        void UpdateOrDefer(Entity3D* entity, double dt) {
+            if (entity->ParallelUpdate) _parallelUpdates.push_back(entity);
+            else entity->Update(dt);
+        }
+
+        // Hands the assets decoded on the job threads to GL, within a time budget so that a burst of
+        // loads is spread over several frames. At least one item is uploaded per frame, whatever its cost.
+        // Objects whose model failed to load are dropped from the scene with an error.
+        void UploadPendingAssets() {
+            // getCurrentTimeMillis counts microseconds, as RenderFrame's frame time does
+            double deadline = sg::getCurrentTimeMillis() + ASSET_UPLOAD_BUDGET_MS * 1000;
+            bool uploaded = false;
+            while ((!uploaded || sg::getCurrentTimeMillis() <= deadline) && TextureManager::Instance()->UploadDecoded()) {
+                uploaded = true;
             }
-            else {
-                StartAll();
-                _firstFrame = false;
+            for (int i = 0; i < _pendingObjects.size(); ) {
+                Object3D* obj = _pendingObjects[i];
+                if (obj->GetModel()->IsFailed()) {
+                    printf("Error: the model of an object failed to load, the object is removed from the scene\n");
+                    _pendingObjects.erase(std::next(_pendingObjects.begin(), i));
+                    continue;
+                }
+                if (!obj->GetModel()->IsLoaded() || (uploaded && sg::getCurrentTimeMillis() > deadline)) {
+                    i++;
+                    continue;
+                }
+                obj->GetModel()->Upload();
+                obj->RefreshMaterials();
+                _objects.push_back(obj);
+                _pendingObjects.erase(std::next(_pendingObjects.begin(), i));
+                uploaded = true;
+            }
+        }
+
+        // The update phase's sync point: every thread's commands in the order they were recorded,
+        // then the deletes, once each
+        void ApplyCommands() {
+            std::vector<Entity3D*> deletes;
+            for (CommandBuffer& buffer : _commands) {
+                for (Command& command : buffer.GetCommands()) {
+                    switch (command.type) {
+                    case CommandAddEntity:
+                        AddEntity(command.entity);
+                        break;
+                    case CommandRemoveEntity:
+                        RemoveEntity(command.entity);
+                        break;
+                    case CommandAddObject:
+                        AddObject(command.object);
+                        break;
+                    case CommandRemoveObject:
+                        RemoveObject(command.object);
+                        break;
+                    case CommandAddLight:
+                        AddLight(command.light);
+                        break;
+                    case CommandRemoveLight:
+                        RemoveLight(command.light);
+                        break;
+                    case CommandSetParent:
+                        if (command.entity->GetParent() != NULL) command.entity->GetParent()->RemoveChild(command.entity, command.keepLocal);
+                        if (command.parent != NULL) command.parent->AddChild(command.entity, command.keepLocal);
+                        break;
+                    case CommandDelete:
+                        if (std::find(deletes.begin(), deletes.end(), command.entity) == deletes.end()) deletes.push_back(command.entity);
+                        break;
+                    case CommandCall:
+                        command.call();
+                        break;
+                    }
+                }
+                buffer.Clear();
+            }
+            for (Entity3D* entity : deletes) {
+                delete(entity);
+            }
+        }
+
+        // Copies what the GL passes need from the scene, once the frame's batches and lights are built
+        void CaptureFrame() {
+            _frame.view = _mainCamera->GetView();
+            _frame.projection = _mainCamera->GetProjection();
+            _frame.viewProjection = _mainCamera->GetViewProjection();
+            _frame.pointShadows.resize(_shadowedPointLights.size());
+            for (int i = 0; i < _shadowedPointLights.size(); i++) {
+                PointLight3D* light = _shadowedPointLights[i];
+                _frame.pointShadows[i].position = light->GetGlobalPosition();
+                _frame.pointShadows[i].farPlane = light->GetFarPlane();
+                for (int face = 0; face < CUBE_FACES; face++) {
+                    _frame.pointShadows[i].faceViewProjections[face] = light->GetViewProjection(face);
+                }
+            }
+            _frame.spotViewProjections.clear();
+            for (int i = 0; i < _spotLights.size() && i < MAX_LIGHTS; i++) {
+                _frame.spotViewProjections.push_back(_spotLights[i]->GetViewProjection());
+            }
+        }
+
+        // Point lights are not capped, but only MAX_LIGHTS of them have their cube map bound:
+        // the ones in view that are nearest to the camera
+        void AssignPointShadows() {
+            std::vector<int> order;
+            for (int i = 0; i < _pointLights.size(); i++) {
+                if (_pointLights[i]->FrustumCheck(_mainCamera->GetFrustum())) order.push_back(i);
+            }
+            glm::vec3 cameraPosition = _mainCamera->GetGlobalPosition();
+            std::stable_sort(order.begin(), order.end(), [this, cameraPosition](int a, int b) {
+                return glm::length(_pointLights[a]->GetGlobalPosition() - cameraPosition) < glm::length(_pointLights[b]->GetGlobalPosition() - cameraPosition);
+            });
+
+            _pointShadowSlots.assign(_pointLights.size(), -1);
+            _shadowedPointLights.clear();
+            for (int k = 0; k < order.size() && k < MAX_LIGHTS; k++) {
+                _pointShadowSlots[order[k]] = k;
+                _shadowedPointLights.push_back(_pointLights[order[k]]);
             }
         }
 
         void UpdateLights() {
-            int textureUnit = 2;
-            sg::UpdateDirectionalLights(_shadowedProgram, _directionalLights, _mainCamera->GetView(), textureUnit);
-            sg::UpdateDirectionalLights(_litProgram, _directionalLights, _mainCamera->GetView(), textureUnit);
+            AssignPointShadows();
+            _lightBuffer.Update(_spotLights, _directionalLights, _ambientLights, _mainCamera->GetView(), _pipeline.GetSlot());
+            _clusters.Update(_pointLights, _pointShadowSlots, _mainCamera->GetView(), _mainCamera->GetProjection(),
+                _mainCamera->GetNearPlane(), _mainCamera->GetFarPlane(), _width, _height);
 
-            textureUnit += _directionalLights.size();
-            sg::UpdatePointLights(_shadowedProgram, _pointLights, _mainCamera->GetView(), textureUnit);
-            sg::UpdatePointLights(_litProgram, _pointLights, _mainCamera->GetView(), textureUnit);
+            int textureUnit = 2;
+            GLState::BindTexture(textureUnit, GL_TEXTURE_2D, _shadowAtlas.GetLiveBuffer().depthMap);
+            for (ShaderProgram* program : _lightPrograms) {
+                program->SetInt(program->uniforms.shadowAtlas, textureUnit);
+            }
+            sg::UpdateDirectionalLights(_lightPrograms, _directionalLights);
 
-            textureUnit += _pointLights.size();
-            sg::UpdateSpotLights(_shadowedProgram, _spotLights, _mainCamera->GetView(), textureUnit);
-            sg::UpdateSpotLights(_litProgram, _spotLights, _mainCamera->GetView(), textureUnit);
+            textureUnit++;
+            sg::UpdatePointLights(_lightPrograms, _shadowedPointLights, textureUnit);
 
-            sg::UpdateAmbientLights(_shadowedProgram, _ambientLights);
-            sg::UpdateAmbientLights(_litProgram, _ambientLights);
+            textureUnit += _shadowedPointLights.size();
+            textureUnit = _clusters.Bind(_lightPrograms, textureUnit);
+            sg::UpdateSpotLights(_lightPrograms, _spotLights, textureUnit);
         }
 
         void RemoveSpotLight(SpotLight3D* light) {
@@ -119,6 +354,7 @@ namespace sg {
             }
             if (index >= 0) {
                 _spotLights.erase(std::next(_spotLights.begin(), index));
+                _interactions.Forget(light);
             }
         }
 
@@ -132,6 +368,7 @@ namespace sg {
             }
             if (index >= 0) {
                 _directionalLights.erase(std::next(_directionalLights.begin(), index));
+                _interactions.Forget(light);
             }
         }
 
@@ -145,6 +382,7 @@ namespace sg {
             }
             if (index >= 0) {
                 _pointLights.erase(std::next(_pointLights.begin(), index));
+                _interactions.Forget(light);
             }
         }
 
@@ -161,86 +399,562 @@ namespace sg {
             }
         }
 
-        void RenderShadows() {
-            glUseProgram(_depthProgram);
+        ShaderProgram* MainProgramFor(Object3D* obj) {
+            if (!obj->Lit) return _unlitProgram;
+            if (_deferred) return _deferredShading.GetGeometryProgram(obj->ReceivesShadows);
+            return obj->ReceivesShadows ? _shadowedProgram : _litProgram;
+        }
 
-            for (int i = 0; i < _spotLights.size(); i++) {
-                if (!_spotLights[i]->FrustumCheck(_mainCamera->GetFrustum())) continue;
-                glBindFramebuffer(GL_DRAW_FRAMEBUFFER, _spotLights[i]->GetShadowBuffer().bufferIndex);
-                glClear(GL_DEPTH_BUFFER_BIT);
-                glViewport(0, 0, _spotLights[i]->GetShadowWidth(), _spotLights[i]->GetShadowHeight());
+        // Groups the visible objects into instanced batches. A NULL program picks each object's
+        // main pass program; depth programs ignore materials, so those batches only compare models.
+        // With several frustums (the faces of a cube map) objects only share a batch when they are
+        // seen by the same set of faces.
+        static bool BatchAccepts(Object3D* obj, int objects) {
+            switch (objects) {
+            case BATCH_ALL_CASTERS:
+                return obj->CastsShadows;
+            case BATCH_STATIC_CASTERS:
+                return obj->CastsShadows && obj->Static;
+            case BATCH_DYNAMIC_CASTERS:
+                return obj->CastsShadows && !obj->Static;
+            case BATCH_LIT_OBJECTS:
+                return obj->Lit;
+            case BATCH_UNLIT_OBJECTS:
+                return !obj->Lit;
+            default:
+                return true;
+            }
+        }
+
+        BatchRange BuildBatches(ShaderProgram* program, int objects, const std::vector<VisibleObject>& visible, float lodBias = 0) {
+            BatchRange range;
+            range.first = (int)_batches.size();
+            _batchMembers.clear();
 
-                for (int j = 0; j < _objects.size(); j++) {
-                    if (_objects[j]->CastsShadows) {
-                        _objects[j]->Draw(_depthProgram, _spotLights[i]->GetViewProjection(), _spotLights[i]->GetFrustum());
+            for (int v = 0; v < visible.size(); v++) {
+                int j = visible[v].object;
+                int faceMask = visible[v].faceMask;
+                Object3D* obj = _objects[j];
+                if (!BatchAccepts(obj, objects)) continue;
+
+                ShaderProgram* p = program != NULL ? program : MainProgramFor(obj);
+                bool compareMaterials = p->uniforms.material.Kd >= 0 || p->uniforms.material.dTextureSet >= 0;
+                int b = range.first;
+                int lod = obj->GetModel()->SelectLod(_screenRadii[j], lodBias);
+                while (b < _batches.size() && !(_batches[b].program == p && _batches[b].faceMask == faceMask && _batches[b].lod == lod
+                    && _batches[b].object->CanShareBatchWith(obj, compareMaterials))) b++;
+                if (b == _batches.size()) {
+                    InstanceBatch batch = { obj, p, 0, 0, _viewDepths[j], faceMask, lod };
+                    _batches.push_back(batch);
+                }
+                _batches[b].count++;
+                _batches[b].depth = glm::min(_batches[b].depth, _viewDepths[j]);
+                _batchMembers.push_back(j);
+                _batchMembers.push_back(b);
+            }
+
+            range.count = (int)_batches.size() - range.first;
+            for (int b = range.first; b < _batches.size(); b++) {
+                _batches[b].firstInstance = _instances.Allocate(_batches[b].count);
+                _batches[b].count = 0;
+            }
+            for (int m = 0; m < _batchMembers.size(); m += 2) {
+                int j = _batchMembers[m];
+                InstanceBatch& batch = _batches[_batchMembers[m + 1]];
+                _instances.Set(batch.firstInstance + batch.count++, _instanceMatrices[j], _normalMatrices[j], _lightMasks[j]);
+            }
+            return range;
+        }
+
+        // Pixels covered by the radius of a box's bounding sphere in the main view; the w of a clip-space point
+        // is its view depth under a perspective projection and 1 under an orthographic one
+        float ScreenRadius(glm::mat4 view, glm::vec3 min, glm::vec3 max) {
+            glm::mat4 projection = _mainCamera->GetProjection();
+            float radius = glm::length(max - min) * 0.5f;
+            float depth = -(view * glm::vec4((min + max) * 0.5f, 1)).z;
+            if (projection[2][3] != 0 && depth <= radius) return FLT_MAX;
+            float w = projection[3][3] - projection[2][3] * depth;
+            return radius * projection[1][1] / w * _height * 0.5f;
+        }
+
+        // Moves the static version on when a static object was added, removed or moved, which rebuilds
+        // the static tree and invalidates every light's cached static shadows
+        bool TrackStaticObjects() {
+            bool changed = false;
+            int n = 0;
+            for (int j = 0; j < _objects.size(); j++) {
+                if (!_objects[j]->Static) continue;
+                if (n == _staticObjects.size()) {
+                    _staticObjects.push_back(_objects[j]);
+                    _staticObjectMatrices.push_back(_modelMatrices[j]);
+                    changed = true;
+                } else if (_staticObjects[n] != _objects[j] || _staticObjectMatrices[n] != _modelMatrices[j]) {
+                    _staticObjects[n] = _objects[j];
+                    _staticObjectMatrices[n] = _modelMatrices[j];
+                    changed = true;
+                }
+                n++;
+            }
+            if (n != _staticObjects.size()) {
+                _staticObjects.resize(n);
+                _staticObjectMatrices.resize(n);
+                changed = true;
+            }
+            if (changed) _staticVersion++;
+            return changed;
+        }
+
+        // The static tree is only rebuilt when a static object changed. The dynamic tree is rebuilt
+        // when objects came or went and otherwise refit to where its members moved.
+        void UpdateSceneTrees() {
+            _staticMembers.clear();
+            _dynamicMembers.clear();
+            _unculledMembers.clear();
+            for (int j = 0; j < _objects.size(); j++) {
+                if (!_objects[j]->PerformFrustumCheck) _unculledMembers.push_back(j);
+                else if (_objects[j]->Static) _staticMembers.push_back(j);
+                else _dynamicMembers.push_back(j);
+            }
+
+            // Light interaction lists hold static tree slots, so any rebuild must move the version on
+            bool staticChanged = TrackStaticObjects();
+            if (!staticChanged && _staticTree.GetNMembers() != _staticMembers.size()) {
+                staticChanged = true;
+                _staticVersion++;
+            }
+            if (staticChanged) {
+                _staticTree.Build(_staticMembers, _boundsMin, _boundsMax);
+            } else {
+                _staticTree.SetMembers(_staticMembers);
+            }
+
+            bool sameMembers = _dynamicObjects.size() == _dynamicMembers.size();
+            for (int m = 0; sameMembers && m < _dynamicMembers.size(); m++) {
+                sameMembers = _dynamicObjects[m] == _objects[_dynamicMembers[m]];
+            }
+            if (sameMembers) {
+                _dynamicTree.SetMembers(_dynamicMembers);
+                _dynamicTree.Refit(_boundsMin, _boundsMax);
+            }
+            if (!sameMembers || _dynamicTree.IsDegraded()) {
+                _dynamicObjects.resize(_dynamicMembers.size());
+                for (int m = 0; m < _dynamicMembers.size(); m++) {
+                    _dynamicObjects[m] = _objects[_dynamicMembers[m]];
+                }
+                _dynamicTree.Build(_dynamicMembers, _boundsMin, _boundsMax);
+            }
+        }
+
+        // Collects the objects seen by any of the frustums, in object order so batching stays stable.
+        // A light's static objects come from its interaction list, queried again only when stale.
+        void Cull(const sg::Frustum* frustums, int nFrustums, std::vector<VisibleObject>& visible,
+            ShadowedLight3D* light = NULL, glm::mat4 viewProjection = glm::mat4(1)) {
+            visible.clear();
+            if (light != NULL) {
+                for (const VisibleObject& v : _interactions.GetStaticSlots(light, viewProjection, _staticVersion, _staticTree, frustums, nFrustums)) {
+                    visible.push_back(VisibleObject{ _staticTree.GetMember(v.object), v.faceMask });
+                }
+            } else {
+                _staticTree.Query(frustums, nFrustums, visible);
+            }
+            _dynamicTree.Query(frustums, nFrustums, visible);
+            visible.erase(std::remove_if(visible.begin(), visible.end(),
+                [this](const VisibleObject& v) { return _screenRadii[v.object] < LOD_CULL_PIXELS; }), visible.end());
+            int allFaces = (1 << nFrustums) - 1;
+            for (int j : _unculledMembers) {
+                visible.push_back(VisibleObject{ j, allFaces });
+            }
+            std::sort(visible.begin(), visible.end(), [](const VisibleObject& a, const VisibleObject& b) { return a.object < b.object; });
+        }
+
+        // Batches the casters in _lightVisible, which the caller has just culled for this light
+        ShadowPass BuildShadowPass(ShadowedLight3D* light, glm::mat4 viewProjection, bool cached, ShaderProgram* program) {
+            ShadowPass pass = ShadowPass();
+            pass.viewProjection = viewProjection;
+            pass.cached = cached;
+            if (!cached) {
+                pass.dynamicCasters = BuildBatches(program, BATCH_ALL_CASTERS, _lightVisible, LOD_SHADOW_BIAS);
+                return pass;
+            }
+            pass.refreshStatic = !light->IsStaticCacheValid(viewProjection, _staticVersion);
+            if (pass.refreshStatic) pass.staticCasters = BuildBatches(program, BATCH_STATIC_CASTERS, _lightVisible, LOD_SHADOW_BIAS);
+            pass.dynamicCasters = BuildBatches(program, BATCH_DYNAMIC_CASTERS, _lightVisible, LOD_SHADOW_BIAS);
+            return pass;
+        }
+
+        // Builds the batches of every pass of the frame and streams all their instances in one upload
+        void PrepareBatches() {
+            _batches.clear();
+            _instances.Clear();
+            _modelMatrices.resize(_objects.size());
+            _normalMatrices.resize(_objects.size());
+            _instanceMatrices.resize(_objects.size());
+            _viewDepths.resize(_objects.size());
+            _screenRadii.resize(_objects.size());
+            _boundsMin.resize(_objects.size());
+            _boundsMax.resize(_objects.size());
+            glm::mat4 view = _mainCamera->GetView();
+            // Every object only writes its own slots, so the objects split across the job threads
+            _jobs.ParallelFor((int)_objects.size(), 0, [this, view](int first, int last) {
+                for (int j = first; j < last; j++) {
+                    _modelMatrices[j] = _objects[j]->GetModelMatrix();
+                    _normalMatrices[j] = glm::transpose(glm::inverse(glm::mat3(_modelMatrices[j])));
+                    // Packed positions are stored in [0, 1] across the model's box: the instance matrix takes them back
+                    _instanceMatrices[j] = _modelMatrices[j] * _objects[j]->GetModel()->GetDequantization();
+                    _viewDepths[j] = -(view * _modelMatrices[j][3]).z;
+                    _objects[j]->GetWorldBounds(_boundsMin[j], _boundsMax[j]);
+                    _screenRadii[j] = ScreenRadius(view, _boundsMin[j], _boundsMax[j]);
+                }
+            });
+            UpdateSceneTrees();
+
+            // Lights outside the view have no atlas tile and are skipped; point lights keep their maps.
+            // Cascades follow the camera, so they are redrawn every frame rather than cached.
+            for (int i = 0; i < _directionalLights.size(); i++) {
+                _directionalLights[i]->UpdateCascades(_mainCamera->GetViewProjection(), _mainCamera->GetNearPlane(), _mainCamera->GetFarPlane());
+            }
+            PackShadowAtlas();
+
+            // The first MAX_LIGHTS spot lights are the ones the shaders see: each marks the objects its frustum
+            // reaches in their instance light mask, and the shaders skip the spot lights an instance lacks.
+            // Spot entries come first in the atlas, in the same order.
+            _lightMasks.assign(_objects.size(), 0);
+            _atlasPasses.assign(_atlasEntries.size(), ShadowPass());
+            for (int i = 0; i < _atlasEntries.size(); i++) {
+                AtlasEntry entry = _atlasEntries[i];
+                bool masked = i < _spotLights.size() && i < MAX_LIGHTS;
+                if (EntryTile(entry).size == 0 && !masked) continue;
+                sg::Frustum frustum = EntryFrustum(entry);
+                glm::mat4 viewProjection = EntryViewProjection(entry);
+                Cull(&frustum, 1, _lightVisible, entry.cascade < 0 ? entry.light : NULL, viewProjection);
+                if (masked) {
+                    for (const VisibleObject& v : _lightVisible) {
+                        _lightMasks[v.object] |= 1 << i;
                     }
                 }
+                if (EntryTile(entry).size == 0) continue;
+                _atlasPasses[i] = BuildShadowPass(entry.light, viewProjection, entry.cascade < 0, _depthProgram);
+            }
+            // Cube maps can only be copied with glCopyImageSubData; without it point lights redraw every caster
+            _pointPasses.assign(_shadowedPointLights.size(), ShadowPass());
+            for (int i = 0; i < _shadowedPointLights.size(); i++) {
+                PointLight3D* light = _shadowedPointLights[i];
+                sg::Frustum faces[CUBE_FACES];
+                for (int face = 0; face < CUBE_FACES; face++) {
+                    faces[face] = light->GetFrustum(face);
+                }
+                Cull(faces, CUBE_FACES, _lightVisible, light, light->GetViewProjection(0));
+                _pointPasses[i] = BuildShadowPass(light, light->GetViewProjection(0), _copyImage, _depthLinearProgram);
+            }
+
+            // In deferred mode the queue only fills the G-buffer; unlit objects are drawn forward after the lights
+            // The main view is culled once and every pass drawn from it batches the same list
+            BatchRange empty = { 0, 0 };
+            sg::Frustum mainFrustum = _mainCamera->GetFrustum();
+            Cull(&mainFrustum, 1, _mainVisible);
+            _mainPass = BuildBatches(NULL, _deferred ? BATCH_LIT_OBJECTS : BATCH_ALL_OBJECTS, _mainVisible);
+            _queue.Clear();
+            for (int i = _mainPass.first; i < _mainPass.first + _mainPass.count; i++) {
+                _queue.Add(i, _batches[i]);
+            }
+            _queue.Sort();
+            _forwardPass = _deferred ? BuildBatches(NULL, BATCH_UNLIT_OBJECTS, _mainVisible) : empty;
+
+            // The prepass only lays down depth, so it ignores materials and goes front to back to reject as much as it can
+            _prepass = (_depthPrepass && !_deferred) ? BuildBatches(_depthProgram, BATCH_ALL_OBJECTS, _mainVisible) : empty;
+            std::sort(_batches.begin() + _prepass.first, _batches.begin() + _prepass.first + _prepass.count,
+                [](const InstanceBatch& a, const InstanceBatch& b) { return a.depth < b.depth; });
+            _trianglePass = _showTriangulation ? BuildBatches(_triangulationProgram, BATCH_ALL_OBJECTS, _mainVisible) : empty;
+
+            _instances.Upload(_pipeline.GetSlot());
+        }
+
+        void DrawBatches(BatchRange range, glm::mat4 vp) {
+            for (int i = range.first; i < range.first + range.count; i++) {
+                InstanceBatch& batch = _batches[i];
+                batch.program->SetMat4(batch.program->uniforms.vp, vp);
+                batch.program->SetInt(batch.program->uniforms.faceMask, batch.faceMask);
+                bool positionsOnly = batch.program == _depthProgram || batch.program == _depthLinearProgram;
+                Model* model = batch.object->GetModel();
+                GLState::BindVertexArray(positionsOnly ? model->GetPositionVAO() : model->GetVAO());
+                _instances.BindAttributes(batch.firstInstance);
+                batch.object->DrawInstanced(batch.program, batch.count, batch.lod);
+            }
+            GLState::BindVertexArray(0);
+        }
+
+        // Submits the main pass in queue order, re-pointing the instance attributes only when the batch changes
+        void DrawQueue(glm::mat4 vp) {
+            const std::vector<DrawItem>& items = _queue.GetItems();
+            int currentBatch = -1;
+            for (int i = 0; i < items.size(); i++) {
+                InstanceBatch& batch = _batches[items[i].batch];
+                if (items[i].batch != currentBatch) {
+                    batch.program->SetMat4(batch.program->uniforms.vp, vp);
+                    GLState::BindVertexArray(batch.object->GetModel()->GetVAO());
+                    _instances.BindAttributes(batch.firstInstance);
+                    currentBatch = items[i].batch;
+                }
+                batch.object->DrawMeshInstanced(batch.program, items[i].mesh, batch.count, batch.lod);
             }
+            GLState::BindVertexArray(0);
+        }
+
+        // Copies a region between two depth textures of the same layout. The blit fallback honours the scissor.
+        void CopyDepth(GLuint source, GLuint sourceBuffer, GLuint destination, GLuint destinationBuffer, GLenum target,
+            int x, int y, int width, int height, int layers) {
+            if (_copyImage) {
+                glCopyImageSubData(source, target, 0, x, y, 0, destination, target, 0, x, y, 0, width, height, layers);
+            } else {
+                GLState::BindFramebuffer(GL_READ_FRAMEBUFFER, sourceBuffer);
+                GLState::BindFramebuffer(GL_DRAW_FRAMEBUFFER, destinationBuffer);
+                glBlitFramebuffer(x, y, x + width, y + height, x, y, x + width, y + height, GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+            }
+        }
+
+        static void SetAtlasTile(AtlasTile tile) {
+            GLState::Viewport(tile.x, tile.y, tile.size, tile.size);
+            GLState::Scissor(tile.x, tile.y, tile.size, tile.size);
+        }
+
+        static AtlasTile EntryTile(AtlasEntry entry) {
+            if (entry.cascade < 0) return entry.light->GetAtlasTile();
+            return static_cast<DirectionalLight3D*>(entry.light)->GetCascadeAtlasTile(entry.cascade);
+        }
+
+        static glm::mat4 EntryViewProjection(AtlasEntry entry) {
+            if (entry.cascade < 0) return entry.light->GetViewProjection();
+            return static_cast<DirectionalLight3D*>(entry.light)->GetCascadeViewProjection(entry.cascade);
+        }
 
+        static sg::Frustum EntryFrustum(AtlasEntry entry) {
+            if (entry.cascade < 0) return entry.light->GetFrustum();
+            return static_cast<DirectionalLight3D*>(entry.light)->GetCascadeFrustum(entry.cascade);
+        }
+
+        // Directional lights get the tile size they ask for, and cascaded ones one tile per cascade.
+        // A spot light's tile halves each time the camera's distance to it doubles past its range,
+        // and lights outside the view get no tile.
+        void PackShadowAtlas() {
+            _atlasEntries.clear();
+            std::vector<int> requested;
+            glm::vec3 cameraPosition = _mainCamera->GetGlobalPosition();
+            for (int i = 0; i < _spotLights.size(); i++) {
+                SpotLight3D* light = _spotLights[i];
+                int size = 0;
+                if (i < MAX_LIGHTS && light->FrustumCheck(_mainCamera->GetFrustum())) {
+                    size = glm::max(light->GetShadowWidth(), light->GetShadowHeight());
+                    float ratio = glm::length(light->GetGlobalPosition() - cameraPosition) / light->GetRange();
+                    if (ratio > 1) size >>= glm::min(3, (int)ceilf(log2f(ratio)));
+                }
+                _atlasEntries.push_back(AtlasEntry{ light, -1 });
+                requested.push_back(size);
+            }
             for (int i = 0; i < _directionalLights.size(); i++) {
-                if (!_directionalLights[i]->FrustumCheck(_mainCamera->GetFrustum())) continue;
-                glBindFramebuffer(GL_DRAW_FRAMEBUFFER, _directionalLights[i]->GetShadowBuffer().bufferIndex);
+                DirectionalLight3D* light = _directionalLights[i];
+                if (light->GetNCascades() > 0) {
+                    for (int c = 0; c < light->GetNCascades(); c++) {
+                        _atlasEntries.push_back(AtlasEntry{ light, c });
+                        requested.push_back(i < MAX_LIGHTS ? light->GetCascadeResolution() : 0);
+                    }
+                    continue;
+                }
+                int size = 0;
+                if (i < MAX_LIGHTS && light->FrustumCheck(_mainCamera->GetFrustum())) {
+                    size = glm::max(light->GetShadowWidth(), light->GetShadowHeight());
+                }
+                _atlasEntries.push_back(AtlasEntry{ light, -1 });
+                requested.push_back(size);
+            }
+
+            _shadowAtlas.Pack(requested);
+            for (int i = 0; i < _atlasEntries.size(); i++) {
+                AtlasEntry entry = _atlasEntries[i];
+                AtlasTile tile = _shadowAtlas.GetTile(i);
+                if (tile == EntryTile(entry)) continue;
+                if (entry.cascade >= 0) {
+                    static_cast<DirectionalLight3D*>(entry.light)->SetCascadeAtlasTile(entry.cascade, tile, _shadowAtlas.GetSize());
+                    continue;
+                }
+                entry.light->SetAtlasTile(tile, _shadowAtlas.GetSize());
+                entry.light->InvalidateStaticCache();
+                entry.light->SetLiveMapStaticCopy(false);
+            }
+        }
+
+        // Spot and directional shadows: refreshed static tiles are drawn into the static atlas, copied
+        // into the live atlas, and the dynamic casters drawn on top, with one framebuffer bind per stage.
+        // Uncached tiles (cascades) skip the first two stages and are cleared and fully drawn in the last.
+        void RenderAtlasShadows() {
+            FrameBuffer live = _shadowAtlas.GetLiveBuffer();
+            FrameBuffer cache = _shadowAtlas.GetStaticBuffer();
+            GLState::SetEnabled(GL_SCISSOR_TEST, true);
+
+            GLState::BindFramebuffer(GL_DRAW_FRAMEBUFFER, cache.bufferIndex);
+            for (int i = 0; i < _atlasEntries.size(); i++) {
+                AtlasTile tile = EntryTile(_atlasEntries[i]);
+                if (tile.size == 0 || !_atlasPasses[i].refreshStatic) continue;
+                SetAtlasTile(tile);
                 glClear(GL_DEPTH_BUFFER_BIT);
-                glViewport(0, 0, _directionalLights[i]->GetShadowWidth(), _directionalLights[i]->GetShadowHeight());
+                DrawBatches(_atlasPasses[i].staticCasters, _atlasPasses[i].viewProjection);
+                _atlasEntries[i].light->SetStaticCacheValid(_atlasPasses[i].viewProjection, _staticVersion);
+            }
 
-                for (int j = 0; j < _objects.size(); j++) {
-                    if (_objects[j]->CastsShadows) {
-                        _objects[j]->Draw(_depthProgram, _directionalLights[i]->GetViewProjection(), _directionalLights[i]->GetFrustum());
-                    }
+            std::vector<int> dynamicLights;
+            for (int i = 0; i < _atlasEntries.size(); i++) {
+                AngledLight3D* light = _atlasEntries[i].light;
+                AtlasTile tile = EntryTile(_atlasEntries[i]);
+                ShadowPass& pass = _atlasPasses[i];
+                if (tile.size == 0) continue;
+                if (!pass.cached) {
+                    dynamicLights.push_back(i);
+                    continue;
                 }
+                if (!pass.refreshStatic && pass.dynamicCasters.count == 0 && light->IsLiveMapStaticCopy()) continue;
+                SetAtlasTile(tile);
+                CopyDepth(cache.depthMap, cache.bufferIndex, live.depthMap, live.bufferIndex, GL_TEXTURE_2D, tile.x, tile.y, tile.size, tile.size, 1);
+                light->SetLiveMapStaticCopy(pass.dynamicCasters.count == 0);
+                if (pass.dynamicCasters.count > 0) dynamicLights.push_back(i);
             }
 
-            glUseProgram(_depthLinearProgram);
+            GLState::BindFramebuffer(GL_DRAW_FRAMEBUFFER, live.bufferIndex);
+            for (int i : dynamicLights) {
+                SetAtlasTile(EntryTile(_atlasEntries[i]));
+                if (!_atlasPasses[i].cached) glClear(GL_DEPTH_BUFFER_BIT);
+                DrawBatches(_atlasPasses[i].dynamicCasters, _atlasPasses[i].viewProjection);
+            }
+            GLState::SetEnabled(GL_SCISSOR_TEST, false);
+        }
 
-            for (int i = 0; i < _pointLights.size(); i++) {
-                if (!_pointLights[i]->FrustumCheck(_mainCamera->GetFrustum())) continue;
-                glBindFramebuffer(GL_DRAW_FRAMEBUFFER, _pointLights[i]->GetShadowBuffer().bufferIndex);
-                for (int face = 0; face < 6; face++) {
-                    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, _pointLights[i]->GetShadowTexture(), 0);
+        // Leaves the light's live map bound and holding the static casters, ready for the dynamic ones.
+        // Returns false when nothing changed since the map was last written and there is nothing to draw.
+        bool PrepareShadowMap(ShadowedLight3D* light, ShadowPass& pass, GLuint liveBuffer, GLuint liveMap, GLuint cacheBuffer, GLuint cacheMap,
+            GLenum target, int layers, glm::mat4 vp) {
+            int width = light->GetShadowWidth();
+            int height = light->GetShadowHeight();
+            if (pass.cached) {
+                if (!pass.refreshStatic && pass.dynamicCasters.count == 0 && light->IsLiveMapStaticCopy()) return false;
+                if (pass.refreshStatic) {
+                    GLState::BindFramebuffer(GL_DRAW_FRAMEBUFFER, cacheBuffer);
+                    GLState::Viewport(0, 0, width, height);
                     glClear(GL_DEPTH_BUFFER_BIT);
-                    glViewport(0, 0, _pointLights[i]->GetShadowWidth(), _pointLights[i]->GetShadowHeight());
+                    DrawBatches(pass.staticCasters, vp);
+                    light->SetStaticCacheValid(pass.viewProjection, _staticVersion);
+                }
+                CopyDepth(cacheMap, cacheBuffer, liveMap, liveBuffer, target, 0, 0, width, height, layers);
+                light->SetLiveMapStaticCopy(pass.dynamicCasters.count == 0);
+                GLState::BindFramebuffer(GL_DRAW_FRAMEBUFFER, liveBuffer);
+                GLState::Viewport(0, 0, width, height);
+            } else {
+                light->SetLiveMapStaticCopy(false);
+                GLState::BindFramebuffer(GL_DRAW_FRAMEBUFFER, liveBuffer);
+                GLState::Viewport(0, 0, width, height);
+                glClear(GL_DEPTH_BUFFER_BIT);
+            }
+            return true;
+        }
 
-                    glUniform3fv(glGetUniformLocation(_depthLinearProgram, "lightPos"), 1, glm::value_ptr(_pointLights[i]->GetGlobalPosition()));
-                    glUniform1f(glGetUniformLocation(_depthLinearProgram, "far_plane"), _pointLights[i]->GetFarPlane());
+        void RenderShadows() {
+            RenderAtlasShadows();
 
-                    for (int j = 0; j < _objects.size(); j++) {
-                        if (_objects[j]->CastsShadows) {
-                            glUniformMatrix4fv(glGetUniformLocation(_depthLinearProgram, "model"), 1, false, glm::value_ptr(_objects[j]->GetModelMatrix()));
-                            _objects[j]->Draw(_depthLinearProgram, _pointLights[i]->GetViewProjection(face), _pointLights[i]->GetFrustum(face));
-                        }
-                    }
+            // The whole cube map is attached as a layered target: one pass per light, and the
+            // geometry shader sends each triangle to the faces it touches
+            ShaderProgram* program = _depthLinearProgram;
+            for (int i = 0; i < _shadowedPointLights.size(); i++) {
+                PointLight3D* light = _shadowedPointLights[i];
+                PointShadowState& state = _frame.pointShadows[i];
+                program->SetVec3(program->uniforms.lightPos, state.position);
+                program->SetFloat(program->uniforms.farPlane, state.farPlane);
+                for (int face = 0; face < CUBE_FACES; face++) {
+                    program->SetMat4(program->uniforms.faceMatrices[face], state.faceViewProjections[face]);
+                }
+                FrameBufferCube live = light->GetShadowBuffer();
+                FrameBufferCube cache = light->GetStaticShadowBuffer();
+                if (PrepareShadowMap(light, _pointPasses[i], live.bufferIndex, live.depthMap, cache.bufferIndex, cache.depthMap, GL_TEXTURE_CUBE_MAP, CUBE_FACES, glm::mat4(1))) {
+                    DrawBatches(_pointPasses[i].dynamicCasters, glm::mat4(1));
                 }
             }
         }
 
+        void RenderForward() {
+            GLState::BindFramebuffer(GL_DRAW_FRAMEBUFFER, _origFB);
+            GLState::Viewport(0, 0, _width, _height);
+            glClear(/*GL_COLOR_BUFFER_BIT |*/ GL_DEPTH_BUFFER_BIT);
+
+            // With the prepass every visible fragment already has its final depth, so shading runs once per pixel
+            bool prepass = _prepass.count > 0;
+            if (prepass) {
+                glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+                DrawBatches(_prepass, _frame.viewProjection);
+                glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+                glDepthFunc(GL_EQUAL);
+                glDepthMask(GL_FALSE);
+            }
+            DrawQueue(_frame.viewProjection);
+            if (prepass) {
+                glDepthFunc(GL_LESS);
+                glDepthMask(GL_TRUE);
+            }
+            DrawBatches(_trianglePass, _frame.viewProjection);
+
+            if (_skybox.IsPresent()) {
+                _skybox.RenderSkybox(_frame.viewProjection);
+            }
+        }
+
+        void RenderDeferred() {
+            _deferredShading.Resize(_width, _height);
+            _deferredShading.BeginGeometry();
+            DrawQueue(_frame.viewProjection);
+
+            _deferredShading.Light(_frame.view, _frame.projection, _clusters.GetNLights(), _frame.spotViewProjections);
+            DrawBatches(_forwardPass, _frame.viewProjection);
+            DrawBatches(_trianglePass, _frame.viewProjection);
+            if (_skybox.IsPresent()) {
+                _skybox.RenderSkybox(_frame.viewProjection);
+            }
+
+            _deferredShading.Present(_origFB);
+        }
+
     public:
         int InitRenderer(GLFWwindow* window, int width, int height) {
             _window = window;
             _width = width;
             _height = height;
 
+            GLState::Reset();
             glClearColor(0, 0, 0, 0);
-            glViewport(0, 0, width, height);
+            GLState::Viewport(0, 0, width, height);
 
             glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &_origFB);
 
-            glGenVertexArrays(1, &_vao);
-            glBindVertexArray(_vao);
-            glEnableVertexAttribArray(0);
-            glEnableVertexAttribArray(1);
-            glEnableVertexAttribArray(2);
-
             glPatchParameteri(GL_PATCH_VERTICES, 4);
-            glEnable(GL_DEPTH_TEST);
-            glEnable(GL_MULTISAMPLE);
-            glEnable(GL_CULL_FACE);
+            GLState::SetEnabled(GL_DEPTH_TEST, true);
+            GLState::SetEnabled(GL_MULTISAMPLE, true);
+            GLState::SetEnabled(GL_CULL_FACE, true);
 
             _shadowedProgram = sg::CreateProgram("shaders/vertexShader_shadowed.glsl", "shaders/fragmentShader_shadowed.glsl");
             _depthProgram = sg::CreateProgram("shaders/vertexShader_depth.glsl", "shaders/fragmentShader_depth.glsl");
-            _depthLinearProgram = sg::CreateProgram("shaders/vertexShader_depth_linear.glsl", "shaders/fragmentShader_depth_linear.glsl");
+            _depthLinearProgram = sg::CreateProgram("shaders/vertexShader_depth_linear.glsl", "shaders/fragmentShader_depth_linear.glsl", "shaders/geometryShader_depth_linear.glsl");
             _unlitProgram = sg::CreateProgram("shaders/vertexShader_unlit.glsl", "shaders/fragmentShader_unlit.glsl");
             _litProgram = sg::CreateProgram("shaders/vertexShader_lit.glsl", "shaders/fragmentShader_lit.glsl");
             _triangulationProgram = sg::CreateProgram("shaders/vertexShader_triangulation.glsl", "shaders/fragmentShader_triangulation.glsl", "shaders/geometryShader_triangulation.glsl");
+            _deferredShading.Init();
+            _lightPrograms = { _shadowedProgram, _litProgram };
+            for (ShaderProgram* program : _deferredShading.GetLightPrograms()) {
+                _lightPrograms.push_back(program);
+            }
+
+            _pipeline.Init(DEFAULT_FRAMES_IN_FLIGHT);
+            _lightBuffer.Init();
+            _clusters.Init();
+            _instances.Init();
+            _copyImage = GLEW_ARB_copy_image || GLEW_VERSION_4_3;
+            _shadowAtlas.Init(SHADOW_ATLAS_SIZE);
+            _jobs.Init();
+            _commands.resize(_jobs.GetNThreads());
+            TextureManager::Instance()->SetJobSystem(&_jobs);
 
             return 0;
         }
@@ -250,10 +964,62 @@ namespace sg {
             _height = y;
         }
 
+        // Program and texture switches of the last frame's main pass, and how many sorting saved
+        RenderQueueStats GetRenderQueueStats() {
+            return _queue.GetStats();
+        }
+
+        // How many frames the CPU may build ahead of the GPU, 1 to MAX_FRAMES_IN_FLIGHT: more hides
+        // stalls better, fewer keeps input latency down
+        void SetFramesInFlight(int frames) {
+            _pipeline.SetDepth(frames);
+        }
+
+        int GetFramesInFlight() {
+            return _pipeline.GetDepth();
+        }
+
+        FrameTimings GetFrameTimings() {
+            return _pipeline.GetTimings();
+        }
+
+        // Bind, state and program changes of the last frame that reached GL, and how many were dropped as redundant
+        GLStateCounters GetGLStateCounters() {
+            return GLState::GetLastFrameCounters();
+        }
+
         void SetShowTriangulation(bool t) {
             _showTriangulation = t;
         }
 
+        // Switches between forward and deferred shading; takes effect from the next frame
+        void SetDeferred(bool deferred) {
+            _deferred = deferred;
+        }
+
+        bool IsDeferred() {
+            return _deferred;
+        }
+
+        // Lays down the main view's depth before shading it; forward mode only, takes effect from the next frame
+        void SetDepthPrepass(bool prepass) {
+            _depthPrepass = prepass;
+        }
+
+        bool HasDepthPrepass() {
+            return _depthPrepass;
+        }
+
+        // Runs each update tick on its own thread, overlapping the GL submission of the previous one;
+        // takes effect from the next frame
+        void SetThreadedSimulation(bool threaded) {
+            _threadedSimulation = threaded;
+        }
+
+        bool HasThreadedSimulation() {
+            return _threadedSimulation;
+        }
+
         GLFWwindow* GetWindow() {
             return _window;
         }
@@ -269,16 +1035,46 @@ namespace sg {
             return _window == NULL || glfwWindowShouldClose(_window);
         }
 
+        // Where the calling thread records structural changes during the update phase; they are applied
+        // once every entity has been updated
+        CommandBuffer* GetCommands() {
+            return &_commands[_jobs.GetThreadIndex()];
+        }
+
+        JobSystem* GetJobSystem() {
+            return &_jobs;
+        }
+
+        // While entities are being updated, adding and removing only records a message in the calling
+        // thread's command buffer; the change happens at the next sync point
         void AddEntity(Entity3D* entity) {
+            if (_updating) {
+                GetCommands()->AddEntity(entity);
+                return;
+            }
             _entities.push_back(entity);
         }
 
         void AddObject(Object3D* obj) {
-            obj->GetModel()->SetVBO(_vao);
+            if (_updating) {
+                GetCommands()->AddObject(obj);
+                return;
+            }
+            // An object whose model is still loading waits in the pending list, updated but not drawn
+            if (!obj->GetModel()->IsLoaded()) {
+                _pendingObjects.push_back(obj);
+                return;
+            }
+            obj->GetModel()->Upload();
+            obj->RefreshMaterials();
             _objects.push_back(obj);
         }
 
         void AddLight(Light* light) {
+            if (_updating) {
+                GetCommands()->AddLight(light);
+                return;
+            }
             switch (light->GetLightType()) {
             case TypeAmbientLight:
                 _ambientLights.push_back(static_cast<AmbientLight*>(light));
@@ -299,6 +1095,10 @@ namespace sg {
         }
 
         void RemoveEntity(Entity3D* ent) {
+            if (_updating) {
+                GetCommands()->RemoveEntity(ent);
+                return;
+            }
             int index = -1;
             for (int i = 0; i < _entities.size(); i++) {
                 if (_entities[i] == ent) {
@@ -312,6 +1112,10 @@ namespace sg {
         }
 
         void RemoveObject(Object3D* obj) {
+            if (_updating) {
+                GetCommands()->RemoveObject(obj);
+                return;
+            }
             int index = -1;
             for (int i = 0; i < _objects.size(); i++) {
                 if (_objects[i] == obj) {
@@ -322,9 +1126,19 @@ namespace sg {
             if (index >= 0) {
                 _objects.erase(std::next(_objects.begin(), index));
             }
+            for (int i = 0; i < _pendingObjects.size(); i++) {
+                if (_pendingObjects[i] == obj) {
+                    _pendingObjects.erase(std::next(_pendingObjects.begin(), i));
+                    break;
+                }
+            }
         }
 
         void RemoveLight(Light* light) {
+            if (_updating) {
+                GetCommands()->RemoveLight(light);
+                return;
+            }
             switch (light->GetLightType()) {
             case TypeAmbientLight:
                 RemoveAmbientLight(static_cast<AmbientLight*>(light));
@@ -350,7 +1164,7 @@ namespace sg {
 
         void SetSkybox(const char* posx, const char* negx, const char* posy, const char* negy, const char* posz, const char* negz) {
             const char* textureFaces[6] = { posx, negx, posy, negy, posz, negz };
-            _skybox.InitSkybox(textureFaces, _vao);
+            _skybox.InitSkybox(textureFaces);
         }
 
         void RemoveAllEntities() {
@@ -358,6 +1172,7 @@ namespace sg {
                 _entities.erase(_entities.begin());
             while (_objects.size() > 0)
                 _objects.erase(_objects.begin());
+            _pendingObjects.clear();
             while (_spotLights.size() > 0)
                 _spotLights.erase(_spotLights.begin());
             while (_pointLights.size() > 0)
@@ -366,53 +1181,56 @@ namespace sg {
                 _directionalLights.erase(_directionalLights.begin());
             while (_ambientLights.size() > 0)
                 _ambientLights.erase(_ambientLights.begin());
+            // Whatever was recorded refers to the entities being dropped
+            for (CommandBuffer& buffer : _commands) {
+                buffer.Clear();
+            }
         }
 
+        // The sync point comes first: the last tick's structural changes are applied and the frame's
+        // state is built from the scene. With the threaded simulation the next tick then runs on its
+        // own thread while this frame is submitted, and is over by the time RenderFrame returns, so
+        // the scene is never touched by two threads outside of it.
         int RenderFrame() {
             double start = sg::getCurrentTimeMillis();
 
-            UpdateOrStart();
+            _updating = true;
+            if (_firstFrame) {
+                StartAll();
+                _firstFrame = false;
+            } else if (!_threadedSimulation) {
+                UpdateAll(_lastDt);
+            }
+            _updating = false;
+            ApplyCommands();
+            UploadPendingAssets();
+            _pipeline.BeginFrame();
             UpdateLights();
+            PrepareBatches();
+            CaptureFrame();
 
-            RenderShadows();
-
-            glBindFramebuffer(GL_DRAW_FRAMEBUFFER, _origFB);
-            glViewport(0, 0, _width, _height);
-            glClear(/*GL_COLOR_BUFFER_BIT |*/ GL_DEPTH_BUFFER_BIT);
-
-            for (int i = 0; i < _objects.size(); i++) {
-                if (_objects[i]->Lit) {
-                    GLuint program = _objects[i]->ReceivesShadows ? _shadowedProgram : _litProgram;
-                    glm::mat4 mv = _mainCamera->GetView() * _objects[i]->GetModelMatrix();
-                    sg::SetMatrix(mv, program, "mv");
-                    sg::SetMatrix(_objects[i]->GetModelMatrix(), program, "modelMat");
-                    sg::SetMatrix(glm::transpose(glm::inverse(glm::mat3(mv))), program, "mvt");
-                    for (int j = 0; j < _spotLights.size(); j++) {
-                        std::string str = std::string("spotShadowMatrices[").append(std::to_string(j)).append("]");
-                        sg::SetMatrix(_spotLights[j]->GetShadow() * _objects[i]->GetModelMatrix(), program, str.c_str());
-                    }
-                    for (int j = 0; j < _directionalLights.size(); j++) {
-                        std::string str = std::string("dirShadowMatrices[").append(std::to_string(j)).append("]");
-                        sg::SetMatrix(_directionalLights[j]->GetShadow() * _objects[i]->GetModelMatrix(), program, str.c_str());
-                    }
-
-                    _objects[i]->Draw(program, _mainCamera->GetViewProjection(), _mainCamera->GetFrustum());
-                } else {
-                    _objects[i]->Draw(_unlitProgram, _mainCamera->GetViewProjection(), _mainCamera->GetFrustum());
-                }
+            if (_threadedSimulation) {
+                double dt = _lastDt;
+                _updating = true;
+                _simulation.Start([this, dt]() { UpdateAll(dt); });
             }
 
-            if (_showTriangulation) {
-                for (int i = 0; i < _objects.size(); i++) {
-                    _objects[i]->Draw(_triangulationProgram, _mainCamera->GetViewProjection(), _mainCamera->GetFrustum());
-                }
+            RenderShadows();
+
+            if (_deferred) {
+                RenderDeferred();
+            } else {
+                RenderForward();
             }
 
-            if (_skybox.IsPresent()) {
-                _skybox.RenderSkybox(_mainCamera);
+            if (_threadedSimulation) {
+                _simulation.Wait();
+                _updating = false;
             }
 
             glfwSwapBuffers(_window);
+            _pipeline.EndFrame();
+            GLState::EndFrame();
 
             double elapsed = (sg::getCurrentTimeMillis() - start) / 1000;
             double sleepTime = glm::max(0.0, (_timestep - elapsed));
@@ -0,0 +1,212 @@
+#pragma once
+
+#include <vector>
+#include <algorithm>
+#include <cfloat>
+#include <glm/glm/glm.hpp>
+#include <sgStructures.h>
+#include <sgFrustumCulling.h>
+
+#define BVH_LEAF_SIZE 4
+#define BVH_MAX_FRUSTUMS 32
+
+namespace sg {
+	// An object that survived culling, with the frustums (cube faces, for layered passes) that see it
+	struct VisibleObject {
+		int object;
+		int faceMask;
+	};
+
+	// Leaves own count items from first; inner nodes have count 0 and their children at first and first + 1
+	struct BVHNode {
+		glm::vec3 min;
+		glm::vec3 max;
+		int first;
+		int count;
+	};
+
+	// Bounding volume hierarchy over the world boxes of a set of scene objects. Members are indices
+	// into the renderer's object list, so the tree survives objects being removed from that list as
+	// long as its own members are unchanged: SetMembers renames them without touching the nodes.
+	// Refit recomputes the boxes bottom-up after the members moved, keeping the topology.
+	class SceneBVH {
+	private:
+		std::vector<BVHNode> _nodes;
+		std::vector<int> _items;	// member slots, in leaf order
+		std::vector<int> _members;	// object index of each slot
+		BoxesSoA _boxes;	// member boxes in leaf order, so a leaf is culled a lane group at a time
+		float _builtArea = 0;
+
+		static float SurfaceArea(const BVHNode& node) {
+			glm::vec3 size = node.max - node.min;
+			return 2 * (size.x * size.y + size.y * size.z + size.z * size.x);
+		}
+
+		void Bound(BVHNode& node, const std::vector<glm::vec3>& mins, const std::vector<glm::vec3>& maxs) {
+			node.min = glm::vec3(FLT_MAX);
+			node.max = glm::vec3(-FLT_MAX);
+			for (int i = node.first; i < node.first + node.count; i++) {
+				int j = _members[_items[i]];
+				node.min = glm::min(node.min, mins[j]);
+				node.max = glm::max(node.max, maxs[j]);
+			}
+		}
+
+		// Splits at the median of the widest axis of the centroids
+		void Split(int nodeIndex, const std::vector<glm::vec3>& mins, const std::vector<glm::vec3>& maxs) {
+			BVHNode node = _nodes[nodeIndex];
+			if (node.count <= BVH_LEAF_SIZE) return;
+
+			glm::vec3 low(FLT_MAX);
+			glm::vec3 high(-FLT_MAX);
+			for (int i = node.first; i < node.first + node.count; i++) {
+				int j = _members[_items[i]];
+				glm::vec3 centroid = (mins[j] + maxs[j]) * 0.5f;
+				low = glm::min(low, centroid);
+				high = glm::max(high, centroid);
+			}
+			glm::vec3 size = high - low;
+			int axis = size.x > size.y ? (size.x > size.z ? 0 : 2) : (size.y > size.z ? 1 : 2);
+			int middle = node.first + node.count / 2;
+			std::nth_element(_items.begin() + node.first, _items.begin() + middle, _items.begin() + node.first + node.count,
+				[this, &mins, &maxs, axis](int a, int b) {
+					return mins[_members[a]][axis] + maxs[_members[a]][axis] < mins[_members[b]][axis] + maxs[_members[b]][axis];
+				});
+
+			int left = (int)_nodes.size();
+			BVHNode leftChild = { glm::vec3(0), glm::vec3(0), node.first, middle - node.first };
+			BVHNode rightChild = { glm::vec3(0), glm::vec3(0), middle, node.first + node.count - middle };
+			Bound(leftChild, mins, maxs);
+			Bound(rightChild, mins, maxs);
+			_nodes.push_back(leftChild);
+			_nodes.push_back(rightChild);
+			_nodes[nodeIndex].first = left;
+			_nodes[nodeIndex].count = 0;
+			Split(left, mins, maxs);
+			Split(left + 1, mins, maxs);
+		}
+
+		void FillBoxes(const std::vector<glm::vec3>& mins, const std::vector<glm::vec3>& maxs) {
+			_boxes.Resize((int)_items.size());
+			for (int i = 0; i < _items.size(); i++) {
+				int j = _members[_items[i]];
+				_boxes.Set(i, mins[j], maxs[j]);
+			}
+		}
+
+		// -1 when the box is outside the frustum, 1 when it is inside every plane, 0 when it straddles one
+		static int Classify(const FrustumPlanes& planes, glm::vec3 min, glm::vec3 max) {
+			glm::vec3 center = (min + max) * 0.5f;
+			glm::vec3 extents = max - center;
+			int result = 1;
+			for (int p = 0; p < 6; p++) {
+				float r = extents.x * planes.ax[p] + extents.y * planes.ay[p] + extents.z * planes.az[p];
+				float d = center.x * planes.nx[p] + center.y * planes.ny[p] + center.z * planes.nz[p] - planes.d[p];
+				if (d < -r) return -1;
+				if (d < r) result = 0;
+			}
+			return result;
+		}
+
+	public:
+		void Build(const std::vector<int>& members, const std::vector<glm::vec3>& mins, const std::vector<glm::vec3>& maxs) {
+			_members = members;
+			_items.resize(members.size());
+			for (int i = 0; i < _items.size(); i++) _items[i] = i;
+			_nodes.clear();
+			_builtArea = 0;
+			if (members.empty()) {
+				_boxes.Resize(0);
+				return;
+			}
+
+			BVHNode root = { glm::vec3(0), glm::vec3(0), 0, (int)members.size() };
+			Bound(root, mins, maxs);
+			_nodes.push_back(root);
+			Split(0, mins, maxs);
+			_builtArea = SurfaceArea(_nodes[0]);
+			FillBoxes(mins, maxs);
+		}
+
+		// Children always come after their parent, so a backwards sweep visits them first
+		void Refit(const std::vector<glm::vec3>& mins, const std::vector<glm::vec3>& maxs) {
+			FillBoxes(mins, maxs);
+			for (int n = (int)_nodes.size() - 1; n >= 0; n--) {
+				BVHNode& node = _nodes[n];
+				if (node.count > 0) {
+					Bound(node, mins, maxs);
+				} else {
+					node.min = glm::min(_nodes[node.first].min, _nodes[node.first + 1].min);
+					node.max = glm::max(_nodes[node.first].max, _nodes[node.first + 1].max);
+				}
+			}
+		}
+
+		// Refitting keeps the topology, which degrades as members drift apart; once the root has
+		// grown well past its size at build time a rebuild is cheaper than the loose queries
+		bool IsDegraded() {
+			return !_nodes.empty() && SurfaceArea(_nodes[0]) > 2 * _builtArea + 1;
+		}
+
+		// Members are in the same order as the list the tree was built from
+		void SetMembers(const std::vector<int>& members) {
+			_members = members;
+		}
+
+		int GetNMembers() {
+			return (int)_members.size();
+		}
+
+		int GetMember(int slot) {
+			return _members[slot];
+		}
+
+		// Appends the members seen by any of the frustums, at most BVH_MAX_FRUSTUMS, as object indices
+		// or, with slots set, as member slots that stay valid across SetMembers. A frustum that
+		// contains a node whole is not tested again below it, and one that misses it is dropped for
+		// the whole subtree; the leaves test their boxes CULL_LANES at a time.
+		void Query(const Frustum* frustums, int nFrustums, std::vector<VisibleObject>& visible, bool slots = false) {
+			if (_nodes.empty()) return;
+			FrustumPlanes planes[BVH_MAX_FRUSTUMS];
+			for (int f = 0; f < nFrustums; f++) {
+				planes[f] = FrustumPlanes(frustums[f]);
+			}
+			struct Entry { int node; int partial; int inside; };
+			Entry stack[64];
+			int top = 0;
+			stack[top++] = { 0, (int)((1ull << nFrustums) - 1), 0 };
+			while (top > 0) {
+				Entry entry = stack[--top];
+				BVHNode& node = _nodes[entry.node];
+				int partial = 0;
+				for (int f = 0; f < nFrustums; f++) {
+					if (!(entry.partial & (1 << f))) continue;
+					int c = Classify(planes[f], node.min, node.max);
+					if (c > 0) entry.inside |= 1 << f;
+					else if (c == 0) partial |= 1 << f;
+				}
+				if ((partial | entry.inside) == 0) continue;
+
+				if (node.count == 0) {
+					stack[top++] = { node.first, partial, entry.inside };
+					stack[top++] = { node.first + 1, partial, entry.inside };
+					continue;
+				}
+				for (int group = node.first; group < node.first + node.count; group += CULL_LANES) {
+					int lanes[BVH_MAX_FRUSTUMS];
+					for (int f = 0; f < nFrustums; f++) {
+						lanes[f] = (partial & (1 << f)) ? _boxes.Cull(planes[f], group) : 0;
+					}
+					int end = glm::min(group + CULL_LANES, node.first + node.count);
+					for (int i = group; i < end; i++) {
+						int mask = entry.inside;
+						for (int f = 0; f < nFrustums; f++) {
+							if (lanes[f] & (1 << (i - group))) mask |= 1 << f;
+						}
+						if (mask != 0) visible.push_back(VisibleObject{ slots ? _items[i] : _members[_items[i]], mask });
+					}
+				}
+			}
+		}
+	};
+}
\ No newline at end of file
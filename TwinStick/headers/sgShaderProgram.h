@@ -0,0 +1,239 @@
+#pragma once
+
+#include <GL/glew.h>
+#include <glm/glm/glm.hpp>
+#include <glm/glm/gtc/type_ptr.hpp>
+#include <unordered_map>
+#include <string>
+#include <vector>
+#include <cstring>
+#include <sgGLState.h>
+
+#define MAX_LIGHTS 5
+#define LIGHTS_BLOCK_BINDING 0
+#define CUBE_FACES 6
+
+namespace sg {
+	typedef int UniformHandle;
+
+	struct UniformSlot {
+		GLint location;
+		GLenum type;
+		bool cached;
+		unsigned char cache[sizeof(glm::mat4)];
+	};
+
+	struct MaterialUniforms {
+		UniformHandle Kd;
+		UniformHandle Ks;
+		UniformHandle Ns;
+		UniformHandle d;
+		UniformHandle dTexture;
+		UniformHandle dTextureSet;
+		UniformHandle sTexture;
+		UniformHandle sTextureSet;
+	};
+
+	struct DeferredUniforms {
+		UniformHandle gAlbedo;
+		UniformHandle gSpecular;
+		UniformHandle gNormal;
+		UniformHandle gDepth;
+		UniformHandle accumulation;
+		UniformHandle inverseProjection;
+		UniformHandle inverseView;
+		UniformHandle screenSize;
+		UniformHandle volumeMatrix;
+		UniformHandle pointVolumes;
+		UniformHandle spotIndex;
+		UniformHandle receivesShadows;
+	};
+
+	// Handles of the uniforms shared by the engine shaders, resolved once at link time.
+	// A handle is -1 when the program does not use that uniform, and setters ignore it.
+	struct ProgramUniforms {
+		UniformHandle vp;
+		UniformHandle lightPos;
+		UniformHandle farPlane;
+		UniformHandle shadowAtlas;
+		UniformHandle faceMask;
+		UniformHandle clusterLights;
+		UniformHandle clusterRanges;
+		UniformHandle clusterIndices;
+		UniformHandle clusterScale;
+		UniformHandle clusterBias;
+		UniformHandle clusterTileSize;
+		UniformHandle faceMatrices[CUBE_FACES];
+		UniformHandle spotShadowMatrices[MAX_LIGHTS];
+		UniformHandle dirShadowMatrices[MAX_LIGHTS];
+		UniformHandle spotMapTextures[MAX_LIGHTS];
+		UniformHandle pointShadowTextures[MAX_LIGHTS];
+		MaterialUniforms material;
+		DeferredUniforms deferred;
+	};
+
+	class ShaderProgram {
+	private:
+		GLuint _id;
+		std::vector<UniformSlot> _slots;
+		std::unordered_map<std::string, UniformHandle> _handles;
+
+		void AddUniform(const std::string& name, GLenum type) {
+			GLint location = glGetUniformLocation(_id, name.c_str());
+			if (location < 0) return;	// uniform block members have no location
+			UniformSlot slot = UniformSlot();
+			slot.location = location;
+			slot.type = type;
+			slot.cached = false;
+			_handles[name] = (UniformHandle)_slots.size();
+			_slots.push_back(slot);
+		}
+
+		void ReflectUniforms() {
+			GLint count = 0;
+			GLint maxLength = 0;
+			glGetProgramiv(_id, GL_ACTIVE_UNIFORMS, &count);
+			glGetProgramiv(_id, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxLength);
+			std::vector<char> nameBuffer(maxLength + 1);
+
+			for (GLint i = 0; i < count; i++) {
+				GLint size = 0;
+				GLenum type = 0;
+				GLsizei length = 0;
+				glGetActiveUniform(_id, i, maxLength + 1, &length, &size, &type, nameBuffer.data());
+				std::string name(nameBuffer.data(), length);
+
+				// Arrays of basic types are reported once as "name[0]": give every element its own slot
+				if (size > 1 && name.size() > 3 && name.compare(name.size() - 3, 3, "[0]") == 0) {
+					std::string base = name.substr(0, name.size() - 3);
+					for (int e = 0; e < size; e++) {
+						AddUniform(base + "[" + std::to_string(e) + "]", type);
+					}
+					if (_handles.count(name)) _handles[base] = _handles[name];
+				} else {
+					AddUniform(name, type);
+				}
+			}
+		}
+
+		// Programs that declare the shared light block read it from the renderer's light buffer
+		void BindUniformBlocks() {
+			GLuint lightsIndex = glGetUniformBlockIndex(_id, "Lights");
+			if (lightsIndex != GL_INVALID_INDEX) glUniformBlockBinding(_id, lightsIndex, LIGHTS_BLOCK_BINDING);
+		}
+
+		void ResolveHandles() {
+			uniforms.vp = GetHandle("vp");
+			uniforms.lightPos = GetHandle("lightPos");
+			uniforms.farPlane = GetHandle("far_plane");
+			uniforms.shadowAtlas = GetHandle("shadowAtlas");
+			uniforms.faceMask = GetHandle("faceMask");
+			uniforms.clusterLights = GetHandle("clusterLights");
+			uniforms.clusterRanges = GetHandle("clusterRanges");
+			uniforms.clusterIndices = GetHandle("clusterIndices");
+			uniforms.clusterScale = GetHandle("clusterScale");
+			uniforms.clusterBias = GetHandle("clusterBias");
+			uniforms.clusterTileSize = GetHandle("clusterTileSize");
+			for (int i = 0; i < CUBE_FACES; i++) {
+				uniforms.faceMatrices[i] = GetHandle("faceMatrices", i);
+			}
+
+			for (int i = 0; i < MAX_LIGHTS; i++) {
+				uniforms.spotShadowMatrices[i] = GetHandle("spotShadowMatrices", i);
+				uniforms.dirShadowMatrices[i] = GetHandle("dirShadowMatrices", i);
+				uniforms.spotMapTextures[i] = GetHandle("spotMapTextures", i);
+				uniforms.pointShadowTextures[i] = GetHandle("pointShadowTextures", i);
+			}
+
+			uniforms.material.Kd = GetHandle("material.Kd");
+			uniforms.material.Ks = GetHandle("material.Ks");
+			uniforms.material.Ns = GetHandle("material.Ns");
+			uniforms.material.d = GetHandle("material.d");
+			uniforms.material.dTexture = GetHandle("material.dTexture");
+			uniforms.material.dTextureSet = GetHandle("material.dTextureSet");
+			uniforms.material.sTexture = GetHandle("material.sTexture");
+			uniforms.material.sTextureSet = GetHandle("material.sTextureSet");
+
+			uniforms.deferred.gAlbedo = GetHandle("gAlbedo");
+			uniforms.deferred.gSpecular = GetHandle("gSpecular");
+			uniforms.deferred.gNormal = GetHandle("gNormal");
+			uniforms.deferred.gDepth = GetHandle("gDepth");
+			uniforms.deferred.accumulation = GetHandle("accumulation");
+			uniforms.deferred.inverseProjection = GetHandle("inverseProjection");
+			uniforms.deferred.inverseView = GetHandle("inverseView");
+			uniforms.deferred.screenSize = GetHandle("screenSize");
+			uniforms.deferred.volumeMatrix = GetHandle("volumeMatrix");
+			uniforms.deferred.pointVolumes = GetHandle("pointVolumes");
+			uniforms.deferred.spotIndex = GetHandle("spotIndex");
+			uniforms.deferred.receivesShadows = GetHandle("receivesShadows");
+		}
+
+		// Returns false when the slot already holds the value, so the upload can be skipped
+		bool UpdateCache(UniformHandle handle, const void* data, size_t size) {
+			if (handle < 0) return false;
+			UniformSlot& slot = _slots[handle];
+			if (slot.cached && memcmp(slot.cache, data, size) == 0) return false;
+			memcpy(slot.cache, data, size);
+			slot.cached = true;
+			Use();
+			return true;
+		}
+
+	public:
+		ProgramUniforms uniforms;
+
+		ShaderProgram(GLuint id) {
+			_id = id;
+			ReflectUniforms();
+			ResolveHandles();
+			BindUniformBlocks();
+		}
+
+		GLuint GetId() {
+			return _id;
+		}
+
+		void Use() {
+			GLState::UseProgram(_id);
+		}
+
+		UniformHandle GetHandle(const char* name) {
+			auto it = _handles.find(name);
+			if (it == _handles.end()) return -1;
+			return it->second;
+		}
+
+		UniformHandle GetHandle(const char* arrayName, int index) {
+			std::string name = std::string(arrayName).append("[").append(std::to_string(index)).append("]");
+			return GetHandle(name.c_str());
+		}
+
+		void SetInt(UniformHandle handle, int value) {
+			if (UpdateCache(handle, &value, sizeof(int))) glUniform1i(_slots[handle].location, value);
+		}
+
+		void SetFloat(UniformHandle handle, float value) {
+			if (UpdateCache(handle, &value, sizeof(float))) glUniform1f(_slots[handle].location, value);
+		}
+
+		void SetVec2(UniformHandle handle, glm::vec2 value) {
+			if (UpdateCache(handle, glm::value_ptr(value), sizeof(glm::vec2))) glUniform2fv(_slots[handle].location, 1, glm::value_ptr(value));
+		}
+
+		void SetVec3(UniformHandle handle, glm::vec3 value) {
+			if (UpdateCache(handle, glm::value_ptr(value), sizeof(glm::vec3))) glUniform3fv(_slots[handle].location, 1, glm::value_ptr(value));
+		}
+
+		void SetMat3(UniformHandle handle, glm::mat3 value) {
+			if (UpdateCache(handle, glm::value_ptr(value), sizeof(glm::mat3))) glUniformMatrix3fv(_slots[handle].location, 1, false, glm::value_ptr(value));
+		}
+
+		void SetMat4(UniformHandle handle, glm::mat4 value) {
+			if (UpdateCache(handle, glm::value_ptr(value), sizeof(glm::mat4))) glUniformMatrix4fv(_slots[handle].location, 1, false, glm::value_ptr(value));
+		}
+
+		~ShaderProgram() {
+			GLState::DeleteProgram(_id);
+		}
+	};
+}
\ No newline at end of file
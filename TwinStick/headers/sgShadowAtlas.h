@@ -0,0 +1,103 @@
+#pragma once
+
+#include <vector>
+#include <algorithm>
+#include <sgStructures.h>
+
+#define SHADOW_ATLAS_SIZE 4096
+#define SHADOW_ATLAS_MIN_TILE 128
+
+namespace sg {
+	// One depth texture shared by every spot and directional light. Each light gets a square
+	// power-of-two tile; a second texture with the same layout caches the static casters.
+	class ShadowAtlas {
+	private:
+		int _size = 0;
+		FrameBuffer* _live = NULL;
+		FrameBuffer* _static = NULL;
+		std::vector<int> _requested;
+		std::vector<AtlasTile> _tiles;
+
+		// Takes the smallest free square that fits and splits it into quadrants down to the tile size
+		static bool Place(std::vector<AtlasTile>& free, int size, AtlasTile& tile) {
+			int best = -1;
+			for (int i = 0; i < free.size(); i++) {
+				if (free[i].size >= size && (best < 0 || free[i].size < free[best].size)) best = i;
+			}
+			if (best < 0) return false;
+
+			AtlasTile square = free[best];
+			free.erase(free.begin() + best);
+			while (square.size > size) {
+				int half = square.size / 2;
+				free.push_back(AtlasTile{ square.x + half, square.y, half });
+				free.push_back(AtlasTile{ square.x, square.y + half, half });
+				free.push_back(AtlasTile{ square.x + half, square.y + half, half });
+				square.size = half;
+			}
+			tile = square;
+			return true;
+		}
+
+		static int NextPowerOfTwo(int value) {
+			int p = 1;
+			while (p < value) p *= 2;
+			return p;
+		}
+
+	public:
+		void Init(int size) {
+			_size = size;
+			_live = new FrameBuffer(size, size, false, true, false, false);
+			_static = new FrameBuffer(size, size, false, true, false, false);
+		}
+
+		// Packs one tile per requested size, largest first. A request that does not fit is halved
+		// until it does, down to SHADOW_ATLAS_MIN_TILE; a request of 0 gets no tile.
+		// Returns false when the requests, and so the layout, are the same as last time.
+		bool Pack(const std::vector<int>& requested) {
+			if (requested == _requested) return false;
+			_requested = requested;
+			_tiles.assign(requested.size(), AtlasTile{ 0, 0, 0 });
+
+			std::vector<int> order(requested.size());
+			for (int i = 0; i < order.size(); i++) order[i] = i;
+			std::stable_sort(order.begin(), order.end(), [&requested](int a, int b) { return requested[a] > requested[b]; });
+
+			std::vector<AtlasTile> free = { AtlasTile{ 0, 0, _size } };
+			for (int i : order) {
+				if (requested[i] <= 0) continue;
+				int size = glm::min(NextPowerOfTwo(requested[i]), _size);
+				while (size >= SHADOW_ATLAS_MIN_TILE && !Place(free, size, _tiles[i])) size /= 2;
+			}
+			return true;
+		}
+
+		AtlasTile GetTile(int index) {
+			return _tiles[index];
+		}
+
+		int GetSize() {
+			return _size;
+		}
+
+		FrameBuffer GetLiveBuffer() {
+			return *_live;
+		}
+
+		FrameBuffer GetStaticBuffer() {
+			return *_static;
+		}
+
+		void Destroy() {
+			if (_live != NULL) {
+				_live->FreeTextures();
+				delete(_live);
+				_static->FreeTextures();
+				delete(_static);
+				_live = NULL;
+				_static = NULL;
+			}
+		}
+	};
+}
\ No newline at end of file
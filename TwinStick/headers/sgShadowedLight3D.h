@@ -7,6 +7,10 @@ namespace sg {
 	private:
 		int _shadowWidth;
 		int _shadowHeight;
+		bool _staticCacheValid = false;
+		glm::mat4 _staticCacheViewProjection;
+		int _staticCacheVersion = 0;
+		bool _liveMapIsStaticCopy = false;
 
 	protected:
 		void SetShadowWidth(int width) {
@@ -25,5 +29,30 @@ namespace sg {
 		int GetShadowHeight() const {
 			return _shadowHeight;
 		}
+
+		// The depth of the static casters is kept in a second map that is only redrawn when the
+		// light's view changes or the renderer's static caster version moves on
+		bool IsStaticCacheValid(glm::mat4 viewProjection, int staticVersion) const {
+			return _staticCacheValid && _staticCacheVersion == staticVersion && _staticCacheViewProjection == viewProjection;
+		}
+
+		void SetStaticCacheValid(glm::mat4 viewProjection, int staticVersion) {
+			_staticCacheValid = true;
+			_staticCacheViewProjection = viewProjection;
+			_staticCacheVersion = staticVersion;
+		}
+
+		void InvalidateStaticCache() {
+			_staticCacheValid = false;
+		}
+
+		// True while the map used for lighting holds nothing but the static cache
+		bool IsLiveMapStaticCopy() const {
+			return _liveMapIsStaticCopy;
+		}
+
+		void SetLiveMapStaticCopy(bool staticCopy) {
+			_liveMapIsStaticCopy = staticCopy;
+		}
 	};
 }
\ No newline at end of file
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+
+namespace sg {
+	// Thread that runs one simulation tick at a time, on request, so that the next tick overlaps the
+	// GL submission of the current frame. Start hands it a tick and returns; Wait blocks until it is over.
+	class SimulationThread {
+	private:
+		std::thread _thread;
+		std::mutex _mutex;
+		std::condition_variable _changed;
+		std::function<void()> _tick;
+		bool _pending = false;
+		bool _running = false;
+
+		void Loop() {
+			std::unique_lock<std::mutex> lock(_mutex);
+			while (true) {
+				_changed.wait(lock, [this]() { return _pending || !_running; });
+				if (!_pending) return;
+				lock.unlock();
+				_tick();
+				lock.lock();
+				_pending = false;
+				_changed.notify_all();
+			}
+		}
+
+	public:
+		// The thread is started by the first tick
+		void Start(const std::function<void()>& tick) {
+			std::lock_guard<std::mutex> lock(_mutex);
+			if (!_running) {
+				_running = true;
+				_thread = std::thread(&SimulationThread::Loop, this);
+			}
+			_tick = tick;
+			_pending = true;
+			_changed.notify_all();
+		}
+
+		void Wait() {
+			std::unique_lock<std::mutex> lock(_mutex);
+			_changed.wait(lock, [this]() { return !_pending; });
+		}
+
+		void Destroy() {
+			{
+				std::lock_guard<std::mutex> lock(_mutex);
+				if (!_running) return;
+				_running = false;
+				_changed.notify_all();
+			}
+			_thread.join();
+		}
+
+		~SimulationThread() {
+			Destroy();
+		}
+	};
+}
\ No newline at end of file
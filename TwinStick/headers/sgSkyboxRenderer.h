@@ -4,16 +4,24 @@
 namespace sg {
     class SkyboxRenderer {
     private:
-        GLuint _backgroundProgram;
+        ShaderProgram* _backgroundProgram;
+        UniformHandle _skyboxHandle;
+        UniformHandle _skyboxSetHandle;
+        UniformHandle _toWorldHandle;
         GLuint _skyboxTexture = -1;
         Vertex _backgroundVertices[3];
         Triangle _backgroundTriangles[1];
-        GLuint _backgroundVBO = -1;
+        GLuint _backgroundVAO = 0;
+        GLuint _backgroundVBO = 0;
+        GLuint _backgroundEBO = 0;
         bool _isPresent = false;
 
     public:
-        void InitSkybox(const char* textureFaces[6], GLuint vao) {
+        void InitSkybox(const char* textureFaces[6]) {
             _backgroundProgram = sg::CreateProgram("shaders/vertexShader_background.glsl", "shaders/fragmentShader_background.glsl");
+            _skyboxHandle = _backgroundProgram->GetHandle("skybox");
+            _skyboxSetHandle = _backgroundProgram->GetHandle("skyboxSet");
+            _toWorldHandle = _backgroundProgram->GetHandle("toWorld");
 
             _skyboxTexture = TextureManager::Instance()->SetCubemap(textureFaces);
 
@@ -22,10 +30,17 @@ namespace sg {
             _backgroundVertices[2] = sg::Vertex{ glm::vec3(3, -1, 1 - 1e-5), glm::vec2(1, 0), glm::vec3(0,0,1) };
             _backgroundTriangles[0] = sg::Triangle{ {0,2,1} };
 
-            glBindVertexArray(vao);
-            glGenBuffers(1, &_backgroundVBO);
-            glBindBuffer(GL_ARRAY_BUFFER, _backgroundVBO);
-            glBufferData(GL_ARRAY_BUFFER, sizeof(sg::Vertex) * 3, _backgroundVertices, GL_STATIC_DRAW);
+            glGenVertexArrays(1, &_backgroundVAO);
+            GLState::BindVertexArray(_backgroundVAO);
+            _backgroundVBO = GLState::CreateBuffer();
+            GLState::BufferData(GL_ARRAY_BUFFER, _backgroundVBO, sizeof(sg::Vertex) * 3, _backgroundVertices, GL_STATIC_DRAW);
+            GLState::BindBuffer(GL_ARRAY_BUFFER, _backgroundVBO);
+            glEnableVertexAttribArray(0);
+            glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(sg::Vertex), (GLvoid*)0);
+            glGenBuffers(1, &_backgroundEBO);
+            glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, _backgroundEBO);
+            glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(sg::Triangle), _backgroundTriangles, GL_STATIC_DRAW);
+            GLState::BindVertexArray(0);
 
             _isPresent = true;
         }
@@ -34,18 +49,16 @@ namespace sg {
             return _isPresent;
         }
 
-        void RenderSkybox(Camera3D* camera) {
-            glUseProgram(_backgroundProgram);
-            glActiveTexture(GL_TEXTURE0);
-            glBindTexture(GL_TEXTURE_CUBE_MAP, _skyboxTexture);
-            glUniform1i(glGetUniformLocation(_backgroundProgram, "skybox"), 0);
-            glUniform1i(glGetUniformLocation(_backgroundProgram, "skyboxSet"), 1);
+        void RenderSkybox(glm::mat4 viewProjection) {
+            _backgroundProgram->Use();
+            GLState::BindTexture(0, GL_TEXTURE_CUBE_MAP, _skyboxTexture);
+            _backgroundProgram->SetInt(_skyboxHandle, 0);
+            _backgroundProgram->SetInt(_skyboxSetHandle, 1);
 
-            glm::mat3 matrixPV = glm::inverse(glm::mat3(camera->GetViewProjection()));
-            glUniformMatrix3fv(glGetUniformLocation(_backgroundProgram, "toWorld"), 1, false, glm::value_ptr(matrixPV));
-            glBindBuffer(GL_ARRAY_BUFFER, _backgroundVBO);
-            glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(sg::Vertex), (GLvoid*)0);
-            glDrawElements(GL_TRIANGLES, 3, GL_UNSIGNED_INT, _backgroundTriangles);
+            glm::mat3 matrixPV = glm::inverse(glm::mat3(viewProjection));
+            _backgroundProgram->SetMat3(_toWorldHandle, matrixPV);
+            GLState::BindVertexArray(_backgroundVAO);
+            glDrawElements(GL_TRIANGLES, 3, GL_UNSIGNED_INT, (GLvoid*)0);
         }
     };
 }
\ No newline at end of file
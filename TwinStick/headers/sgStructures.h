@@ -2,6 +2,9 @@
 
 #include <GL/glew.h>
 #include <glm/glm/glm.hpp>
+#include <sgGLState.h>
+
+#define FRAMEBUFFER_MAX_ATTACHMENTS 4
 
 namespace sg {
 
@@ -15,18 +18,19 @@ namespace sg {
 		GLuint depthBuffer = 0;
 		bool isRectangle = false;
 		bool isValid = false;
+		int nColorAttachments = 0;
+		GLuint colorAttachments[FRAMEBUFFER_MAX_ATTACHMENTS] = {};
 
 		sg::FrameBuffer(float width, float height, bool createTexture = true, bool createDepthMap = false, bool createDepthBuffer = true, bool rectangleTexture = false) {
 			isRectangle = rectangleTexture;
 			glGenFramebuffers(1, &bufferIndex);
-			glBindFramebuffer(GL_FRAMEBUFFER, bufferIndex);
+			GLState::BindFramebuffer(GL_FRAMEBUFFER, bufferIndex);
 
 			if (createTexture) {
 				hasTexture = true;
 				glGenTextures(1, &renderTexture);
-				glActiveTexture(GL_TEXTURE0);
 				GLuint textureType = rectangleTexture ? GL_TEXTURE_RECTANGLE : GL_TEXTURE_2D;
-				glBindTexture(textureType, renderTexture);
+				GLState::BindTextureForEdit(textureType, renderTexture);
 				glTexImage2D(textureType, 0, GL_RGBA, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, 0);
 				glTexParameteri(textureType, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
 				glTexParameteri(textureType, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
@@ -37,9 +41,8 @@ namespace sg {
 			if (createDepthMap) {
 				hasDepthMap = true;
 				glGenTextures(1, &depthMap);
-				glActiveTexture(GL_TEXTURE0);
 				GLuint textureType = rectangleTexture ? GL_TEXTURE_RECTANGLE : GL_TEXTURE_2D;
-				glBindTexture(textureType, depthMap);
+				GLState::BindTextureForEdit(textureType, depthMap);
 				glTexImage2D(textureType, 0, GL_DEPTH_COMPONENT32F, width, height, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
 				glTexParameteri(textureType, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
 				glTexParameteri(textureType, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
@@ -73,17 +76,56 @@ namespace sg {
 			this->isValid = (glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE);
 		}
 
+		// Adds a render target after the ones already there; fragment output n goes to the n-th target
+		void AddColorAttachment(float width, float height, GLenum internalFormat, GLenum format, GLenum type) {
+			if (nColorAttachments == FRAMEBUFFER_MAX_ATTACHMENTS) {
+				printf("Error: framebuffer already has %d color attachments\n", FRAMEBUFFER_MAX_ATTACHMENTS);
+				return;
+			}
+			GLuint texture;
+			glGenTextures(1, &texture);
+			GLState::BindTextureForEdit(GL_TEXTURE_2D, texture);
+			glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, width, height, 0, format, type, NULL);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+			int first = hasTexture ? 1 : 0;
+			GLState::BindFramebuffer(GL_FRAMEBUFFER, bufferIndex);
+			glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0 + first + nColorAttachments, GL_TEXTURE_2D, texture, 0);
+			colorAttachments[nColorAttachments++] = texture;
+
+			GLenum drawBuffers[FRAMEBUFFER_MAX_ATTACHMENTS + 1];
+			for (int i = 0; i < first + nColorAttachments; i++) drawBuffers[i] = GL_COLOR_ATTACHMENT0 + i;
+			glDrawBuffers(first + nColorAttachments, drawBuffers);
+			glReadBuffer(GL_COLOR_ATTACHMENT0);
+
+			this->isValid = (glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE);
+		}
+
+		// Attaches a depth texture owned by another framebuffer, so both test against the same depth
+		void AttachDepthMap(GLuint texture) {
+			GLState::BindFramebuffer(GL_FRAMEBUFFER, bufferIndex);
+			glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, texture, 0);
+			this->isValid = (glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE);
+		}
+
 		void FreeTextures() {
 			if (hasTexture) {
-				glDeleteTextures(1, &renderTexture);
+				GLState::DeleteTexture(renderTexture);
 				hasTexture = false;
 			}
+			for (int i = 0; i < nColorAttachments; i++) {
+				GLState::DeleteTexture(colorAttachments[i]);
+			}
+			nColorAttachments = 0;
 			if (hasDepthMap) {
-				glDeleteTextures(1, &depthMap);
+				GLState::DeleteTexture(depthMap);
 				hasDepthMap = false;
 			}
 			if (hasDepth) {
-				glDeleteTextures(1, &depthBuffer);
+				glDeleteRenderbuffers(1, &depthBuffer);
 				hasDepth = false;
 			}
 		}
@@ -101,13 +143,12 @@ namespace sg {
 
 		sg::FrameBufferCube(float res, bool createTexture = true, bool createDepthMap = false, bool createDepthBuffer = true) {
 			glGenFramebuffers(1, &bufferIndex);
-			glBindFramebuffer(GL_FRAMEBUFFER, bufferIndex);
+			GLState::BindFramebuffer(GL_FRAMEBUFFER, bufferIndex);
 
 			if (createTexture) {
 				hasTexture = true;
 				glGenTextures(1, &renderTexture);
-				glActiveTexture(GL_TEXTURE0);
-				glBindTexture(GL_TEXTURE_CUBE_MAP, renderTexture);
+				GLState::BindTextureForEdit(GL_TEXTURE_CUBE_MAP, renderTexture);
 				for (int i = 0; i < 6; i++) {
 					glTexImage2D( GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, GL_RGBA, res, res, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
 				}
@@ -124,8 +165,7 @@ namespace sg {
 			if (createDepthMap) {
 				hasDepthMap = true;
 				glGenTextures(1, &depthMap);
-				glActiveTexture(GL_TEXTURE0);
-				glBindTexture(GL_TEXTURE_CUBE_MAP, depthMap);
+				GLState::BindTextureForEdit(GL_TEXTURE_CUBE_MAP, depthMap);
 				for (int i = 0; i < 6; i++) {
 					glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, GL_DEPTH_COMPONENT32F, res, res, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
 				}
@@ -138,9 +178,7 @@ namespace sg {
 				glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
 				glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_BASE_LEVEL, 0);
 				glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAX_LEVEL, 0);
-				for (int i = 0; i < 6; i++) {
-					glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, depthMap, 0);
-				}
+				glFramebufferTexture(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, depthMap, 0);
 			}
 			if (createDepthBuffer) {
 				hasDepth = true;
@@ -165,15 +203,15 @@ namespace sg {
 
 		void FreeTextures() {
 			if (hasTexture) {
-				glDeleteTextures(1, &renderTexture);
+				GLState::DeleteTexture(renderTexture);
 				hasTexture = false;
 			}
 			if (hasDepthMap) {
-				glDeleteTextures(1, &depthMap);
+				GLState::DeleteTexture(depthMap);
 				hasDepthMap = false;
 			}
 			if (hasDepth) {
-				glDeleteTextures(1, &depthBuffer);
+				glDeleteRenderbuffers(1, &depthBuffer);
 				hasDepth = false;
 			}
 		}
@@ -185,10 +223,41 @@ namespace sg {
 		glm::vec3 normal;
 	};
 
+	// Vertex as uploaded for packed models, 16 bytes instead of 32: the position quantized to
+	// 16 bits per axis inside the model's bounding box, the normal as signed 10:10:10 and the
+	// texture coordinates as half floats
+	struct PackedVertex {
+		unsigned short coord[4];	// the fourth component only pads the normal to 4 bytes
+		unsigned int normal;
+		unsigned int texture;
+	};
+
 	struct Triangle {
 		unsigned int index[3];
 	};
 
+	#define INSTANCE_MODEL_LOCATION 3
+	#define INSTANCE_NORMAL_LOCATION 7
+	#define INSTANCE_LIGHT_MASK_LOCATION 10
+
+	// Per-instance attributes read by the vertex shaders at the locations above
+	struct InstanceData {
+		glm::mat4 model;
+		glm::mat3 normal;
+		int lightMask;	// spot lights that can reach the instance, one bit per light
+	};
+
+	// A square region of the shadow atlas, in texels; size 0 means the light has no tile
+	struct AtlasTile {
+		int x;
+		int y;
+		int size;
+
+		bool operator==(const AtlasTile& other) const {
+			return x == other.x && y == other.y && size == other.size;
+		}
+	};
+
 	struct Texture {
 		char* map;
 		bool isPresent;
@@ -274,12 +343,20 @@ namespace sg {
 		}
 	};
 
+	#define MESH_MAX_LODS 4
+
 	struct Mesh {
 		char* name;
 		bool hasMaterial;
 		char* materialName;
 		sg::Triangle *triangles;
 		int nTriangles;
+		size_t indexOffset;
+		// Simplified levels after the full one; a mesh with fewer levels than its model repeats its last
+		int nLods;
+		sg::Triangle* lodTriangles[MESH_MAX_LODS - 1];
+		int lodNTriangles[MESH_MAX_LODS - 1];
+		size_t lodIndexOffsets[MESH_MAX_LODS - 1];
 
 		sg::Mesh() {
 			name = NULL;
@@ -287,6 +364,8 @@ namespace sg {
 			materialName = NULL;
 			triangles = NULL;
 			nTriangles = 0;
+			indexOffset = 0;
+			nLods = 0;
 		}
 
 		sg::Mesh(char* n, char* matName, sg::Triangle* tris, int nTris) {
@@ -295,6 +374,18 @@ namespace sg {
 			materialName = matName;
 			triangles = tris;
 			nTriangles = nTris;
+			indexOffset = 0;
+			nLods = 0;
+		}
+
+		int GetNTriangles(int lod) {
+			lod = glm::min(lod, nLods);
+			return lod == 0 ? nTriangles : lodNTriangles[lod - 1];
+		}
+
+		size_t GetIndexOffset(int lod) {
+			lod = glm::min(lod, nLods);
+			return lod == 0 ? indexOffset : lodIndexOffsets[lod - 1];
 		}
 	};
 
@@ -1,14 +1,29 @@
 #pragma once
 #include <sgStructures.h>
+#include <sgShaderProgram.h>
 #define STB_IMAGE_IMPLEMENTATION
 #include <stb_image.h>
+#include <sgJobSystem.h>
+#include <mutex>
+#include <string>
 
 namespace sg {
+    // An image decoded on a job thread, waiting for the main thread to upload it over its placeholder
+    struct DecodedTexture {
+        GLuint texture;
+        int width, height;
+        unsigned char* data;
+        std::string name;
+    };
+
     class TextureManager {
     private:
         static TextureManager _instance;
         static bool _initialized;
+        static std::mutex _decodedMutex;
         std::vector<Texture> _loadedTextures;
+        std::vector<DecodedTexture> _decoded;
+        JobSystem* _jobs = NULL;
 
         TextureManager() {
             
@@ -39,8 +54,7 @@ namespace sg {
         }
 
         void BindTexture(GLuint texture, int width, int height, unsigned char* data) {
-            glActiveTexture(GL_TEXTURE0);
-            glBindTexture(GL_TEXTURE_2D, texture);
+            GLState::BindTextureForEdit(GL_TEXTURE_2D, texture);
             glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, data);
             glGenerateMipmap(GL_TEXTURE_2D);
             glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
@@ -49,7 +63,27 @@ namespace sg {
             glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
         }
 
+        // With job threads the file is decoded on one of them and the texture starts as a single grey
+        // texel, replaced by UploadDecoded once the image is ready
         GLuint SetTexture(const char* filename) {
+            if (_jobs != NULL && _jobs->GetNThreads() > 1) {
+                GLuint texture;
+                unsigned char placeholder[4] = { 128, 128, 128, 255 };
+                glGenTextures(1, &texture);
+                BindTexture(texture, 1, 1, placeholder);
+                std::string name = filename;
+                _jobs->RunBackground([this, texture, name]() {
+                    DecodedTexture decoded = DecodedTexture();
+                    int nrChannels;
+                    decoded.texture = texture;
+                    decoded.name = name;
+                    decoded.data = stbi_load(name.c_str(), &decoded.width, &decoded.height, &nrChannels, STBI_rgb_alpha);
+                    std::lock_guard<std::mutex> lock(_decodedMutex);
+                    _decoded.push_back(decoded);
+                });
+                return texture;
+            }
+
             int width, height, nrChannels;
             unsigned char* data = stbi_load(filename, &width, &height, &nrChannels, STBI_rgb_alpha);
             GLuint texture = -1;
@@ -65,6 +99,29 @@ namespace sg {
         }
 
     public:
+        void SetJobSystem(JobSystem* jobs) {
+            _jobs = jobs;
+        }
+
+        // Uploads one decoded image over its placeholder; returns false when there was none waiting
+        bool UploadDecoded() {
+            DecodedTexture decoded;
+            {
+                std::lock_guard<std::mutex> lock(_decodedMutex);
+                if (_decoded.empty()) return false;
+                decoded = _decoded.front();
+                _decoded.erase(_decoded.begin());
+            }
+            if (decoded.data) {
+                BindTexture(decoded.texture, decoded.width, decoded.height, decoded.data);
+            }
+            else {
+                printf("Failed to load texture %s\n", decoded.name.c_str());
+            }
+            stbi_image_free(decoded.data);
+            return true;
+        }
+
         sg::Texture LoadTexture(const char* filename) {
             sg::Texture t;
             t.map = (char *)filename;
@@ -94,8 +151,7 @@ namespace sg {
         GLuint SetCubemap(const char* textures_faces[6]) {
             GLuint texID;
             glGenTextures(1, &texID);
-            glActiveTexture(GL_TEXTURE0);
-            glBindTexture(GL_TEXTURE_CUBE_MAP, texID);
+            GLState::BindTextureForEdit(GL_TEXTURE_CUBE_MAP, texID);
             glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
             glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
             glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
@@ -123,57 +179,52 @@ namespace sg {
             return texID;
         }
 
-        void SetMaterialData(GLuint programId, Material* mat) {
+        void SetMaterialData(ShaderProgram* program, Material* mat) {
             SetTexturesData(mat);
-            glUseProgram(programId);
-            GLint Kd = glGetUniformLocation(programId, "material.Kd");
-            glUniform3f(Kd, mat->Kd[0], mat->Kd[1], mat->Kd[2]);
-            GLint Ks = glGetUniformLocation(programId, "material.Ks");
-            glUniform3f(Ks, mat->Ks[0], mat->Ks[1], mat->Ks[2]);
-            GLint Ns = glGetUniformLocation(programId, "material.Ns");
-            glUniform1f(Ns, mat->Ns);
-            GLint d = glGetUniformLocation(programId, "material.d");
-            glUniform1f(d, mat->d);
+            const MaterialUniforms& handles = program->uniforms.material;
+            program->SetVec3(handles.Kd, glm::vec3(mat->Kd[0], mat->Kd[1], mat->Kd[2]));
+            program->SetVec3(handles.Ks, glm::vec3(mat->Ks[0], mat->Ks[1], mat->Ks[2]));
+            program->SetFloat(handles.Ns, mat->Ns);
+            program->SetFloat(handles.d, mat->d);
             if (mat->texture_Kd.isPresent) {
-                glActiveTexture(GL_TEXTURE0);
-                glBindTexture(GL_TEXTURE_2D, mat->texture_Kd.index);
-                glUniform1i(glGetUniformLocation(programId, "material.dTexture"), 0);
-                glUniform1i(glGetUniformLocation(programId, "material.dTextureSet"), 1);
+                GLState::BindTexture(0, GL_TEXTURE_2D, mat->texture_Kd.index);
+                program->SetInt(handles.dTexture, 0);
+                program->SetInt(handles.dTextureSet, 1);
             }
             else {
-                glUniform1i(glGetUniformLocation(programId, "material.dTextureSet"), 0);
+                program->SetInt(handles.dTextureSet, 0);
             }
             if (mat->texture_Ks.isPresent) {
-                glActiveTexture(GL_TEXTURE1);
-                glBindTexture(GL_TEXTURE_2D, mat->texture_Ks.index);
-                glUniform1i(glGetUniformLocation(programId, "material.sTexture"), 1);
-                glUniform1i(glGetUniformLocation(programId, "material.sTextureSet"), 1);
+                GLState::BindTexture(1, GL_TEXTURE_2D, mat->texture_Ks.index);
+                program->SetInt(handles.sTexture, 1);
+                program->SetInt(handles.sTextureSet, 1);
             }
             else {
-                glUniform1i(glGetUniformLocation(programId, "material.sTextureSet"), 0);
+                program->SetInt(handles.sTextureSet, 0);
             }
         }
 
-        void SetMaterialData(GLuint programId) {
-            glUseProgram(programId);
-            glUniform3f(glGetUniformLocation(programId, "material.Kd"), 1, 1, 1);
-            glUniform3f(glGetUniformLocation(programId, "material.Ks"), 0.4, 0.4, 0.4);
-            glUniform1f(glGetUniformLocation(programId, "material.Ns"), 20);
-            glUniform1f(glGetUniformLocation(programId, "material.d"), 1);
+        void SetMaterialData(ShaderProgram* program) {
+            const MaterialUniforms& handles = program->uniforms.material;
+            program->SetVec3(handles.Kd, glm::vec3(1, 1, 1));
+            program->SetVec3(handles.Ks, glm::vec3(0.4, 0.4, 0.4));
+            program->SetFloat(handles.Ns, 20);
+            program->SetFloat(handles.d, 1);
 
-            glUniform1i(glGetUniformLocation(programId, "material.dTextureSet"), 0);
-            glUniform1i(glGetUniformLocation(programId, "material.sTextureSet"), 0);
+            program->SetInt(handles.dTextureSet, 0);
+            program->SetInt(handles.sTextureSet, 0);
         }
 
         ~TextureManager() {
             for (int i = 0; i < _loadedTextures.size(); i++) {
-                glDeleteTextures(1, &_loadedTextures[i].index);
+                GLState::DeleteTexture(_loadedTextures[i].index);
             }
         }
 	};
 
     TextureManager TextureManager::_instance = TextureManager::TextureManager();
     bool TextureManager::_initialized = false;
+    std::mutex TextureManager::_decodedMutex;
 
     TextureManager* TextureManager::Instance() {
         if (!TextureManager::_initialized) {
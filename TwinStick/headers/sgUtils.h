@@ -1,6 +1,7 @@
 #pragma once
 
 #include <sgModel.h>
+#include <sgShaderProgram.h>
 #include <GL/glew.h>
 #include <chrono>
 #include <fstream>
@@ -54,7 +55,7 @@ namespace sg {
         return shaderID;
     }
 
-    GLuint CreateProgram(const char* vsSource, const char* fsSource) {
+    ShaderProgram* CreateProgram(const char* vsSource, const char* fsSource) {
         GLuint vsID = CompileShader(vsSource, GL_VERTEX_SHADER);
         GLuint fsID = CompileShader(fsSource, GL_FRAGMENT_SHADER);
 
@@ -73,15 +74,16 @@ namespace sg {
             std::cout << "ERROR: " << compilerMessage.data() << std::endl;
         }
 
-        glUseProgram(programID);
+        ShaderProgram* program = new ShaderProgram(programID);
+        program->Use();
 
         glDeleteShader(vsID);
         glDeleteShader(fsID);
 
-        return programID;
+        return program;
     }
 
-    GLuint CreateProgram(const char* vsSource, const char* fsSource, const char* gsSource) {
+    ShaderProgram* CreateProgram(const char* vsSource, const char* fsSource, const char* gsSource) {
         GLuint vsID = CompileShader(vsSource, GL_VERTEX_SHADER);
         GLuint fsID = CompileShader(fsSource, GL_FRAGMENT_SHADER);
         GLuint gsID = CompileShader(gsSource, GL_GEOMETRY_SHADER);
@@ -102,16 +104,17 @@ namespace sg {
             std::cout << "ERROR: " << compilerMessage.data() << std::endl;
         }
 
-        glUseProgram(programID);
+        ShaderProgram* program = new ShaderProgram(programID);
+        program->Use();
 
         glDeleteShader(vsID);
         glDeleteShader(fsID);
         glDeleteShader(gsID);
 
-        return programID;
+        return program;
     }
 
-    GLuint CreateProgram(const char* vsSource, const char* fsSource, const char* tcsSource, const char* tesSource) {
+    ShaderProgram* CreateProgram(const char* vsSource, const char* fsSource, const char* tcsSource, const char* tesSource) {
         GLuint vsID = CompileShader(vsSource, GL_VERTEX_SHADER);
         GLuint fsID = CompileShader(fsSource, GL_FRAGMENT_SHADER);
         GLuint tcsID = CompileShader(tcsSource, GL_TESS_CONTROL_SHADER);
@@ -134,17 +137,18 @@ namespace sg {
             std::cout << "ERROR: " << compilerMessage.data() << std::endl;
         }
 
-        glUseProgram(programID);
+        ShaderProgram* program = new ShaderProgram(programID);
+        program->Use();
 
         glDeleteShader(vsID);
         glDeleteShader(fsID);
         glDeleteShader(tcsID);
         glDeleteShader(tesID);
 
-        return programID;
+        return program;
     }
 
-    GLuint CreateProgram(const char* vsSource, const char* fsSource, const char* tcsSource, const char* tesSource, const char* gsSource) {
+    ShaderProgram* CreateProgram(const char* vsSource, const char* fsSource, const char* tcsSource, const char* tesSource, const char* gsSource) {
         GLuint vsID = CompileShader(vsSource, GL_VERTEX_SHADER);
         GLuint fsID = CompileShader(fsSource, GL_FRAGMENT_SHADER);
         GLuint tcsID = CompileShader(tcsSource, GL_TESS_CONTROL_SHADER);
@@ -169,7 +173,8 @@ namespace sg {
             std::cout << "ERROR: " << compilerMessage.data() << std::endl;
         }
 
-        glUseProgram(programID);
+        ShaderProgram* program = new ShaderProgram(programID);
+        program->Use();
 
         glDeleteShader(vsID);
         glDeleteShader(fsID);
@@ -177,79 +182,41 @@ namespace sg {
         glDeleteShader(tesID);
         glDeleteShader(gsID);
 
-        return programID;
+        return program;
     }
 
-    void UpdateSpotLights(GLuint program, std::vector<sg::SpotLight3D*> spotLights, glm::mat4 mv, int textureUnit) {
-        if (program <= 0) return;
-        glUseProgram(program);
-        glUniform1i(glGetUniformLocation(program, "nSpotLights"), spotLights.size());
-        for (int i = 0; i < spotLights.size(); i++) {
-            glm::vec3 lightPos = glm::vec3(mv * glm::vec4(spotLights[i]->GetGlobalPosition(), 1));
-            std::string baseString = std::string("spotLights[").append(std::to_string(i)).append("].");
-            glUniform3fv(glGetUniformLocation(program, (baseString + "pos").c_str()), 1, glm::value_ptr(lightPos));
-            glUniform3fv(glGetUniformLocation(program, (baseString + "color").c_str()), 1, glm::value_ptr(spotLights[i]->GetColor()));
-            glUniform1f(glGetUniformLocation(program, (baseString + "range").c_str()), spotLights[i]->GetRange());
-            glUniform1f(glGetUniformLocation(program, (baseString + "intensity").c_str()), spotLights[i]->GetIntensity());
-            glActiveTexture(GL_TEXTURE0 + textureUnit);
-            glBindTexture(GL_TEXTURE_2D, spotLights[i]->GetShadowTexture()); //variare se la texture pu essere un rettangolo
-            glUniform1i(glGetUniformLocation(program, (baseString + "shadowTexture").c_str()), textureUnit);
-            textureUnit++;
+    // Light parameters live in the shared light buffer; only the mask and cube shadow textures are bound here,
+    // once per frame, and each program's sampler uniforms and world-to-shadow matrices are updated.
+    // Spot and directional shadows are read from the renderer's shadow atlas.
+    void UpdateSpotLights(std::vector<ShaderProgram*> programs, std::vector<sg::SpotLight3D*> spotLights, int textureUnit) {
+        for (int i = 0; i < spotLights.size() && i < MAX_LIGHTS; i++) {
+            int mapUnit = -1;
             if (spotLights[i]->GetMapTexture().isPresent) {
-                glActiveTexture(GL_TEXTURE0 + textureUnit);
-                glBindTexture(GL_TEXTURE_2D, spotLights[i]->GetMapTexture().index); //variare se la texture pu essere un rettangolo
-                glUniform1i(glGetUniformLocation(program, (baseString + "mapTexture").c_str()), textureUnit);
-                glUniform1i(glGetUniformLocation(program, (baseString + "mapTextureSet").c_str()), 1);
-                textureUnit++;
+                mapUnit = textureUnit++;
+                GLState::BindTexture(mapUnit, GL_TEXTURE_2D, spotLights[i]->GetMapTexture().index); //variare se la texture pu essere un rettangolo
+            }
+            for (ShaderProgram* program : programs) {
+                program->SetMat4(program->uniforms.spotShadowMatrices[i], spotLights[i]->GetShadow());
+                if (mapUnit >= 0) program->SetInt(program->uniforms.spotMapTextures[i], mapUnit);
             }
         }
     }
 
-    void UpdatePointLights(GLuint program, std::vector<sg::PointLight3D*> pointLights, glm::mat4 mv, int textureUnit) {
-        if (program <= 0) return;
-        glUseProgram(program);
-        glUniform1i(glGetUniformLocation(program, "nPointLights"), pointLights.size());
-        for (int i = 0; i < pointLights.size(); i++) {
-            glm::vec3 lightPos = glm::vec3(mv * glm::vec4(pointLights[i]->GetGlobalPosition(), 1));
-            std::string baseString = std::string("pointLights[").append(std::to_string(i)).append("].");
-            glUniform3fv(glGetUniformLocation(program, (baseString + "pos").c_str()), 1, glm::value_ptr(lightPos));
-            glUniform3fv(glGetUniformLocation(program, (baseString + "worldPos").c_str()), 1, glm::value_ptr(pointLights[i]->GetGlobalPosition()));
-            glUniform3fv(glGetUniformLocation(program, (baseString + "color").c_str()), 1, glm::value_ptr(pointLights[i]->GetColor()));
-            glUniform1f(glGetUniformLocation(program, (baseString + "range").c_str()), pointLights[i]->GetRange());
-            glUniform1f(glGetUniformLocation(program, (baseString + "intensity").c_str()), pointLights[i]->GetIntensity());
-            glUniform1f(glGetUniformLocation(program, (baseString + "far_plane").c_str()), pointLights[i]->GetFarPlane());
-            glActiveTexture(GL_TEXTURE0 + textureUnit);
-            glBindTexture(GL_TEXTURE_CUBE_MAP, pointLights[i]->GetShadowTexture());
-            glUniform1i(glGetUniformLocation(program, (baseString + "shadowTexture").c_str()), textureUnit);
-            textureUnit++;
-        }
-    }
-
-    void UpdateDirectionalLights(GLuint program, std::vector<sg::DirectionalLight3D*> dirLights, glm::mat4 mv, int textureUnit) {
-        if (program <= 0) return;
-        glUseProgram(program);
-        glUniform1i(glGetUniformLocation(program, "nDirLights"), dirLights.size());
-        for (int i = 0; i < dirLights.size(); i++) {
-            glm::vec3 lightDir = glm::vec3(mv * glm::vec4(dirLights[i]->GlobalForward(), 0));
-            std::string baseString = std::string("dirLights[").append(std::to_string(i)).append("].");
-            glUniform3fv(glGetUniformLocation(program, (baseString + "dir").c_str()), 1, glm::value_ptr(lightDir));
-            glUniform3fv(glGetUniformLocation(program, (baseString + "color").c_str()), 1, glm::value_ptr(dirLights[i]->GetColor()));
-            glUniform1f(glGetUniformLocation(program, (baseString + "intensity").c_str()), dirLights[i]->GetIntensity());
-            glActiveTexture(GL_TEXTURE0 + textureUnit);
-            glBindTexture(GL_TEXTURE_2D, dirLights[i]->GetShadowTexture()); //variare se la texture pu essere un rettangolo
-            glUniform1i(glGetUniformLocation(program, (baseString + "shadowTexture").c_str()), textureUnit);
+    void UpdatePointLights(std::vector<ShaderProgram*> programs, std::vector<sg::PointLight3D*> pointLights, int textureUnit) {
+        for (int i = 0; i < pointLights.size() && i < MAX_LIGHTS; i++) {
+            GLState::BindTexture(textureUnit, GL_TEXTURE_CUBE_MAP, pointLights[i]->GetShadowTexture());
+            for (ShaderProgram* program : programs) {
+                program->SetInt(program->uniforms.pointShadowTextures[i], textureUnit);
+            }
             textureUnit++;
         }
     }
 
-    void UpdateAmbientLights(GLuint program, std::vector<sg::AmbientLight*> ambientLights) {
-        if (program <= 0) return;
-        glUseProgram(program);
-        glUniform1i(glGetUniformLocation(program, "nAmbientLights"), ambientLights.size());
-        for (int i = 0; i < ambientLights.size(); i++) {
-            std::string baseString = std::string("ambientLights[").append(std::to_string(i)).append("].");
-            glUniform3fv(glGetUniformLocation(program, (baseString + "color").c_str()), 1, glm::value_ptr(ambientLights[i]->GetColor()));
-            glUniform1f(glGetUniformLocation(program, (baseString + "intensity").c_str()), ambientLights[i]->GetIntensity());
+    void UpdateDirectionalLights(std::vector<ShaderProgram*> programs, std::vector<sg::DirectionalLight3D*> dirLights) {
+        for (int i = 0; i < dirLights.size() && i < MAX_LIGHTS; i++) {
+            for (ShaderProgram* program : programs) {
+                program->SetMat4(program->uniforms.dirShadowMatrices[i], dirLights[i]->GetShadow());
+            }
         }
     }
 
@@ -257,15 +224,11 @@ namespace sg {
         return std::chrono::high_resolution_clock::now().time_since_epoch().count() / 1000.0;
     }
 
-    void SetMatrix(glm::mat4 matrix, GLuint program, char const* name) {
-        GLint location = glGetUniformLocation(program, name);
-        glUseProgram(program);
-        glUniformMatrix4fv(location, 1, false, glm::value_ptr(matrix));
+    void SetMatrix(glm::mat4 matrix, ShaderProgram* program, UniformHandle handle) {
+        program->SetMat4(handle, matrix);
     }
 
-    void SetMatrix(glm::mat3 matrix, GLuint program, char const* name) {
-        GLint location = glGetUniformLocation(program, name);
-        glUseProgram(program);
-        glUniformMatrix3fv(location, 1, false, glm::value_ptr(matrix));
+    void SetMatrix(glm::mat3 matrix, ShaderProgram* program, UniformHandle handle) {
+        program->SetMat3(handle, matrix);
     }
 }
\ No newline at end of file
@@ -1,5 +1,6 @@
 #include <sgEngine.h>
 #include <sstream>
+#include <iomanip>
 #include <Player.h>
 #include <EnemyManager.h>
 #include <Bullet.h>
@@ -87,7 +88,6 @@ private:
 
     void mainLoop() {
         printf("Starting rendering\n");
-        float previousPlayerZ = player->GetGlobalPosition().z - 15;
         while (!renderer->Terminated())
         {
             if (!minimized) {
@@ -95,13 +95,14 @@ private:
                     cleanup();
                     initGame();
                 }
-                float newPlayerZ = player->GetGlobalPosition().z - 15;
-                if (previousPlayerZ * newPlayerZ < 0) mapCreator->SwapLights();
-                previousPlayerZ = newPlayerZ;
 
                 int fps = renderer->RenderFrame();
                 std::stringstream ss{};
-                ss << "TwinStick [" << averageFrameRate(fps) << " FPS]";
+                sg::RenderQueueStats queueStats = renderer->GetRenderQueueStats();
+                ss << "TwinStick [" << averageFrameRate(fps) << " FPS] [" << (renderer->IsDeferred() ? "deferred" : "forward") << (renderer->HasDepthPrepass() ? " + prepass" : "") << "] [switches avoided: "
+                    << queueStats.programSwitchesAvoided << " program, " << queueStats.textureSwitchesAvoided << " texture] [GL calls elided: "
+                    << renderer->GetGLStateCounters().elided << "] [CPU wait " << std::fixed << std::setprecision(1) << renderer->GetFrameTimings().cpuWait
+                    << " ms, GPU " << renderer->GetFrameTimings().gpuBusy << " ms]";
                 glfwSetWindowTitle(renderer->GetWindow(), ss.str().c_str());
 
                 if (shootLightPresent > 0 && --shootLightPresent == 0) {
@@ -141,10 +142,11 @@ private:
         enemyManager = new EnemyManager(renderer, ENEMY_SPEED, player, "res/models/zombie.obj");
         mapCreator = new MapCreator(renderer);
         bulletModel = new sg::Model();
-        bulletModel->LoadFromObj("res/models/projectile.obj");
+        bulletModel->LoadFromObjAsync("res/models/projectile.obj", renderer->GetJobSystem());
 
         sunLight = new sg::DirectionalLight3D(shadowResx*2, shadowResy*2, 35, 1, 50, 130, glm::vec3(0.1, -0.5, -0.5));
         sunLight->SetIntensity(0.2f);
+        sunLight->SetCascades(3, shadowResx, 150);
         renderer->AddLight(sunLight);
 
         ambientLight = new sg::AmbientLight(0.12f);
@@ -159,6 +161,8 @@ private:
     void BindInputs() {
         BindInput(sg::Key_Esc_Down, onEscKeyPressed);
         BindInput(sg::Key_Space_Down, onSpaceKeyPressed);
+        BindInput(sg::Key_Ctrl_Down, onCtrlKeyPressed);
+        BindInput(sg::Key_P_Down, onPKeyPressed);
         BindInput(sg::Mouse_Left_Down, onLeftMouseButtonClick);
         BindInput(sg::Mouse_Position, onMouseDrag);
         BindInput(sg::Window_Resize, onWindowResize);
@@ -192,6 +196,14 @@ private:
         renderer->SetShowTriangulation(showTriangulation);
     }
 
+    static void onCtrlKeyPressed(int mods) {
+        renderer->SetDeferred(!renderer->IsDeferred());
+    }
+
+    static void onPKeyPressed(int mods) {
+        renderer->SetDepthPrepass(!renderer->HasDepthPrepass());
+    }
+
     static void onWindowResize(int x, int y) {
         resx = x;
         resy = y;
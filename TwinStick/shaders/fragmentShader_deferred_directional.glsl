@@ -0,0 +1,165 @@
+#version 330 core
+
+#define MAX_LIGHTS 5
+#define MAX_CASCADES 4
+
+struct SpotLight {
+	vec3 pos;
+	float intensity;
+	vec3 color;
+	float range;
+	int mapTextureSet;
+	vec4 atlasRect;
+};
+
+struct DirLight {
+	vec3 dir;
+	float intensity;
+	vec3 color;
+	int nCascades;
+	vec4 atlasRect;
+	vec4 cascadeSplits;
+};
+
+struct Cascade {
+	mat4 shadowMatrix;
+	vec4 atlasRect;
+};
+
+// Point lights come from the clustered light buffers, three texels each
+struct PointLight {
+	vec3 pos;
+	float intensity;
+	vec3 color;
+	float range;
+	float far_plane;
+	int shadowIndex;
+};
+
+struct AmbientLight {
+	vec3 color;
+	float intensity;
+};
+
+layout(std140) uniform Lights {
+	mat4 view;
+	SpotLight spotLights[MAX_LIGHTS];
+	DirLight dirLights[MAX_LIGHTS];
+	AmbientLight ambientLights[MAX_LIGHTS];
+	Cascade cascades[MAX_LIGHTS * MAX_CASCADES];
+	int nSpotLights;
+	int nDirLights;
+	int nAmbientLights;
+};
+
+uniform sampler2DShadow shadowAtlas;
+uniform mat4 dirShadowMatrices[MAX_LIGHTS];
+
+uniform sampler2D gAlbedo;
+uniform sampler2D gSpecular;
+uniform sampler2D gNormal;
+uniform sampler2D gDepth;
+uniform mat4 inverseProjection;
+uniform mat4 inverseView;
+uniform vec2 screenSize;
+
+struct Surface {
+	vec3 albedo;
+	vec3 specular;
+	float Ns;
+	vec3 normal;
+	vec3 viewPosition;
+	vec3 worldPosition;
+	bool receivesShadows;
+};
+
+// Rebuilds the surface under the fragment; false where no lit object was drawn
+bool ReadSurface(out Surface surface) {
+	vec2 uv = gl_FragCoord.xy / screenSize;
+	float viewDepth = texture(gDepth, uv).x;
+	if (viewDepth == 0.0) return false;
+
+	vec4 farPoint = inverseProjection * vec4(uv * 2 - 1, 1, 1);
+	surface.viewPosition = farPoint.xyz / farPoint.w;
+	surface.viewPosition *= viewDepth / surface.viewPosition.z;
+	surface.worldPosition = (inverseView * vec4(surface.viewPosition, 1)).xyz;
+
+	vec4 specular = texture(gSpecular, uv);
+	vec4 normal = texture(gNormal, uv);
+	surface.albedo = texture(gAlbedo, uv).xyz;
+	surface.specular = specular.xyz;
+	surface.Ns = specular.w;
+	surface.normal = normalize(normal.xyz);
+	surface.receivesShadows = normal.w > 0.5;
+	return true;
+}
+
+out vec4 color;
+
+// p is in the light's [0, 1] shadow space; the lookup is kept half a texel inside the light's tile
+float SampleShadowAtlas(vec4 atlasRect, vec3 p) {
+	if (atlasRect.z == 0) return 1;
+	vec2 halfTexel = 0.5 / vec2(textureSize(shadowAtlas, 0));
+	vec2 uv = clamp(atlasRect.xy + p.xy * atlasRect.zw, atlasRect.xy + halfTexel, atlasRect.xy + atlasRect.zw - halfTexel);
+	return texture(shadowAtlas, vec3(uv, p.z));
+}
+
+vec3 CalcDirLightComponent(int i, Surface surface, vec3 camDir) {
+	vec3 lightDir = normalize(-mat3(view) * dirLights[i].dir);
+	float diffuseComponent = max(0, dot(lightDir, surface.normal));
+	
+	vec3 bounceDir = normalize(lightDir + camDir);
+	float specularComponent = pow(max(0, dot(bounceDir, surface.normal)), surface.Ns);
+
+	if (surface.receivesShadows && dirLights[i].nCascades > 0) {
+		float depth = -surface.viewPosition.z;
+		int c = 0;
+		while (c < dirLights[i].nCascades && depth > dirLights[i].cascadeSplits[c]) c++;
+		if (c < dirLights[i].nCascades) {
+			Cascade cascade = cascades[i * MAX_CASCADES + c];
+			vec4 lightPosition = cascade.shadowMatrix * vec4(surface.worldPosition, 1);
+			vec3 p = lightPosition.xyz / lightPosition.w;
+			if (p.z <= 1.0) {
+				float litValue = SampleShadowAtlas(cascade.atlasRect, p);
+				diffuseComponent *= litValue;
+				specularComponent *= litValue;
+			}
+		}
+	} else if (surface.receivesShadows) {
+		vec4 lightPosition = dirShadowMatrices[i] * vec4(surface.worldPosition, 1);
+		vec3 p = lightPosition.xyz;
+		p.z *= 0.99;
+		p /= lightPosition.w;
+		if (p.x > 1 || p.x < 0 || p.y > 1 || p.y < 0 || p.z > 1.0 || p.z < 0.0) {
+			diffuseComponent = 0; specularComponent = 0;
+		} else {
+			float litValue = SampleShadowAtlas(dirLights[i].atlasRect, p);
+			diffuseComponent *= litValue;
+			specularComponent *= litValue;
+		}
+	}
+	
+	// blinn-phong
+	vec3 shading = dirLights[i].color * (diffuseComponent * surface.albedo) + surface.specular * specularComponent;
+	return dirLights[i].intensity * shading;
+}
+
+vec3 CalcAmbientLightComponent(int i, vec3 albedo) {
+	return albedo * ambientLights[i].color * ambientLights[i].intensity;
+}
+
+void main() {
+	Surface surface;
+	if (!ReadSurface(surface)) discard;
+
+	vec3 camDir = -normalize(surface.viewPosition);
+	vec3 shading = vec3(0.);
+	for(int i=0; i<nDirLights; i++) {
+		shading += CalcDirLightComponent(i, surface, camDir);
+	}
+	for(int i=0; i<nAmbientLights; i++) {
+		shading += CalcAmbientLightComponent(i, surface.albedo);
+	}
+	
+	color = vec4(shading, 1);
+}
\ No newline at end of file
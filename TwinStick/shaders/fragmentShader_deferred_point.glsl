@@ -0,0 +1,150 @@
+#version 330 core
+
+#define MAX_LIGHTS 5
+#define MAX_CASCADES 4
+
+struct SpotLight {
+	vec3 pos;
+	float intensity;
+	vec3 color;
+	float range;
+	int mapTextureSet;
+	vec4 atlasRect;
+};
+
+struct DirLight {
+	vec3 dir;
+	float intensity;
+	vec3 color;
+	int nCascades;
+	vec4 atlasRect;
+	vec4 cascadeSplits;
+};
+
+struct Cascade {
+	mat4 shadowMatrix;
+	vec4 atlasRect;
+};
+
+// Point lights come from the clustered light buffers, three texels each
+struct PointLight {
+	vec3 pos;
+	float intensity;
+	vec3 color;
+	float range;
+	float far_plane;
+	int shadowIndex;
+};
+
+struct AmbientLight {
+	vec3 color;
+	float intensity;
+};
+
+layout(std140) uniform Lights {
+	mat4 view;
+	SpotLight spotLights[MAX_LIGHTS];
+	DirLight dirLights[MAX_LIGHTS];
+	AmbientLight ambientLights[MAX_LIGHTS];
+	Cascade cascades[MAX_LIGHTS * MAX_CASCADES];
+	int nSpotLights;
+	int nDirLights;
+	int nAmbientLights;
+};
+
+uniform samplerBuffer clusterLights;
+uniform samplerCube pointShadowTextures[MAX_LIGHTS];
+
+uniform sampler2D gAlbedo;
+uniform sampler2D gSpecular;
+uniform sampler2D gNormal;
+uniform sampler2D gDepth;
+uniform mat4 inverseProjection;
+uniform mat4 inverseView;
+uniform vec2 screenSize;
+
+struct Surface {
+	vec3 albedo;
+	vec3 specular;
+	float Ns;
+	vec3 normal;
+	vec3 viewPosition;
+	vec3 worldPosition;
+	bool receivesShadows;
+};
+
+// Rebuilds the surface under the fragment; false where no lit object was drawn
+bool ReadSurface(out Surface surface) {
+	vec2 uv = gl_FragCoord.xy / screenSize;
+	float viewDepth = texture(gDepth, uv).x;
+	if (viewDepth == 0.0) return false;
+
+	vec4 farPoint = inverseProjection * vec4(uv * 2 - 1, 1, 1);
+	surface.viewPosition = farPoint.xyz / farPoint.w;
+	surface.viewPosition *= viewDepth / surface.viewPosition.z;
+	surface.worldPosition = (inverseView * vec4(surface.viewPosition, 1)).xyz;
+
+	vec4 specular = texture(gSpecular, uv);
+	vec4 normal = texture(gNormal, uv);
+	surface.albedo = texture(gAlbedo, uv).xyz;
+	surface.specular = specular.xyz;
+	surface.Ns = specular.w;
+	surface.normal = normalize(normal.xyz);
+	surface.receivesShadows = normal.w > 0.5;
+	return true;
+}
+
+flat in int lightIndex;
+
+out vec4 color;
+
+PointLight FetchPointLight(int index) {
+	vec4 a = texelFetch(clusterLights, index * 3);
+	vec4 b = texelFetch(clusterLights, index * 3 + 1);
+	vec4 c = texelFetch(clusterLights, index * 3 + 2);
+	return PointLight(a.xyz, a.w, b.xyz, b.w, c.x, int(c.y));
+}
+
+// Sampler arrays can only be indexed with constants in GLSL 3.30, and the slot here comes from a buffer
+float SamplePointShadow(int index, vec3 direction) {
+	switch (index) {
+	case 0: return textureLod(pointShadowTextures[0], direction, 0).x;
+	case 1: return textureLod(pointShadowTextures[1], direction, 0).x;
+	case 2: return textureLod(pointShadowTextures[2], direction, 0).x;
+	case 3: return textureLod(pointShadowTextures[3], direction, 0).x;
+	case 4: return textureLod(pointShadowTextures[4], direction, 0).x;
+	}
+	return 1;
+}
+
+void main() {
+	Surface surface;
+	if (!ReadSurface(surface)) discard;
+	PointLight light = FetchPointLight(lightIndex);
+
+	vec3 toLightWorld = light.pos - surface.worldPosition;
+	if (length(toLightWorld) > light.range) discard;
+
+	vec3 camDir = -normalize(surface.viewPosition);
+	vec3 toLight = (view * vec4(light.pos, 1)).xyz - surface.viewPosition;
+	vec3 lightDir = normalize(toLight);
+	float diffuseComponent = max(0, dot(lightDir, surface.normal));
+	
+	vec3 bounceDir = normalize(lightDir + camDir);
+	float specularComponent = pow(max(0, dot(bounceDir, surface.normal)), surface.Ns);
+
+	bool inShadow = false;
+	if (surface.receivesShadows && light.shadowIndex >= 0) {
+		float sampledDistance = SamplePointShadow(light.shadowIndex, -toLightWorld) * light.far_plane;
+		inShadow = (length(toLightWorld) - sampledDistance) >= 0.01;
+	}
+	if (inShadow) discard;
+
+	float coefficient = max(0., (1 - length(toLightWorld) / light.range));
+	diffuseComponent *= coefficient;
+	specularComponent *= coefficient;
+
+	// blinn-phong
+	vec3 shading = light.color * (diffuseComponent * surface.albedo) + surface.specular * specularComponent;
+	color = vec4(light.intensity * shading, 1);
+}
\ No newline at end of file
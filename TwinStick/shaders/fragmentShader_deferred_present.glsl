@@ -0,0 +1,9 @@
+#version 330 core
+
+uniform sampler2D accumulation;
+
+out vec4 color;
+
+void main() {
+	color = vec4(texelFetch(accumulation, ivec2(gl_FragCoord.xy), 0).xyz, 1);
+}
\ No newline at end of file
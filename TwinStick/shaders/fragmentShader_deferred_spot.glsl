@@ -0,0 +1,149 @@
+#version 330 core
+
+#define MAX_LIGHTS 5
+#define MAX_CASCADES 4
+
+struct SpotLight {
+	vec3 pos;
+	float intensity;
+	vec3 color;
+	float range;
+	int mapTextureSet;
+	vec4 atlasRect;
+};
+
+struct DirLight {
+	vec3 dir;
+	float intensity;
+	vec3 color;
+	int nCascades;
+	vec4 atlasRect;
+	vec4 cascadeSplits;
+};
+
+struct Cascade {
+	mat4 shadowMatrix;
+	vec4 atlasRect;
+};
+
+// Point lights come from the clustered light buffers, three texels each
+struct PointLight {
+	vec3 pos;
+	float intensity;
+	vec3 color;
+	float range;
+	float far_plane;
+	int shadowIndex;
+};
+
+struct AmbientLight {
+	vec3 color;
+	float intensity;
+};
+
+layout(std140) uniform Lights {
+	mat4 view;
+	SpotLight spotLights[MAX_LIGHTS];
+	DirLight dirLights[MAX_LIGHTS];
+	AmbientLight ambientLights[MAX_LIGHTS];
+	Cascade cascades[MAX_LIGHTS * MAX_CASCADES];
+	int nSpotLights;
+	int nDirLights;
+	int nAmbientLights;
+};
+
+uniform sampler2DShadow shadowAtlas;
+uniform sampler2D spotMapTextures[MAX_LIGHTS];
+uniform mat4 spotShadowMatrices[MAX_LIGHTS];
+uniform int spotIndex;
+
+uniform sampler2D gAlbedo;
+uniform sampler2D gSpecular;
+uniform sampler2D gNormal;
+uniform sampler2D gDepth;
+uniform mat4 inverseProjection;
+uniform mat4 inverseView;
+uniform vec2 screenSize;
+
+struct Surface {
+	vec3 albedo;
+	vec3 specular;
+	float Ns;
+	vec3 normal;
+	vec3 viewPosition;
+	vec3 worldPosition;
+	bool receivesShadows;
+};
+
+// Rebuilds the surface under the fragment; false where no lit object was drawn
+bool ReadSurface(out Surface surface) {
+	vec2 uv = gl_FragCoord.xy / screenSize;
+	float viewDepth = texture(gDepth, uv).x;
+	if (viewDepth == 0.0) return false;
+
+	vec4 farPoint = inverseProjection * vec4(uv * 2 - 1, 1, 1);
+	surface.viewPosition = farPoint.xyz / farPoint.w;
+	surface.viewPosition *= viewDepth / surface.viewPosition.z;
+	surface.worldPosition = (inverseView * vec4(surface.viewPosition, 1)).xyz;
+
+	vec4 specular = texture(gSpecular, uv);
+	vec4 normal = texture(gNormal, uv);
+	surface.albedo = texture(gAlbedo, uv).xyz;
+	surface.specular = specular.xyz;
+	surface.Ns = specular.w;
+	surface.normal = normalize(normal.xyz);
+	surface.receivesShadows = normal.w > 0.5;
+	return true;
+}
+
+out vec4 color;
+
+// p is in the light's [0, 1] shadow space; the lookup is kept half a texel inside the light's tile
+float SampleShadowAtlas(vec4 atlasRect, vec3 p) {
+	if (atlasRect.z == 0) return 1;
+	vec2 halfTexel = 0.5 / vec2(textureSize(shadowAtlas, 0));
+	vec2 uv = clamp(atlasRect.xy + p.xy * atlasRect.zw, atlasRect.xy + halfTexel, atlasRect.xy + atlasRect.zw - halfTexel);
+	return texture(shadowAtlas, vec3(uv, p.z));
+}
+
+// Sampler arrays can only be indexed with constants in GLSL 3.30
+float SampleSpotMap(int index, vec2 uv) {
+	switch (index) {
+	case 0: return textureLod(spotMapTextures[0], uv, 0).x;
+	case 1: return textureLod(spotMapTextures[1], uv, 0).x;
+	case 2: return textureLod(spotMapTextures[2], uv, 0).x;
+	case 3: return textureLod(spotMapTextures[3], uv, 0).x;
+	case 4: return textureLod(spotMapTextures[4], uv, 0).x;
+	}
+	return 1;
+}
+
+void main() {
+	Surface surface;
+	if (!ReadSurface(surface)) discard;
+	int i = spotIndex;
+
+	vec4 lightPosition = spotShadowMatrices[i] * vec4(surface.worldPosition, 1);
+	vec3 p = lightPosition.xyz;
+	p.z *= 0.99999;
+	p /= lightPosition.w;
+	if (p.x > 1 || p.x < 0 || p.y > 1 || p.y < 0 || p.z > 1.0 || p.z < 0.0) discard;
+
+	vec3 camDir = -normalize(surface.viewPosition);
+	vec3 toLight = (view * vec4(spotLights[i].pos, 1)).xyz - surface.viewPosition;
+	vec3 lightDir = normalize(toLight);
+	float diffuseComponent = max(0, dot(lightDir, surface.normal));
+	
+	vec3 bounceDir = normalize(lightDir + camDir);
+	float specularComponent = pow(max(0, dot(bounceDir, surface.normal)), surface.Ns);
+
+	float litValue = surface.receivesShadows ? SampleShadowAtlas(spotLights[i].atlasRect, p) : 1.;
+	if (spotLights[i].mapTextureSet == 1) litValue *= SampleSpotMap(i, p.xy);
+	float coefficient = litValue * max(0., (1 - length(toLight) / spotLights[i].range));
+	diffuseComponent *= coefficient;
+	specularComponent *= coefficient;
+
+	// blinn-phong
+	vec3 shading = spotLights[i].color * (diffuseComponent * surface.albedo) + surface.specular * specularComponent;
+	color = vec4(spotLights[i].intensity * shading, 1);
+}
\ No newline at end of file
@@ -0,0 +1,33 @@
+#version 330 core
+
+struct Material {
+	vec3 Kd;
+	vec3 Ks;
+	float Ns;
+	float d;
+	sampler2D dTexture;
+	int dTextureSet;
+	sampler2D sTexture;
+	int sTextureSet;
+};  
+uniform Material material;
+uniform int receivesShadows;
+
+in vec3 viewPosition;
+in vec2 textureC;
+in vec3 fragNormal;
+
+layout(location=0) out vec4 gAlbedo;
+layout(location=1) out vec4 gSpecular;
+layout(location=2) out vec4 gNormal;
+layout(location=3) out float gDepth;
+
+void main() {
+	vec3 albedo = (material.dTextureSet == 1) ? texture(material.dTexture, textureC).xyz * material.Kd : material.Kd;
+	vec3 specular = (material.sTextureSet == 1) ? texture(material.sTexture, textureC).xyz * material.Ks : material.Ks;
+
+	gAlbedo = vec4(albedo, 1);
+	gSpecular = vec4(specular, material.Ns);
+	gNormal = vec4(normalize(fragNormal), float(receivesShadows));
+	gDepth = viewPosition.z;
+}
\ No newline at end of file
@@ -1,41 +1,67 @@
 #version 330 core
 
 #define MAX_LIGHTS 5
+#define MAX_CASCADES 4
+#define CLUSTER_X 16
+#define CLUSTER_Y 9
+#define CLUSTER_Z 24
 
 struct SpotLight {
 	vec3 pos;
-	vec3 color;
 	float intensity;
+	vec3 color;
 	float range;
-	sampler2D mapTexture;
 	int mapTextureSet;
+	vec4 atlasRect;
+};
+
+struct DirLight {
+	vec3 dir;
+	float intensity;
+	vec3 color;
+	int nCascades;
+	vec4 atlasRect;
+	vec4 cascadeSplits;
+};
+
+struct Cascade {
+	mat4 shadowMatrix;
+	vec4 atlasRect;
 };
-uniform SpotLight spotLights[MAX_LIGHTS];
-uniform int nSpotLights;
 
+// Point lights come from the clustered light buffers, three texels each
 struct PointLight {
 	vec3 pos;
-	vec3 color;
 	float intensity;
+	vec3 color;
 	float range;
+	float far_plane;
+	int shadowIndex;
 };
-uniform PointLight pointLights[MAX_LIGHTS];
-uniform int nPointLights;
 
-struct DirLight {
-	vec3 dir;
+struct AmbientLight {
 	vec3 color;
 	float intensity;
 };
-uniform DirLight dirLights[MAX_LIGHTS];
-uniform int nDirLights;
 
-struct AmbientLight {
-	vec3 color;
-	float intensity;
+layout(std140) uniform Lights {
+	mat4 view;
+	SpotLight spotLights[MAX_LIGHTS];
+	DirLight dirLights[MAX_LIGHTS];
+	AmbientLight ambientLights[MAX_LIGHTS];
+	Cascade cascades[MAX_LIGHTS * MAX_CASCADES];
+	int nSpotLights;
+	int nDirLights;
+	int nAmbientLights;
 };
-uniform AmbientLight ambientLights[MAX_LIGHTS];
-uniform int nAmbientLights;
+
+uniform samplerBuffer clusterLights;
+uniform usamplerBuffer clusterRanges;
+uniform usamplerBuffer clusterIndices;
+uniform float clusterScale;
+uniform float clusterBias;
+uniform vec2 clusterTileSize;
+uniform sampler2D spotMapTextures[MAX_LIGHTS];
 
 struct Material {
 	vec3 Kd;
@@ -53,11 +79,12 @@ in vec3 viewPosition;
 in vec2 textureC;
 in vec3 fragNormal;
 in vec4 spotLightViewPositions[MAX_LIGHTS];
+flat in int lightMask;	// spot lights whose frustum reaches this instance
 
 out vec4 color;
 
 vec3 CalcSpotLightComponent(int i, vec3 albedo, vec3 specular, vec3 camDir) {
-	vec3 toLight = spotLights[i].pos - viewPosition;
+	vec3 toLight = (view * vec4(spotLights[i].pos, 1)).xyz - viewPosition;
 	vec3 lightDir = normalize(toLight);
 	float diffuseComponent = max(0, dot(lightDir, normalize(fragNormal)));
 	
@@ -69,7 +96,7 @@ vec3 CalcSpotLightComponent(int i, vec3 albedo, vec3 specular, vec3 camDir) {
 		diffuseComponent = 0; specularComponent = 0;
 	} else {
 		float litValue = 1.;
-		if (spotLights[i].mapTextureSet == 1) litValue *= texture(spotLights[i].mapTexture, p.xy).x;
+		if (spotLights[i].mapTextureSet == 1) litValue *= texture(spotMapTextures[i], p.xy).x;
 		float coefficient = litValue * max(0., (1 - length(toLight) / spotLights[i].range));
 		diffuseComponent *= coefficient;
 		specularComponent *= coefficient;
@@ -80,25 +107,39 @@ vec3 CalcSpotLightComponent(int i, vec3 albedo, vec3 specular, vec3 camDir) {
 	return spotLights[i].intensity * shading;
 }
 
-vec3 CalcPointLightComponent(int i, vec3 albedo, vec3 specular, vec3 camDir) {
-	vec3 toLight = pointLights[i].pos - viewPosition;
+PointLight FetchPointLight(int index) {
+	vec4 a = texelFetch(clusterLights, index * 3);
+	vec4 b = texelFetch(clusterLights, index * 3 + 1);
+	vec4 c = texelFetch(clusterLights, index * 3 + 2);
+	return PointLight(a.xyz, a.w, b.xyz, b.w, c.x, int(c.y));
+}
+
+// (offset, count) of the fragment's froxel in clusterIndices
+uvec2 FetchCluster() {
+	int z = int(clamp(floor(log(-viewPosition.z) * clusterScale - clusterBias), 0.0, float(CLUSTER_Z - 1)));
+	ivec2 xy = clamp(ivec2(gl_FragCoord.xy / clusterTileSize), ivec2(0), ivec2(CLUSTER_X - 1, CLUSTER_Y - 1));
+	return texelFetch(clusterRanges, xy.x + CLUSTER_X * (xy.y + CLUSTER_Y * z)).xy;
+}
+
+vec3 CalcPointLightComponent(PointLight light, vec3 albedo, vec3 specular, vec3 camDir) {
+	vec3 toLight = (view * vec4(light.pos, 1)).xyz - viewPosition;
 	vec3 lightDir = normalize(toLight);
 	float diffuseComponent = max(0, dot(lightDir, normalize(fragNormal)));
 	
 	vec3 bounceDir = normalize(lightDir + camDir);
 	float specularComponent = pow(max(0, dot(bounceDir, fragNormal)), material.Ns);
 
-	float coefficient = max(0., (1 - length(toLight) / pointLights[i].range));
+	float coefficient = max(0., (1 - length(toLight) / light.range));
 	diffuseComponent *= coefficient;
 	specularComponent *= coefficient;
 
 	// blinn-phong
-	vec3 shading = pointLights[i].color * (diffuseComponent * albedo) + specular * specularComponent;
-	return pointLights[i].intensity * shading;
+	vec3 shading = light.color * (diffuseComponent * albedo) + specular * specularComponent;
+	return light.intensity * shading;
 }
 
 vec3 CalcDirLightComponent(int i, vec3 albedo, vec3 specular, vec3 camDir) {
-	vec3 lightDir = normalize(-dirLights[i].dir);
+	vec3 lightDir = normalize(-mat3(view) * dirLights[i].dir);
 	float diffuseComponent = max(0, dot(lightDir, normalize(fragNormal)));
 	
 	vec3 bounceDir = normalize(lightDir + camDir);
@@ -120,10 +161,13 @@ void main() {
 	vec3 camDir = -normalize(viewPosition);
 	vec3 shading = vec3(0.);
 	for(int i=0; i<nSpotLights; i++) {
+		if((lightMask & (1 << i)) == 0) continue;
 		shading += CalcSpotLightComponent(i, albedo, specular, camDir);
 	}
-	for(int i=0; i<nPointLights; i++) {
-		shading += CalcPointLightComponent(i, albedo, specular, camDir);
+	uvec2 cluster = FetchCluster();
+	for(uint n=0u; n<cluster.y; n++) {
+		int index = int(texelFetch(clusterIndices, int(cluster.x + n)).x);
+		shading += CalcPointLightComponent(FetchPointLight(index), albedo, specular, camDir);
 	}
 	for(int i=0; i<nDirLights; i++) {
 		shading += CalcDirLightComponent(i, albedo, specular, camDir);
@@ -1,46 +1,69 @@
 #version 330 core
 
 #define MAX_LIGHTS 5
+#define MAX_CASCADES 4
+#define CLUSTER_X 16
+#define CLUSTER_Y 9
+#define CLUSTER_Z 24
 
 struct SpotLight {
 	vec3 pos;
-	vec3 color;
 	float intensity;
+	vec3 color;
 	float range;
-	sampler2DShadow shadowTexture;
-	sampler2D mapTexture;
 	int mapTextureSet;
+	vec4 atlasRect;
+};
+
+struct DirLight {
+	vec3 dir;
+	float intensity;
+	vec3 color;
+	int nCascades;
+	vec4 atlasRect;
+	vec4 cascadeSplits;
 };
-uniform SpotLight spotLights[MAX_LIGHTS];
-uniform int nSpotLights;
 
+struct Cascade {
+	mat4 shadowMatrix;
+	vec4 atlasRect;
+};
+
+// Point lights come from the clustered light buffers, three texels each
 struct PointLight {
 	vec3 pos;
-	vec3 worldPos;
-	vec3 color;
 	float intensity;
+	vec3 color;
 	float range;
-	samplerCube shadowTexture;
 	float far_plane;
+	int shadowIndex;
 };
-uniform PointLight pointLights[MAX_LIGHTS];
-uniform int nPointLights;
 
-struct DirLight {
-	vec3 dir;
+struct AmbientLight {
 	vec3 color;
 	float intensity;
-	sampler2DShadow shadowTexture;
 };
-uniform DirLight dirLights[MAX_LIGHTS];
-uniform int nDirLights;
 
-struct AmbientLight {
-	vec3 color;
-	float intensity;
+layout(std140) uniform Lights {
+	mat4 view;
+	SpotLight spotLights[MAX_LIGHTS];
+	DirLight dirLights[MAX_LIGHTS];
+	AmbientLight ambientLights[MAX_LIGHTS];
+	Cascade cascades[MAX_LIGHTS * MAX_CASCADES];
+	int nSpotLights;
+	int nDirLights;
+	int nAmbientLights;
 };
-uniform AmbientLight ambientLights[MAX_LIGHTS];
-uniform int nAmbientLights;
+
+uniform sampler2DShadow shadowAtlas;
+uniform samplerBuffer clusterLights;
+uniform usamplerBuffer clusterRanges;
+uniform usamplerBuffer clusterIndices;
+uniform float clusterScale;
+uniform float clusterBias;
+uniform vec2 clusterTileSize;
+uniform sampler2D spotMapTextures[MAX_LIGHTS];
+uniform samplerCube pointShadowTextures[MAX_LIGHTS];
 
 struct Material {
 	vec3 Kd;
@@ -59,12 +82,21 @@ in vec3 viewPosition;
 in vec2 textureC;
 in vec3 fragNormal;
 in vec4 spotLightViewPositions[MAX_LIGHTS];
+flat in int lightMask;	// spot lights whose frustum reaches this instance
 in vec4 dirLightViewPositions[MAX_LIGHTS];
 
 out vec4 color;
 
+// p is in the light's [0, 1] shadow space; the lookup is kept half a texel inside the light's tile
+float SampleShadowAtlas(vec4 atlasRect, vec3 p) {
+	if (atlasRect.z == 0) return 1;
+	vec2 halfTexel = 0.5 / vec2(textureSize(shadowAtlas, 0));
+	vec2 uv = clamp(atlasRect.xy + p.xy * atlasRect.zw, atlasRect.xy + halfTexel, atlasRect.xy + atlasRect.zw - halfTexel);
+	return texture(shadowAtlas, vec3(uv, p.z));
+}
+
 vec3 CalcSpotLightComponent(int i, vec3 albedo, vec3 specular, vec3 camDir) {
-	vec3 toLight = spotLights[i].pos - viewPosition;
+	vec3 toLight = (view * vec4(spotLights[i].pos, 1)).xyz - viewPosition;
 	vec3 lightDir = normalize(toLight);
 	float diffuseComponent = max(0, dot(lightDir, normalize(fragNormal)));
 	
@@ -77,8 +109,8 @@ vec3 CalcSpotLightComponent(int i, vec3 albedo, vec3 specular, vec3 camDir) {
 	if (p.x > 1 || p.x < 0 || p.y > 1 || p.y < 0 || p.z > 1.0 || p.z < 0.0) {
 		diffuseComponent = 0; specularComponent = 0;
 	} else {
-		float litValue = texture(spotLights[i].shadowTexture, p);
-		if (spotLights[i].mapTextureSet == 1) litValue *= texture(spotLights[i].mapTexture, p.xy).x;
+		float litValue = SampleShadowAtlas(spotLights[i].atlasRect, p);
+		if (spotLights[i].mapTextureSet == 1) litValue *= texture(spotMapTextures[i], p.xy).x;
 		float coefficient = litValue * max(0., (1 - length(toLight) / spotLights[i].range));
 		diffuseComponent *= coefficient;
 		specularComponent *= coefficient;
@@ -89,47 +121,92 @@ vec3 CalcSpotLightComponent(int i, vec3 albedo, vec3 specular, vec3 camDir) {
 	return spotLights[i].intensity * shading;
 }
 
-vec3 CalcPointLightComponent(int i, vec3 albedo, vec3 specular, vec3 camDir) {
-	vec3 toLight = pointLights[i].pos - viewPosition;
+PointLight FetchPointLight(int index) {
+	vec4 a = texelFetch(clusterLights, index * 3);
+	vec4 b = texelFetch(clusterLights, index * 3 + 1);
+	vec4 c = texelFetch(clusterLights, index * 3 + 2);
+	return PointLight(a.xyz, a.w, b.xyz, b.w, c.x, int(c.y));
+}
+
+// (offset, count) of the fragment's froxel in clusterIndices
+uvec2 FetchCluster() {
+	int z = int(clamp(floor(log(-viewPosition.z) * clusterScale - clusterBias), 0.0, float(CLUSTER_Z - 1)));
+	ivec2 xy = clamp(ivec2(gl_FragCoord.xy / clusterTileSize), ivec2(0), ivec2(CLUSTER_X - 1, CLUSTER_Y - 1));
+	return texelFetch(clusterRanges, xy.x + CLUSTER_X * (xy.y + CLUSTER_Y * z)).xy;
+}
+
+// Sampler arrays can only be indexed with constants in GLSL 3.30, and the slot here comes from a buffer
+float SamplePointShadow(int index, vec3 direction) {
+	switch (index) {
+	case 0: return textureLod(pointShadowTextures[0], direction, 0).x;
+	case 1: return textureLod(pointShadowTextures[1], direction, 0).x;
+	case 2: return textureLod(pointShadowTextures[2], direction, 0).x;
+	case 3: return textureLod(pointShadowTextures[3], direction, 0).x;
+	case 4: return textureLod(pointShadowTextures[4], direction, 0).x;
+	}
+	return 1;
+}
+
+vec3 CalcPointLightComponent(PointLight light, vec3 albedo, vec3 specular, vec3 camDir) {
+	vec3 toLight = (view * vec4(light.pos, 1)).xyz - viewPosition;
 	vec3 lightDir = normalize(toLight);
 	float diffuseComponent = max(0, dot(lightDir, normalize(fragNormal)));
 	
 	vec3 bounceDir = normalize(lightDir + camDir);
 	float specularComponent = pow(max(0, dot(bounceDir, fragNormal)), material.Ns);
 
-	vec3 toLightWorld = pointLights[i].worldPos - worldPosition;
-	float sampledDistance = texture(pointLights[i].shadowTexture, -toLightWorld).x;
-	sampledDistance *= pointLights[i].far_plane;
-	bool inShadow = (length(toLightWorld) - sampledDistance) >= 0.01;
+	vec3 toLightWorld = light.pos - worldPosition;
+	bool inShadow = false;
+	if (light.shadowIndex >= 0) {
+		float sampledDistance = SamplePointShadow(light.shadowIndex, -toLightWorld) * light.far_plane;
+		inShadow = (length(toLightWorld) - sampledDistance) >= 0.01;
+	}
 	if (inShadow) {
 		diffuseComponent = 0; specularComponent = 0;
 	} else {
-		float coefficient = max(0., (1 - length(toLightWorld) / pointLights[i].range));
+		float coefficient = max(0., (1 - length(toLightWorld) / light.range));
 		diffuseComponent *= coefficient;
 		specularComponent *= coefficient;
 	}
 
 	// blinn-phong
-	vec3 shading = pointLights[i].color * (diffuseComponent * albedo) + specular * specularComponent;
-	return pointLights[i].intensity * shading;
+	vec3 shading = light.color * (diffuseComponent * albedo) + specular * specularComponent;
+	return light.intensity * shading;
 }
 
 vec3 CalcDirLightComponent(int i, vec3 albedo, vec3 specular, vec3 camDir) {
-	vec3 lightDir = normalize(-dirLights[i].dir);
+	vec3 lightDir = normalize(-mat3(view) * dirLights[i].dir);
 	float diffuseComponent = max(0, dot(lightDir, normalize(fragNormal)));
 	
 	vec3 bounceDir = normalize(lightDir + camDir);
 	float specularComponent = pow(max(0, dot(bounceDir, fragNormal)), material.Ns);
 
-	vec3 p = dirLightViewPositions[i].xyz;
-	p.z *= 0.99;
-	p /= dirLightViewPositions[i].w;
-	if (p.x > 1 || p.x < 0 || p.y > 1 || p.y < 0 || p.z > 1.0 || p.z < 0.0) {
-		diffuseComponent = 0; specularComponent = 0;
+	if (dirLights[i].nCascades > 0) {
+		// the first cascade whose slice reaches past the fragment's view depth; beyond the last one there is no shadow
+		float depth = -viewPosition.z;
+		int c = 0;
+		while (c < dirLights[i].nCascades && depth > dirLights[i].cascadeSplits[c]) c++;
+		if (c < dirLights[i].nCascades) {
+			Cascade cascade = cascades[i * MAX_CASCADES + c];
+			vec4 lightPosition = cascade.shadowMatrix * vec4(worldPosition, 1);
+			vec3 p = lightPosition.xyz / lightPosition.w;
+			if (p.z <= 1.0) {
+				float litValue = SampleShadowAtlas(cascade.atlasRect, p);
+				diffuseComponent *= litValue;
+				specularComponent *= litValue;
+			}
+		}
 	} else {
-		float litValue = texture(dirLights[i].shadowTexture, p);
-		diffuseComponent *= litValue;
-		specularComponent *= litValue;
+		vec3 p = dirLightViewPositions[i].xyz;
+		p.z *= 0.99;
+		p /= dirLightViewPositions[i].w;
+		if (p.x > 1 || p.x < 0 || p.y > 1 || p.y < 0 || p.z > 1.0 || p.z < 0.0) {
+			diffuseComponent = 0; specularComponent = 0;
+		} else {
+			float litValue = SampleShadowAtlas(dirLights[i].atlasRect, p);
+			diffuseComponent *= litValue;
+			specularComponent *= litValue;
+		}
 	}
 	
 	// blinn-phong
@@ -148,10 +225,13 @@ void main() {
 	vec3 camDir = -normalize(viewPosition);
 	vec3 shading = vec3(0.);
 	for(int i=0; i<nSpotLights; i++) {
+		if((lightMask & (1 << i)) == 0) continue;
 		shading += CalcSpotLightComponent(i, albedo, specular, camDir);
 	}
-	for(int i=0; i<nPointLights; i++) {
-		shading += CalcPointLightComponent(i, albedo, specular, camDir);
+	uvec2 cluster = FetchCluster();
+	for(uint n=0u; n<cluster.y; n++) {
+		int index = int(texelFetch(clusterIndices, int(cluster.x + n)).x);
+		shading += CalcPointLightComponent(FetchPointLight(index), albedo, specular, camDir);
 	}
 	for(int i=0; i<nDirLights; i++) {
 		shading += CalcDirLightComponent(i, albedo, specular, camDir);
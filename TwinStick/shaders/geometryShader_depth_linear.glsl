@@ -0,0 +1,33 @@
+#version 330 core
+
+layout ( triangles ) in;
+layout ( triangle_strip, max_vertices = 18 ) out;
+
+uniform mat4 faceMatrices[6];
+uniform int faceMask;
+
+out vec3 fragPos;
+
+void main() {
+	for (int face = 0; face < 6; face++) {
+		if ((faceMask & (1 << face)) == 0) continue;
+
+		vec4 clip[3];
+		for (int i = 0; i < 3; i++) {
+			clip[i] = faceMatrices[face] * gl_in[i].gl_Position;
+		}
+		// skip the face when the whole triangle lies beyond one of its side planes
+		if (clip[0].x > clip[0].w && clip[1].x > clip[1].w && clip[2].x > clip[2].w) continue;
+		if (clip[0].x < -clip[0].w && clip[1].x < -clip[1].w && clip[2].x < -clip[2].w) continue;
+		if (clip[0].y > clip[0].w && clip[1].y > clip[1].w && clip[2].y > clip[2].w) continue;
+		if (clip[0].y < -clip[0].w && clip[1].y < -clip[1].w && clip[2].y < -clip[2].w) continue;
+
+		for (int i = 0; i < 3; i++) {
+			gl_Layer = face;
+			fragPos = gl_in[i].gl_Position.xyz;
+			gl_Position = clip[i];
+			EmitVertex();
+		}
+		EndPrimitive();
+	}
+}
\ No newline at end of file
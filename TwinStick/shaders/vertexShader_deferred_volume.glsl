@@ -0,0 +1,26 @@
+#version 330 core
+
+uniform mat4 vp;
+uniform mat4 volumeMatrix;
+uniform int pointVolumes;
+uniform samplerBuffer clusterLights;
+
+layout(location=0) in vec3 position;
+
+flat out int lightIndex;
+
+// Point lights are instanced: each instance scales the unit sphere to one clustered light's range.
+// A spot light's volume is the clip-space cube taken back to world space by volumeMatrix.
+void main() {
+	vec3 world;
+	if (pointVolumes == 1) {
+		vec4 posIntensity = texelFetch(clusterLights, gl_InstanceID * 3);
+		vec4 colorRange = texelFetch(clusterLights, gl_InstanceID * 3 + 1);
+		world = posIntensity.xyz + position * colorRange.w;
+	} else {
+		vec4 corner = volumeMatrix * vec4(position, 1);
+		world = corner.xyz / corner.w;
+	}
+	lightIndex = gl_InstanceID;
+	gl_Position = vp * vec4(world, 1);
+}
\ No newline at end of file
@@ -1,10 +1,14 @@
 #version 330 core
 
 layout(location=0) in vec3 position;
+layout(location=3) in mat4 instanceModel;
 
-uniform mat4 mvp;
+uniform mat4 vp;
 
+// Must compute gl_Position exactly like the main pass shaders, which the depth prepass tests for equality
+invariant gl_Position;
 
 void main() {
-	gl_Position = mvp * vec4(position, 1);
+	vec4 world = instanceModel * vec4(position, 1);
+	gl_Position = vp * world;
 }
\ No newline at end of file
@@ -1,13 +1,9 @@
 #version 330 core
 
 layout(location=0) in vec3 position;
-
-uniform mat4 model;
-uniform mat4 mvp;
-
-out vec3 fragPos;
+layout(location=3) in mat4 instanceModel;
 
 void main() {
-	fragPos = (model * vec4(position, 1)).xyz;
-	gl_Position = mvp * vec4(position, 1);
+	// world space; the geometry shader projects it once per cube face
+	gl_Position = instanceModel * vec4(position, 1);
 }
\ No newline at end of file
@@ -0,0 +1,26 @@
+#version 330 core
+
+// Only the first member of the shared light block is needed here
+layout(std140) uniform Lights {
+	mat4 view;
+};
+
+uniform mat4 vp;
+
+layout(location=0) in vec3 position;
+layout(location=1) in vec2 textureCoord;
+layout(location=2) in vec3 normal;
+layout(location=3) in mat4 instanceModel;
+layout(location=7) in mat3 instanceNormal;
+
+out vec3 viewPosition;
+out vec2 textureC;
+out vec3 fragNormal;
+
+void main() {
+	vec4 world = instanceModel * vec4(position, 1);
+	gl_Position = vp * world;
+	viewPosition = (view * world).xyz;
+	fragNormal = mat3(view) * instanceNormal * normal;
+	textureC = textureCoord;
+}
\ No newline at end of file
@@ -1,28 +1,74 @@
 #version 330 core
 
 #define MAX_LIGHTS 5
+#define MAX_CASCADES 4
 
-uniform mat4 mvp;
-uniform mat4 mv;
-uniform mat3 mvt;
+struct SpotLight {
+	vec3 pos;
+	float intensity;
+	vec3 color;
+	float range;
+	int mapTextureSet;
+	vec4 atlasRect;
+};
+
+struct DirLight {
+	vec3 dir;
+	float intensity;
+	vec3 color;
+	int nCascades;
+	vec4 atlasRect;
+	vec4 cascadeSplits;
+};
+
+struct Cascade {
+	mat4 shadowMatrix;
+	vec4 atlasRect;
+};
+
+struct AmbientLight {
+	vec3 color;
+	float intensity;
+};
+
+layout(std140) uniform Lights {
+	mat4 view;
+	SpotLight spotLights[MAX_LIGHTS];
+	DirLight dirLights[MAX_LIGHTS];
+	AmbientLight ambientLights[MAX_LIGHTS];
+	Cascade cascades[MAX_LIGHTS * MAX_CASCADES];
+	int nSpotLights;
+	int nDirLights;
+	int nAmbientLights;
+};
+
+uniform mat4 vp;
 uniform mat4 spotShadowMatrices[MAX_LIGHTS];
-uniform int nSpotLights;
 
 layout(location=0) in vec3 position;
 layout(location=1) in vec2 textureCoord;
 layout(location=2) in vec3 normal;
+layout(location=3) in mat4 instanceModel;
+layout(location=7) in mat3 instanceNormal;
+layout(location=10) in int instanceLightMask;
 
 out vec3 viewPosition;
 out vec2 textureC;
 out vec3 fragNormal;
 out vec4 spotLightViewPositions[MAX_LIGHTS];
+flat out int lightMask;
+
+invariant gl_Position;
 
 void main() {
-	gl_Position = mvp * vec4(position, 1);
-	viewPosition = (mv * vec4(position, 1)).xyz;
-	fragNormal = mvt * normal;
+	vec4 world = instanceModel * vec4(position, 1);
+	gl_Position = vp * world;
+	viewPosition = (view * world).xyz;
+	fragNormal = mat3(view) * instanceNormal * normal;
 	textureC = textureCoord;
+	lightMask = instanceLightMask;
 	for(int i=0; i<nSpotLights; i++) {
-		spotLightViewPositions[i] = spotShadowMatrices[i] * vec4(position,1);
+		if((instanceLightMask & (1 << i)) == 0) continue;
+		spotLightViewPositions[i] = spotShadowMatrices[i] * world;
 	}
 }
\ No newline at end of file
@@ -2,12 +2,13 @@
 
 layout(location=0) in vec3 position;
 layout(location=1) in vec2 textureCoord;
+layout(location=3) in mat4 instanceModel;
 
 out vec2 vTextureC;
 
-uniform mat4 mvp;
+uniform mat4 vp;
 
 void main() {
-	gl_Position = mvp*vec4(position, 1);
+	gl_Position = vp*(instanceModel*vec4(position, 1));
 	vTextureC = textureCoord;
 }
\ No newline at end of file
@@ -1,13 +1,17 @@
 #version 330 core
 
-uniform mat4 mvp;
+uniform mat4 vp;
 layout(location=0) in vec3 position;
 layout(location=1) in vec2 textureCoord;
 layout(location=2) in vec3 normal;
+layout(location=3) in mat4 instanceModel;
 
 out vec2 textureC;
 
+invariant gl_Position;
+
 void main() {
-	gl_Position = mvp * vec4(position, 1);
+	vec4 world = instanceModel * vec4(position, 1);
+	gl_Position = vp * world;
 	textureC = textureCoord;
 }
\ No newline at end of file
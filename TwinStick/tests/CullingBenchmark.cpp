@@ -0,0 +1,92 @@
+// Frustum culling microbenchmark for BoxesSoA::Cull at 1k, 10k and 100k boxes. Checks every lane
+// mask against a plain per-box test, then times culling all boxes against one frustum.
+// Build it twice from the project folder to compare the two paths:
+//   cl /std:c++17 /O2 /EHsc /Iheaders tests\CullingBenchmark.cpp
+//   cl /std:c++17 /O2 /EHsc /Iheaders /DSG_CULL_SCALAR tests\CullingBenchmark.cpp
+#include <cstdio>
+#include <chrono>
+#include <random>
+#include <vector>
+#include <sgFrustumCulling.h>
+
+#define BENCHMARK_BOX_TESTS 50000000
+
+static sg::Plane MakePlane(glm::vec3 point, glm::vec3 normal) {
+    return sg::Plane(point, glm::normalize(normal));
+}
+
+// A slanted box-shaped frustum around the middle of the scene, which about a fifth of the boxes fall inside
+static sg::Frustum MakeFrustum() {
+    sg::Frustum frustum;
+    frustum.leftFace = MakePlane(glm::vec3(-50, 0, 0), glm::vec3(1, 0, 0.2f));
+    frustum.rightFace = MakePlane(glm::vec3(50, 0, 0), glm::vec3(-1, 0, 0.2f));
+    frustum.bottomFace = MakePlane(glm::vec3(0, -50, 0), glm::vec3(0, 1, 0.2f));
+    frustum.topFace = MakePlane(glm::vec3(0, 50, 0), glm::vec3(0, -1, 0.2f));
+    frustum.nearFace = MakePlane(glm::vec3(0, 0, -100), glm::vec3(0, 0, 1));
+    frustum.farFace = MakePlane(glm::vec3(0, 0, 60), glm::vec3(0, 0, -1));
+    return frustum;
+}
+
+static bool Reference(const sg::FrustumPlanes& planes, glm::vec3 min, glm::vec3 max) {
+    glm::vec3 center = (min + max) * 0.5f;
+    glm::vec3 extents = max - center;
+    for (int p = 0; p < 6; p++) {
+        float distance = center.x * planes.nx[p] + center.y * planes.ny[p] + center.z * planes.nz[p] - planes.d[p];
+        float radius = extents.x * planes.ax[p] + extents.y * planes.ay[p] + extents.z * planes.az[p];
+        if (distance + radius < 0) return false;
+    }
+    return true;
+}
+
+int main() {
+#ifdef SG_CULL_SSE
+    printf("BoxesSoA::Cull, SSE path\n");
+#else
+    printf("BoxesSoA::Cull, scalar path\n");
+#endif
+    sg::FrustumPlanes planes(MakeFrustum());
+    std::mt19937 random(1);
+    std::uniform_real_distribution<float> position(-100, 100);
+    std::uniform_real_distribution<float> size(0.5f, 4.0f);
+    int failures = 0;
+
+    for (int count : { 1000, 10000, 100000 }) {
+        sg::BoxesSoA boxes;
+        boxes.Resize(count);
+        std::vector<glm::vec3> mins(count), maxs(count);
+        for (int i = 0; i < count; i++) {
+            mins[i] = glm::vec3(position(random), position(random), position(random));
+            maxs[i] = mins[i] + glm::vec3(size(random), size(random), size(random));
+            boxes.Set(i, mins[i], maxs[i]);
+        }
+
+        int visible = 0;
+        for (int first = 0; first < count; first += CULL_LANES) {
+            int mask = boxes.Cull(planes, first);
+            for (int lane = 0; lane < CULL_LANES && first + lane < count; lane++) {
+                bool inside = (mask >> lane) & 1;
+                if (inside != Reference(planes, mins[first + lane], maxs[first + lane])) failures++;
+                visible += inside;
+            }
+        }
+
+        int repeats = BENCHMARK_BOX_TESTS / count;
+        int checksum = 0;
+        auto start = std::chrono::steady_clock::now();
+        for (int r = 0; r < repeats; r++) {
+            for (int first = 0; first < count; first += CULL_LANES) {
+                checksum += boxes.Cull(planes, first);
+            }
+        }
+        double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        printf("%6d boxes: %5d visible, %8.2f us per cull, %5.2f ns per box (checksum %d)\n",
+            count, visible, ms * 1000 / repeats, ms * 1e6 / ((double)repeats * count), checksum);
+    }
+
+    if (failures > 0) {
+        printf("FAILED: %d boxes disagree with the reference test\n", failures);
+        return 1;
+    }
+    printf("All lane masks match the reference test\n");
+    return 0;
+}
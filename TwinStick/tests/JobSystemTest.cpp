@@ -0,0 +1,126 @@
+// Correctness checks and a scaling benchmark for sg::JobSystem. Needs nothing but the job system header:
+//   cl /std:c++17 /O2 /EHsc /Iheaders tests\JobSystemTest.cpp
+// Returns non-zero when a check fails.
+#include <cstdio>
+#include <cmath>
+#include <chrono>
+#include <atomic>
+#include <vector>
+#include <sgJobSystem.h>
+
+#define BENCHMARK_ITEMS 4000000
+#define BENCHMARK_REPEATS 10
+
+static int failures = 0;
+
+static void Check(bool condition, const char* what, int nThreads) {
+    if (condition) return;
+    printf("FAILED with %d threads: %s\n", nThreads, what);
+    failures++;
+}
+
+// Every index in [0, count) is visited exactly once, whatever the batch size
+static void TestParallelFor(sg::JobSystem& jobs, int nThreads) {
+    for (int count : { 0, 1, 15, 16, 17, 1000, 100003 }) {
+        for (int batchSize : { 0, 1, 7, 64 }) {
+            std::vector<std::atomic<int>> visits(count);
+            for (auto& v : visits) v = 0;
+            jobs.ParallelFor(count, batchSize, [&visits](int first, int last) {
+                for (int i = first; i < last; i++) visits[i]++;
+            });
+            bool once = true;
+            for (auto& v : visits) once &= v == 1;
+            Check(once, "ParallelFor visits every index once", nThreads);
+        }
+    }
+}
+
+// Wait returns only after every job of its fork ran, including forks nested inside jobs
+static void TestNestedForks(sg::JobSystem& jobs, int nThreads) {
+    std::atomic<int> sum(0);
+    sg::JobCounter outer(0);
+    for (int i = 0; i < 64; i++) {
+        jobs.Run([&jobs, &sum]() {
+            sg::JobCounter inner(0);
+            for (int j = 0; j < 16; j++) jobs.Run([&sum]() { sum++; }, &inner);
+            jobs.Wait(inner);
+            sum += 100;
+        }, &outer);
+    }
+    jobs.Wait(outer);
+    Check(outer == 0, "outer counter back to zero", nThreads);
+    Check(sum == 64 * (16 + 100), "every nested job ran before its fork joined", nThreads);
+}
+
+// Jobs queued by the main thread are taken by the workers while it waits
+static void TestStealing(sg::JobSystem& jobs, int nThreads) {
+    std::atomic<int> byWorkers(0);
+    sg::JobCounter counter(0);
+    for (int i = 0; i < 32; i++) {
+        jobs.Run([&jobs, &byWorkers]() {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            if (jobs.GetThreadIndex() != 0) byWorkers++;
+        }, &counter);
+    }
+    jobs.Wait(counter);
+    if (nThreads > 1) Check(byWorkers > 0, "workers steal from the main thread's queue", nThreads);
+    else Check(byWorkers == 0, "a single thread runs everything itself", nThreads);
+}
+
+// Background jobs all run, and never on a thread that is joining a fork
+static void TestBackground(sg::JobSystem& jobs, int nThreads) {
+    std::atomic<int> done(0);
+    std::atomic<int> onMain(0);
+    for (int i = 0; i < 8; i++) {
+        jobs.RunBackground([&jobs, &done, &onMain]() {
+            std::this_thread::sleep_for(std::chrono::milliseconds(2));
+            if (jobs.GetThreadIndex() == 0) onMain++;
+            done++;
+        });
+    }
+    // Frame-style joins while the background jobs are queued
+    for (int frame = 0; frame < 20; frame++) {
+        jobs.ParallelFor(1000, 0, [](int, int) {});
+    }
+    while (done < 8) std::this_thread::yield();
+    if (nThreads > 1) Check(onMain == 0, "background jobs stay off the joining thread", nThreads);
+}
+
+static double Benchmark(int nThreads, std::vector<float>& data) {
+    sg::JobSystem jobs;
+    jobs.Init(nThreads);
+    auto start = std::chrono::steady_clock::now();
+    for (int r = 0; r < BENCHMARK_REPEATS; r++) {
+        jobs.ParallelFor((int)data.size(), 0, [&data, r](int first, int last) {
+            for (int i = first; i < last; i++) data[i] = sinf(i * 0.001f + r) * cosf(i * 0.002f);
+        });
+    }
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+int main() {
+    int hardwareThreads = std::max((int)std::thread::hardware_concurrency(), 1);
+    std::vector<int> threadCounts = { 1, 2, 4 };
+    if (hardwareThreads > 4) threadCounts.push_back(hardwareThreads);
+
+    for (int nThreads : threadCounts) {
+        sg::JobSystem jobs;
+        jobs.Init(nThreads);
+        Check(jobs.GetNThreads() == nThreads, "GetNThreads matches Init", nThreads);
+        TestParallelFor(jobs, nThreads);
+        TestNestedForks(jobs, nThreads);
+        TestStealing(jobs, nThreads);
+        TestBackground(jobs, nThreads);
+    }
+    printf("%s\n", failures == 0 ? "All job system checks passed" : "Job system checks FAILED");
+
+    printf("ParallelFor over %d items, %d times, on %d hardware threads:\n", BENCHMARK_ITEMS, BENCHMARK_REPEATS, hardwareThreads);
+    std::vector<float> data(BENCHMARK_ITEMS);
+    double serial = 0;
+    for (int nThreads : threadCounts) {
+        double ms = Benchmark(nThreads, data);
+        if (nThreads == 1) serial = ms;
+        printf("%3d threads: %8.1f ms, speedup %.2fx\n", nThreads, ms, serial / ms);
+    }
+    return failures == 0 ? 0 : 1;
+}